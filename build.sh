@@ -1,20 +1,36 @@
 #!/bin/sh
 set -xe
-SRC="src/main.c src/vector.c src/image.c src/system/bmp.c \
+MAIN="src/main.c"
+NAME="imp"
+if [ "$1" = "test" ]; then
+    # the module self tests replace main, they are run once built
+    MAIN="src/selftest.c src/system/lz-test.c src/history-test.c src/fill-test.c src/tiles-test.c src/system/bmp-test.c \
+src/system/png-test.c src/raster-test.c"
+    NAME="imp-test"
+fi
+
+SRC="$MAIN src/batch.c src/vector.c src/image.c src/pipeline.c src/convolve.c src/quantize.c src/random.c src/system/bmp.c \
 src/imp.c src/ui/toolmenu.c src/ui/actionmenu.c src/ui/colormenu.c src/system/palette.c \
-src/canvas.c src/cursor.c"
-CFLAGS="-Wall -Wextra -Wshadow -Wno-unused-function -g"
+src/canvas.c src/cursor.c src/system/parallel.c src/system/arena.c src/system/asyncio.c src/system/png.c src/system/lz.c src/history.c src/fill.c src/brush.c src/raster.c src/tiles.c"
+CFLAGS="-Wall -Wextra -Wshadow -Wno-unused-function -pthread -g"
 
 mkdir -p build
 
 if [[ "$OSTYPE" == "linux-gnu"* ]]; then
-    cc $CFLAGS $SRC -I src -o imp `sdl2-config --cflags --libs` -lSDL2_image -lm
+    BIN="./$NAME"
+    cc $CFLAGS $SRC -I src -o $BIN `sdl2-config --cflags --libs` -lSDL2_image -lz -lm
 elif [[ "$OSTYPE" == "msys" ]]; then
     # include and lib folders from SDL2-devel/i686-w64-mingw32
-    cc $CFLAGS $SRC -I src -I include -L lib -o build/imp -lSDL2_image -lmingw32 -lSDL2main -lSDL2 -lm
+    BIN="build/$NAME"
+    cc $CFLAGS $SRC -I src -I include -L lib -o $BIN -lSDL2_image -lmingw32 -lSDL2main -lSDL2 -lz -lm
 else
 	# assumming cygwin
     # include and lib folders from SDL2-devel/i686-w64-mingw32
-    cc $CFLAGS $SRC -I src -I include -L lib -o build/imp -lSDL2_image -lmingw32 -lSDL2main -lSDL2
+    BIN="build/$NAME"
+    cc $CFLAGS $SRC -I src -I include -L lib -o $BIN -lSDL2_image -lmingw32 -lSDL2main -lSDL2 -lz
+fi
+
+if [ "$1" = "test" ]; then
+    $BIN
 fi
 
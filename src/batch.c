@@ -0,0 +1,586 @@
+/* batch.c - read -> filter -> write pipeline over files, see batch.h */
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include "batch.h"
+#include "convolve.h"
+#include "image.h"
+#include "pipeline.h"
+#include "system/bmp.h"
+#include "system/palette.h"
+#include "system/parallel.h"
+#include "vector.h"
+
+#define MAX_STEPS 32
+// images in flight between two stages, bounds memory use to a few decoded images per queue
+#define QUEUE_CAPACITY 4
+#define MAX_WORKERS 64
+
+VECTOR_DEFINE_STATIC(StrVec, char *)
+
+static const ImpPixelFormat FORMAT_BGRA32 = {.bytes_per_pixel = 4, .red = 2, .green = 1, .blue = 0};
+
+static void usage(void) {
+    fprintf(stderr,
+            "imp --batch -o outdir -f filter[,filter...] [-j workers] [-s seed] files/dirs...\n"
+            "filters: invert grayscale two-tone:RRGGBB/RRGGBB noise:amplitude\n"
+            "         gaussian-noise:sigma salt-pepper:density dither[:palette]\n"
+            "         dither-single[:palette] quantize[:palette|:N] blur:radius gaussian:sigma\n"
+            "         sharpen sobel laplacian unsharp:sigma\n"
+            "palettes are files as in res/palettes, the default palette is used without one.\n"
+            "quantize:N generates N colors from each image instead\n");
+}
+
+typedef enum {
+    STEP_PIXEL, // runs of per-pixel filters fused into one pipeline
+    STEP_BOX_BLUR,
+    STEP_GAUSSIAN_BLUR,
+    STEP_SHARPEN,
+    STEP_SOBEL,
+    STEP_LAPLACIAN,
+    STEP_UNSHARP,
+    STEP_QUANTIZE,  // to a palette of arg colors generated from the image itself
+} StepType;
+
+typedef struct {
+    StepType type;
+    ImpPipeline *pipeline;
+    double arg;
+} Step;
+
+typedef struct {
+    char *src;
+    char *dest;
+    uchar *pixels;
+    unsigned w, h, bytes_per_pixel;
+    size_t file_bytes;
+} Item;
+
+/** fixed size ring of items, push blocks while full and pop while empty and not closed */
+typedef struct {
+    Item *items[QUEUE_CAPACITY];
+    size_t head, count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} Queue;
+
+typedef struct {
+    Step steps[MAX_STEPS];
+    size_t nsteps;
+    ImpPalette palettes[MAX_STEPS];
+    size_t npalettes;
+    StrVec files;
+    const char *outdir;
+    Queue loaded, processed;
+    int nworkers, workers_left;
+    pthread_mutex_t workers_lock;
+} Batch;
+
+static void queue_init(Queue *q) {
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_destroy(Queue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+static void queue_push(Queue *q, Item *item) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == QUEUE_CAPACITY)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    q->items[(q->head + q->count++) % QUEUE_CAPACITY] = item;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// NULL once the queue is closed and drained
+static Item *queue_pop(Queue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    Item *item = NULL;
+    if (q->count) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % QUEUE_CAPACITY;
+        --q->count;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+static void queue_close(Queue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void item_free(Item *item) {
+    free(item->src);
+    free(item->dest);
+    free(item->pixels);
+    free(item);
+}
+
+static int has_extension(const char *path, const char *ext) {
+    size_t n = strlen(path), m = strlen(ext);
+    if (n < m)
+        return 0;
+    for (size_t i = 0; i < m; ++i)
+        if (tolower((uchar)path[n - m + i]) != ext[i])
+            return 0;
+    return 1;
+}
+
+static int is_image(const char *path) {
+    return has_extension(path, ".bmp") || has_extension(path, ".png");
+}
+
+static int add_file(Batch *b, const char *path) {
+    char *file = strdup(path);
+    if (!file || StrVec_push(&b->files, file) != 0) {
+        free(file);
+        return -1;
+    }
+    return 0;
+}
+
+// directories contribute their .bmp and .png files, without recursing
+static int collect_files(Batch *b, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "batch: not found: '%s'\n", path);
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode))
+        return add_file(b, path);
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "batch: cannot open directory: '%s'\n", path);
+        return -1;
+    }
+    struct dirent *entry;
+    int status = 0;
+    while ((entry = readdir(dir)) && status == 0) {
+        if (!is_image(entry->d_name))
+            continue;
+        size_t n = strlen(path) + strlen(entry->d_name) + 2;
+        char *file = malloc(n);
+        if (!file) {
+            status = -1;
+            break;
+        }
+        snprintf(file, n, "%s/%s", path, entry->d_name);
+        status = add_file(b, file);
+        free(file);
+    }
+    closedir(dir);
+    return status;
+}
+
+// palette files are compiled once and mapped from the cache on later runs
+static int step_palette(Batch *b, const char *arg, ImpFilter *f) {
+    ImpPalette *palette = &b->palettes[b->npalettes];
+    if (palette_open(palette, arg) != 0)
+        return -1;
+    ++b->npalettes;
+    f->palette = palette->colors;
+    f->palette_size = palette->ncolors;
+    f->palette_index = palette;
+    return 0;
+}
+
+// appends a per-pixel filter to the pipeline of the last step, starting one when needed
+static int push_pixel_filter(Batch *b, ImpFilter filter) {
+    if (b->nsteps == 0 || b->steps[b->nsteps - 1].type != STEP_PIXEL) {
+        if (b->nsteps == MAX_STEPS)
+            return -1;
+        Step *step = &b->steps[b->nsteps];
+        step->type = STEP_PIXEL;
+        if (!(step->pipeline = pipeline_create()))
+            return -1;
+        ++b->nsteps;
+    }
+    return pipeline_push(b->steps[b->nsteps - 1].pipeline, filter);
+}
+
+static int push_step(Batch *b, StepType type, double arg) {
+    if (b->nsteps == MAX_STEPS)
+        return -1;
+    b->steps[b->nsteps++] = (Step){.type = type, .arg = arg};
+    return 0;
+}
+
+static bool is_count(const char *arg) {
+    if (!arg || !*arg)
+        return false;
+    for (; *arg; ++arg)
+        if (!isdigit((uchar)*arg))
+            return false;
+    return true;
+}
+
+// one `name[:arg]` token of the -f option
+static int parse_filter(Batch *b, char *token, uint64_t seed) {
+    char *arg = strchr(token, ':');
+    if (arg)
+        *arg++ = '\0';
+    ImpFilter f = {.seed = seed};
+
+    if (!strcmp(token, "invert")) {
+        f.type = IMP_FILTER_INVERT;
+    } else if (!strcmp(token, "grayscale")) {
+        f.type = IMP_FILTER_GRAYSCALE;
+    } else if (!strcmp(token, "two-tone")) {
+        f.type = IMP_FILTER_TWO_TONE;
+        if (!arg || sscanf(arg, "%x/%x", &f.tone1, &f.tone2) != 2)
+            return -1;
+    } else if (!strcmp(token, "noise") && arg) {
+        f.type = IMP_FILTER_BERNOULLI_NOISE;
+        f.amplitude = atoi(arg);
+    } else if (!strcmp(token, "gaussian-noise") && arg) {
+        f.type = IMP_FILTER_GAUSSIAN_NOISE;
+        f.sigma = atof(arg);
+    } else if (!strcmp(token, "salt-pepper") && arg) {
+        f.type = IMP_FILTER_SALT_AND_PEPPER_NOISE;
+        f.density = atof(arg);
+    } else if (!strcmp(token, "quantize") && is_count(arg)) {
+        long n = atol(arg);
+        if (n < 1 || n > PALETTE_MAX_COLORS)
+            return -1;
+        return push_step(b, STEP_QUANTIZE, n);
+    } else if (!strcmp(token, "dither") || !strcmp(token, "dither-single") ||
+               !strcmp(token, "quantize")) {
+        f.type = !strcmp(token, "dither")          ? IMP_FILTER_DITHER_TRIPLE_CHANNEL
+                 : !strcmp(token, "dither-single") ? IMP_FILTER_DITHER_SINGLE_CHANNEL
+                                                   : IMP_FILTER_PALETTE_QUANTIZATION;
+        if (b->npalettes == MAX_STEPS || step_palette(b, arg, &f) != 0)
+            return -1;
+    } else if (!strcmp(token, "blur") && arg) {
+        return push_step(b, STEP_BOX_BLUR, atoi(arg));
+    } else if (!strcmp(token, "gaussian") && arg) {
+        return push_step(b, STEP_GAUSSIAN_BLUR, atof(arg));
+    } else if (!strcmp(token, "sharpen")) {
+        return push_step(b, STEP_SHARPEN, 0);
+    } else if (!strcmp(token, "sobel")) {
+        return push_step(b, STEP_SOBEL, 0);
+    } else if (!strcmp(token, "laplacian")) {
+        return push_step(b, STEP_LAPLACIAN, 0);
+    } else if (!strcmp(token, "unsharp") && arg) {
+        return push_step(b, STEP_UNSHARP, atof(arg));
+    } else {
+        return -1;
+    }
+    return push_pixel_filter(b, f);
+}
+
+static int parse_filters(Batch *b, char *spec, uint64_t seed) {
+    for (char *token = strtok(spec, ","); token; token = strtok(NULL, ",")) {
+        if (parse_filter(b, token, seed) != 0) {
+            fprintf(stderr, "batch: bad filter '%s'\n", token);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// PNGs (and anything else SDL_image reads) are converted to packed BGR
+static int load_with_sdl(Item *item) {
+    SDL_Surface *surf = IMG_Load(item->src);
+    if (!surf) {
+        fprintf(stderr, "batch: could not load '%s': %s\n", item->src, SDL_GetError());
+        return -1;
+    }
+    SDL_Surface *bgr = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_BGR24, 0);
+    SDL_FreeSurface(surf);
+    if (!bgr)
+        return -1;
+
+    item->w = bgr->w;
+    item->h = bgr->h;
+    item->bytes_per_pixel = 3;
+    size_t row = 3 * (size_t)bgr->w;
+    if ((item->pixels = malloc(row * bgr->h + 1))) {
+        for (int y = 0; y < bgr->h; ++y)
+            memcpy(item->pixels + y * row, (uchar *)bgr->pixels + (size_t)y * bgr->pitch, row);
+    }
+    SDL_FreeSurface(bgr);
+    return item->pixels ? 0 : -1;
+}
+
+static int load_item(Item *item) {
+    struct stat st;
+    item->file_bytes = stat(item->src, &st) == 0 ? st.st_size : 0;
+    if (!has_extension(item->src, ".bmp"))
+        return load_with_sdl(item);
+
+    BMP_file bmp;
+    if (BMP_load(&bmp, item->src) != 0)
+        return -1;
+    item->pixels = bmp.image_raw;
+    item->w = bmp.w;
+    item->h = bmp.h;
+    item->bytes_per_pixel = bmp.bytes_per_pixel;
+    bmp.image_raw = NULL;
+    BMP_free(&bmp);
+    return 0;
+}
+
+// file name part of path
+static const char *base_name(const char *path) {
+    const char *name = strrchr(path, '/');
+#ifdef _WIN32
+    const char *back = strrchr(path, '\\');
+    if (back && (!name || back > name))
+        name = back;
+#endif
+    return name ? name + 1 : path;
+}
+
+// outdir/<name>.bmp
+static char *dest_path(const char *outdir, const char *src) {
+    const char *name = base_name(src);
+    size_t stem = strrchr(name, '.') ? (size_t)(strrchr(name, '.') - name) : strlen(name);
+    size_t n = strlen(outdir) + stem + 6;
+    char *dest = malloc(n);
+    if (dest)
+        snprintf(dest, n, "%s/%.*s.bmp", outdir, (int)stem, name);
+    return dest;
+}
+
+static int compare_paths(const void *a, const void *b) {
+#ifdef _WIN32
+    return _stricmp(*(char *const *)a, *(char *const *)b);
+#else
+    return strcmp(*(char *const *)a, *(char *const *)b);
+#endif
+}
+
+// every output is <stem>.bmp, so a.bmp and a.png (or a file given twice) would overwrite each other
+static int check_destinations(const Batch *b) {
+    char **dests = calloc(b->files.size + 1, sizeof(char *));
+    int status = dests ? 0 : -1;
+    for (size_t i = 0; i < b->files.size && status == 0; ++i)
+        if (!(dests[i] = dest_path(b->outdir, b->files.arr[i])))
+            status = -1;
+
+    if (status == 0) {
+        qsort(dests, b->files.size, sizeof(char *), compare_paths);
+        for (size_t i = 1; i < b->files.size && status == 0; ++i) {
+            if (compare_paths(&dests[i - 1], &dests[i]) == 0) {
+                fprintf(stderr, "batch: more than one input would be written to '%s'\n", dests[i]);
+                status = -1;
+            }
+        }
+    }
+    for (size_t i = 0; dests && i < b->files.size; ++i)
+        free(dests[i]);
+    free(dests);
+    return status;
+}
+
+static void *reader_thread(void *arg) {
+    Batch *b = arg;
+    for (size_t i = 0; i < b->files.size; ++i) {
+        Item *item = calloc(1, sizeof(Item));
+        if (!item || !(item->src = strdup(b->files.arr[i])) || !(item->dest = dest_path(b->outdir, item->src)) ||
+            load_item(item) != 0) {
+            // failed items still travel down the pipeline so they are counted once by the writer
+            if (item) {
+                free(item->pixels);
+                item->pixels = NULL;
+            }
+        }
+        if (item)
+            queue_push(&b->loaded, item);
+    }
+    queue_close(&b->loaded);
+    return NULL;
+}
+
+// median cut and k-means over this image's colors, then every pixel to the nearest of them
+static int quantize_generated(const ImpImage *image, size_t ncolors) {
+    U32Vec colors;
+    U32Vec_init(&colors);
+    ImpPalette palette;
+    size_t size = image->width * image->height * image->format.bytes_per_pixel;
+    if (generate_palette(&colors, image->pixels, size, image->format.bytes_per_pixel, ncolors) != 0 ||
+        palette_build(&palette, colors.arr, colors.size) != 0) {
+        U32Vec_free(&colors);
+        return -1;
+    }
+    ImpFilter f = {
+        .type = IMP_FILTER_PALETTE_QUANTIZATION,
+        .palette = palette.colors,
+        .palette_size = palette.ncolors,
+        .palette_index = &palette,
+    };
+    apply_filter_image(&f, image);
+    palette_close(&palette);
+    U32Vec_free(&colors);
+    return 0;
+}
+
+static int process_item(Batch *b, Item *item) {
+    ImpImage image = {item->pixels, item->w, item->h,
+                      item->bytes_per_pixel == 4 ? FORMAT_BGRA32 : IMP_FORMAT_BGR24};
+    for (size_t i = 0; i < b->nsteps; ++i) {
+        const Step *s = &b->steps[i];
+        int status = 0;
+        switch (s->type) {
+        case STEP_PIXEL: pipeline_run_image(s->pipeline, &image); break;
+        case STEP_BOX_BLUR: status = box_blur(&image, (int)s->arg); break;
+        case STEP_GAUSSIAN_BLUR: status = gaussian_blur(&image, s->arg); break;
+        case STEP_SHARPEN: status = sharpen(&image); break;
+        case STEP_SOBEL: status = sobel(&image); break;
+        case STEP_LAPLACIAN: status = laplacian(&image); break;
+        case STEP_UNSHARP: status = unsharp_mask(&image, s->arg, 1.0, 0); break;
+        case STEP_QUANTIZE: status = quantize_generated(&image, (size_t)s->arg); break;
+        }
+        if (status != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void *worker_thread(void *arg) {
+    Batch *b = arg;
+    Item *item;
+    while ((item = queue_pop(&b->loaded))) {
+        if (item->pixels && process_item(b, item) != 0) {
+            fprintf(stderr, "batch: out of memory filtering '%s'\n", item->src);
+            free(item->pixels);
+            item->pixels = NULL;
+        }
+        queue_push(&b->processed, item);
+    }
+
+    // the last worker out lets the writer finish
+    pthread_mutex_lock(&b->workers_lock);
+    if (--b->workers_left == 0)
+        queue_close(&b->processed);
+    pthread_mutex_unlock(&b->workers_lock);
+    return NULL;
+}
+
+static int parse_args(Batch *b, int argc, char *argv[]) {
+    char *filters = NULL;
+    uint64_t seed = 0;
+    b->nworkers = 1;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (i + 1 == argc) {
+            usage();
+            return -1;
+        }
+        if (!strcmp(argv[i], "-o"))
+            b->outdir = argv[++i];
+        else if (!strcmp(argv[i], "-f"))
+            filters = argv[++i];
+        else if (!strcmp(argv[i], "-j"))
+            b->nworkers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s"))
+            seed = strtoull(argv[++i], NULL, 10);
+        else {
+            usage();
+            return -1;
+        }
+    }
+    if (!b->outdir || !filters || i == argc || b->nworkers < 1 || b->nworkers > MAX_WORKERS) {
+        usage();
+        return -1;
+    }
+
+    if (parse_filters(b, filters, seed) != 0)
+        return -1;
+    for (; i < argc; ++i)
+        if (collect_files(b, argv[i]) != 0)
+            return -1;
+    return check_destinations(b);
+}
+
+static void batch_free(Batch *b) {
+    for (size_t i = 0; i < b->nsteps; ++i)
+        if (b->steps[i].pipeline)
+            pipeline_free(b->steps[i].pipeline);
+    for (size_t i = 0; i < b->npalettes; ++i)
+        palette_close(&b->palettes[i]);
+    for (size_t i = 0; i < b->files.size; ++i)
+        free(b->files.arr[i]);
+    StrVec_free(&b->files);
+}
+
+int batch_main(int argc, char *argv[]) {
+    Batch *b = calloc(1, sizeof(Batch));
+    if (!b)
+        return EXIT_FAILURE;
+    if (parse_args(b, argc, argv) != 0) {
+        batch_free(b);
+        free(b);
+        return EXIT_FAILURE;
+    }
+    IMG_Init(IMG_INIT_PNG);
+
+    // whole-image workers share the cpus the filters would otherwise spread over
+    int nthreads = parallel_nthreads() / b->nworkers;
+    parallel_set_nthreads(nthreads > 0 ? nthreads : 1);
+
+    queue_init(&b->loaded);
+    queue_init(&b->processed);
+    pthread_mutex_init(&b->workers_lock, NULL);
+    b->workers_left = b->nworkers;
+
+    uint64_t t0 = SDL_GetPerformanceCounter();
+    pthread_t reader, workers[MAX_WORKERS];
+    pthread_create(&reader, NULL, reader_thread, b);
+    for (int i = 0; i < b->nworkers; ++i)
+        pthread_create(&workers[i], NULL, worker_thread, b);
+
+    // this thread is the writer stage
+    size_t ndone = 0, nfailed = 0, bytes_in = 0, bytes_out = 0;
+    Item *item;
+    while ((item = queue_pop(&b->processed))) {
+        if (item->pixels &&
+            BMP_write_buffer(item->pixels, item->w, item->h, item->bytes_per_pixel, item->dest) == 0) {
+            struct stat st;
+            bytes_in += item->file_bytes;
+            bytes_out += stat(item->dest, &st) == 0 ? st.st_size : 0;
+            ++ndone;
+        } else {
+            fprintf(stderr, "batch: failed: '%s'\n", item->src);
+            ++nfailed;
+        }
+        item_free(item);
+    }
+
+    pthread_join(reader, NULL);
+    for (int i = 0; i < b->nworkers; ++i)
+        pthread_join(workers[i], NULL);
+    double seconds = (double)(SDL_GetPerformanceCounter() - t0) / SDL_GetPerformanceFrequency();
+
+    printf("%zu images (%zu failed) in %.3f s: %.1f images/s, %.1f MB/s read, %.1f MB/s written\n",
+           ndone, nfailed, seconds, ndone / seconds, bytes_in / 1e6 / seconds,
+           bytes_out / 1e6 / seconds);
+
+    queue_destroy(&b->loaded);
+    queue_destroy(&b->processed);
+    pthread_mutex_destroy(&b->workers_lock);
+    batch_free(b);
+    free(b);
+    return nfailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
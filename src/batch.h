@@ -0,0 +1,12 @@
+/* batch.h - headless filtering of many image files */
+#ifndef BATCH_H
+#define BATCH_H
+
+/**
+ * entry point of `imp --batch`, argv[0] is "--batch". files are read, filtered and written by
+ * separate stages connected through bounded queues so disk and cpu work overlap.
+ * returns 0 when every file was processed
+ */
+int batch_main(int argc, char *argv[]);
+
+#endif
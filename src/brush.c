@@ -0,0 +1,117 @@
+#include "brush.h"
+#include "raster.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUBPIXEL_PHASES 4
+
+static float clampf(float v, float lo, float hi) { return v < lo ? lo : v > hi ? hi : v; }
+
+static void fill_mask(uchar *mask, int dim, ImpBrushShape shape, float cx, float cy, float radius,
+                      bool smooth) {
+    for (int y = 0; y < dim; ++y) {
+        for (int x = 0; x < dim; ++x) {
+            float d = hypotf(x - cx, y - cy);
+            float coverage;
+            if (shape == IMP_BRUSH_ROUND) {
+                coverage = smooth ? clampf(radius - d + 0.5f, 0.0f, 1.0f) : d <= radius;
+            } else if (shape == IMP_BRUSH_SOFT) {
+                float t = clampf(d / radius, 0.0f, 1.0f);
+                coverage = (1.0f - t * t) * (1.0f - t * t);
+            } else {
+                coverage = fabsf(x - cx) <= radius && fabsf(y - cy) <= radius;
+            }
+            mask[y * dim + x] = (uchar)lroundf(coverage * 255.0f);
+        }
+    }
+}
+
+int brush_init(ImpBrush *brush, ImpBrushShape shape, int size, bool subpixel) {
+    size = size > 1 ? size : 1;
+    // squares have no edge to smooth
+    int phases = subpixel && shape != IMP_BRUSH_SQUARE ? SUBPIXEL_PHASES : 1;
+    int dim = size + (phases > 1);
+    uchar *mask = malloc((size_t)phases * phases * dim * dim);
+    if (!mask) {
+        return -1;
+    }
+    // the mask at phase (px, py) is centred that many fractions of a pixel right and down
+    float centre = (size - 1) / 2.0f, radius = size / 2.0f;
+    for (int py = 0; py < phases; ++py) {
+        for (int px = 0; px < phases; ++px) {
+            uchar *m = mask + (size_t)(py * phases + px) * dim * dim;
+            fill_mask(m, dim, shape, centre + (float)px / phases, centre + (float)py / phases, radius,
+                      subpixel);
+        }
+    }
+    brush->shape = shape;
+    brush->size = size;
+    brush->subpixel = subpixel;
+    brush->phases = phases;
+    brush->dim = dim;
+    brush->mask = mask;
+    // overlapping soft stamps need to be closer for the falloff to stay smooth
+    brush->spacing = fmaxf(1.0f, size * (shape == IMP_BRUSH_SOFT ? 0.1f : 0.25f));
+    return 0;
+}
+
+void brush_free(ImpBrush *brush) {
+    free(brush->mask);
+    brush->mask = NULL;
+    brush->size = 0;
+}
+
+// splits the position of the unshifted mask's top-left pixel into a whole pixel and a phase
+static int place(float pos, int phases, int *phase) {
+    int steps = (int)lroundf(pos * phases);
+    int whole = steps >= 0 ? steps / phases : -((-steps + phases - 1) / phases);
+    *phase = steps - whole * phases;
+    return whole;
+}
+
+void brush_stamp(const ImpBrush *brush, const ImpImage *image, float x, float y, uint32_t color) {
+    int dim = brush->dim, px, py;
+    float offset = (brush->size - 1) / 2.0f;
+    int x0 = place(x - offset, brush->phases, &px);
+    int y0 = place(y - offset, brush->phases, &py);
+    const uchar *mask = brush->mask + (size_t)(py * brush->phases + px) * dim * dim;
+    int mx0 = x0 < 0 ? -x0 : 0, my0 = y0 < 0 ? -y0 : 0;
+    int mx1 = dim, my1 = dim;
+    if (x0 + mx1 > (int)image->width) {
+        mx1 = (int)image->width - x0;
+    }
+    if (y0 + my1 > (int)image->height) {
+        my1 = (int)image->height - y0;
+    }
+    if (mx0 >= mx1 || my0 >= my1) {
+        return;
+    }
+    uint32_t *pixels = (uint32_t *)image->pixels;
+    for (int my = my0; my < my1; ++my) {
+        uint32_t *row = pixels + (size_t)(y0 + my) * image->width + x0;
+        raster_blend_span(row + mx0, mask + (size_t)my * dim + mx0, mx1 - mx0, color);
+    }
+}
+
+void brush_stroke_to(ImpStroke *stroke, const ImpBrush *brush, const ImpImage *image, float x,
+                     float y, uint32_t color) {
+    if (!stroke->started) {
+        brush_stamp(brush, image, x, y, color);
+        *stroke = (ImpStroke){x, y, 0.0f, true};
+        return;
+    }
+    float dx = x - stroke->x, dy = y - stroke->y;
+    float len = hypotf(dx, dy);
+    if (len == 0.0f) {
+        return;
+    }
+    // t is the distance along the segment of the next stamp
+    float t = brush->spacing - stroke->carry;
+    for (; t <= len; t += brush->spacing) {
+        brush_stamp(brush, image, stroke->x + dx * t / len, stroke->y + dy * t / len, color);
+    }
+    stroke->carry = len - (t - brush->spacing);
+    stroke->x = x;
+    stroke->y = y;
+}
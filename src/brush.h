@@ -0,0 +1,50 @@
+/* brush.h - brush masks and stroke stamping */
+#ifndef BRUSH_H
+#define BRUSH_H
+#include "image.h"
+
+typedef enum ImpBrushShape {
+    IMP_BRUSH_SQUARE,
+    IMP_BRUSH_ROUND,        // hard disc, its edge antialiased with subpixel
+    IMP_BRUSH_SOFT,         // coverage falls off smoothly from the centre
+} ImpBrushShape;
+
+typedef struct ImpBrush {
+    ImpBrushShape shape;
+    int size;               // diameter in pixels
+    bool subpixel;          // as passed to brush_init
+    int phases;             // subpixel offsets per axis, 1 snaps stamps to whole pixels
+    int dim;                // width and height of a mask, one more than size with phases
+    uchar *mask;            // phases^2 masks of dim * dim coverage, 255 stamps the full color
+    float spacing;          // distance between stamps along a stroke, in pixels
+} ImpBrush;
+
+typedef struct ImpStroke {
+    float x, y;             // where the last segment ended
+    float carry;            // distance walked since the last stamp
+    bool started;
+} ImpStroke;
+
+/**
+ * computes the mask of shape at size pixels, returns 0 or -1. subpixel precomputes it at
+ * quarter pixel offsets so round and soft strokes move smoothly instead of in pixel steps, and
+ * smooths the edge of round masks, which are aliased without it
+ */
+int brush_init(ImpBrush *brush, ImpBrushShape shape, int size, bool subpixel);
+void brush_free(ImpBrush *brush);
+
+/**
+ * blends color over the pixels under the mask centred on (x, y), clipped to the image, with
+ * raster_blend_span. 4 byte per pixel images only, color is an opaque raw pixel
+ */
+void brush_stamp(const ImpBrush *brush, const ImpImage *image, float x, float y, uint32_t color);
+
+/**
+ * extends a stroke to (x, y): the first call stamps there, later ones stamp every spacing
+ * pixels along the segment from the previous point, carrying the remainder over so fast and
+ * slow strokes get the same density
+ */
+void brush_stroke_to(ImpStroke *stroke, const ImpBrush *brush, const ImpImage *image, float x,
+                     float y, uint32_t color);
+
+#endif
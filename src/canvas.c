@@ -1,5 +1,9 @@
 #include "canvas.h"
+#include "fill.h"
+#include "raster.h"
+#include "system/asyncio.h"
 #include "ui/toolmenu.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <SDL2/SDL_image.h>
 #include <math.h>
@@ -7,17 +11,23 @@
 
 #define W_CANVAS_RESOLUTION 1080
 #define H_CANVAS_RESOLUTION 720
+#define W_DOCUMENT IMP_TILES_MAX_SIZE
+#define H_DOCUMENT IMP_TILES_MAX_SIZE
+#define BACKGROUND 0xFFFFFFFF
+#define MIN_ZOOM (1.0f / 64)
+#define MAX_ZOOM 8.0f
 #define SIZE_LINE 2
-#define rgb_red(rgb) ((rgb & 0xFF0000) >> 16)
-#define rgb_green(rgb) ((rgb & 0x00FF00) >> 8)
-#define rgb_blue(rgb) (rgb & 0x0000FF)
-#define ABS(x) ((x) >= 0 ? (x) : -(x))
-#define SIGN(_x) ((_x) < 0 ? -1 : \
-		                 ((_x) > 0 ? 1 : 0))
-
-// rgb encoded color
-u32 imp_rgba(ImpCanvas *c, u32 color) {
-    return SDL_MapRGBA(c->pixel_format, rgb_red(color), rgb_green(color), rgb_blue(color), 255);
+#define HISTORY_BUDGET (64 << 20)
+// wasted area up to which two dirty rects are uploaded as their union
+#define DIRTY_MERGE_SLACK (64 * 64)
+
+// the cursor color packed for surf, only repacked when the cursor's changes
+static u32 imp_canvas_color(ImpCanvas *c, ImpCursor *cursor) {
+    if (cursor->color != c->color_rgb) {
+        c->color_rgb = cursor->color;
+        c->color = imp_pack_rgb(cursor->color);
+    }
+    return c->color;
 }
 
 ImpCanvas *create_imp_canvas(SDL_Window *window, SDL_Renderer *renderer, char *output) {
@@ -34,24 +44,38 @@ ImpCanvas *create_imp_canvas(SDL_Window *window, SDL_Renderer *renderer, char *o
     canvas->rect.w = W_CANVAS_RESOLUTION;
     canvas->rect.h = H_CANVAS_RESOLUTION;
 
-    u32 pixel_format;
+    // must agree with imp_pack_rgb
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
-    pixel_format = SDL_PIXELFORMAT_RGBA32;
     canvas->masks.r = 0x0000FF00;
     canvas->masks.g = 0x00FF0000;
     canvas->masks.b = 0xFF000000;
 #else
-    pixel_format = SDL_PIXELFORMAT_ABGR32;
     canvas->masks.r = 0xFF000000;
     canvas->masks.g = 0x00FF0000;
     canvas->masks.b = 0x0000FF00;
 #endif
-    canvas->pixel_format = SDL_AllocFormat(pixel_format);
     canvas->pitch = 4 * canvas->rect.w;
     canvas->depth = 32;
     canvas->surf = SDL_CreateRGBSurface(0, canvas->rect.w, canvas->rect.h, canvas->depth,
                                         canvas->masks.r, canvas->masks.g, canvas->masks.b, 0xFF);
-    SDL_FillRect(canvas->surf, NULL, 0xFFFFFFFF);
+    SDL_FillRect(canvas->surf, NULL, BACKGROUND);
+    // starts in the middle of an empty drawing, so surf already matches it
+    canvas->doc = create_imp_tiles(W_DOCUMENT, H_DOCUMENT, canvas->surf->format->format, BACKGROUND);
+    if (!canvas->doc) {
+        SDL_FreeSurface(canvas->surf);
+        free(canvas);
+        return NULL;
+    }
+    canvas->origin = (SDL_Point){(W_DOCUMENT - canvas->rect.w) / 2, (H_DOCUMENT - canvas->rect.h) / 2};
+    canvas->zoom = 1.0f;
+    canvas->ndirty = 0;
+    canvas->history = create_imp_history(canvas->doc, HISTORY_BUDGET, true);
+    if (!canvas->history) {
+        imp_tiles_free(canvas->doc);
+        SDL_FreeSurface(canvas->surf);
+        free(canvas);
+        return NULL;
+    }
 
     int bgoff = 16;
     SDL_Surface *bg = IMG_Load("res/png/border.png");
@@ -64,6 +88,16 @@ ImpCanvas *create_imp_canvas(SDL_Window *window, SDL_Renderer *renderer, char *o
     canvas->line_guide = (ImpLineGuide){0};
     canvas->size_line = SIZE_LINE;
     canvas->output = output;
+    canvas->png = PNG_DEFAULT_OPTIONS;
+    canvas->fill_tolerance = 0;
+    canvas->fill_diagonal = false;
+    canvas->antialias = false;
+    canvas->color_rgb = 0;
+    canvas->color = imp_pack_rgb(0);
+    canvas->brush_shape = IMP_BRUSH_ROUND;
+    canvas->brush = (ImpBrush){0};
+    canvas->stroke = (ImpStroke){0};
+    canvas->nsamples = 0;
     canvas->save_lock = false;
     return canvas;
 }
@@ -79,83 +113,154 @@ static int min(int a, int b) { return a < b ? a : b; }
 // clamp val into range [lower, upper]
 static int clamp(int val, int lower, int upper) { return max(lower, min(upper, val)); }
 
-static void imp_canvas_pencil_draw(ImpCanvas *canvas, ImpCursor *cursor) {
-    int xrel = cursor->rect.x - canvas->rect.x;
-    int yrel = cursor->rect.y - canvas->rect.y;
-    SDL_Rect area = {xrel, yrel, cursor->w_pencil, cursor->h_pencil};
-    SDL_FillRect(canvas->surf, &area, imp_rgba(canvas, cursor->color));
+static long rect_area(const SDL_Rect *r) { return (long)r->w * r->h; }
+
+void imp_canvas_damage(ImpCanvas *c, SDL_Rect area) {
+    SDL_Rect bounds = {0, 0, c->surf->w, c->surf->h};
+    if (!SDL_IntersectRect(&area, &bounds, &area)) {
+        return;
+    }
+
+    // grow an overlapping or close rect rather than uploading many small ones
+    for (int i = 0; i < c->ndirty; ++i) {
+        SDL_Rect merged;
+        SDL_UnionRect(&c->dirty[i], &area, &merged);
+        if (rect_area(&merged) <= rect_area(&c->dirty[i]) + rect_area(&area) + DIRTY_MERGE_SLACK) {
+            c->dirty[i] = merged;
+            return;
+        }
+    }
+    if (c->ndirty < IMP_CANVAS_MAX_DIRTY) {
+        c->dirty[c->ndirty++] = area;
+        return;
+    }
+    // out of slots, everything becomes one bounding rect
+    for (int i = 1; i < c->ndirty; ++i) {
+        SDL_UnionRect(&c->dirty[0], &c->dirty[i], &c->dirty[0]);
+    }
+    SDL_UnionRect(&c->dirty[0], &area, &c->dirty[0]);
+    c->ndirty = 1;
 }
 
-static void set_pixel_color(ImpCanvas *c, u32 *pixels, int x, int y, int width, u32 color) {
-    if (x > width) {
-        fprintf(stderr, "buffer overflow in x: %d (width: %d)\n", x, width);
+// only what changed since the last flush is written back, the tiles upload it when drawn
+static void imp_canvas_flush(ImpCanvas *c) {
+    SDL_Surface *surf = c->surf;
+    for (int i = 0; i < c->ndirty; ++i) {
+        SDL_Rect r = c->dirty[i];
+        const u32 *pixels = (const u32 *)surf->pixels + (size_t)r.y * surf->w + r.x;
+        SDL_Rect area = {c->origin.x + r.x, c->origin.y + r.y, r.w, r.h};
+        if (imp_tiles_write(c->doc, area, pixels, surf->w) != 0) {
+            fprintf(stderr, "out of memory for the drawing, some of it was not kept\n");
+        }
     }
-    
-    pixels[x + y * width] = imp_rgba(c, color);
+    c->ndirty = 0;
 }
 
-/**
- * Is the circle out-of-bounds with the rect?
- * @return true if oob
- */
-static bool is_circle_oob(ImpCircleGuide circle, SDL_Rect *rect) {
-    bool oob_top = circle.y - circle.r <= rect->y;
-    bool oob_bottom = circle.y + circle.r >= rect->y + rect->h;
-    bool oob_right = circle.x + circle.r >= rect->x + rect->w;
-    bool oob_left = circle.x - circle.r <= rect->x;
-    return oob_top || oob_bottom || oob_left || oob_right;
+// copies the part of area (drawing coordinates) inside the window from the drawing into surf
+static void imp_canvas_reload(ImpCanvas *c, SDL_Rect area) {
+    SDL_Rect window = {c->origin.x, c->origin.y, c->surf->w, c->surf->h};
+    if (!SDL_IntersectRect(&area, &window, &area)) {
+        return;
+    }
+    u32 *pixels = (u32 *)c->surf->pixels + (size_t)(area.y - c->origin.y) * c->surf->w + (area.x - c->origin.x);
+    imp_tiles_read(c->doc, area, pixels, c->surf->w);
 }
 
-// unused because slow
-static void line_gradient(ImpCanvas *c, SDL_Surface *surf, u32 color, int x1, int x2, int y1, int y2) {
-    int dx = x2 - x1;
-    int dy = y2 - y1;
-    int inc_x = SIGN(dx);
-    int inc_y = SIGN(dy);
-    dx = abs(dx);
-    dy = abs(dy);
-
-    if (dy == 0) {
-        // horizontal line
-        for (int x = x1; x != x2 + inc_x; x += inc_x) {
-            SDL_FillRect(surf, &(SDL_Rect){ x, y1, c->size_line, c->size_line }, imp_rgba(c, color));
-        }
-    } else if (dx == 0) {
-        // vertical line
-        for (int y = y1; y != y2 + inc_y; y += inc_y) {
-            SDL_FillRect(surf, &(SDL_Rect){ x1, y, c->size_line, c->size_line }, imp_rgba(c, color));
-        }
-    } else if (dx >= dy) {
-        // < 45 degrees
-        int slope = 2*dy;
-        int error = -dx;
-        int error_inc = -2*dx;
-        int y = y1;
-
-        for (int x = x1; x != x2 + inc_x; x += inc_x) {
-            SDL_FillRect(surf, &(SDL_Rect){ x, y, c->size_line, c->size_line }, imp_rgba(c, color));
-            error += slope;
-            if (error >= 0) {
-                y += inc_y;
-                error += error_inc;
-            }
-        }
-    } else {
-        // > 45 degrees
-        int slope = 2*dx;
-        int error = -dy;
-        int error_inc = -2*dy;
-        int x = x1;
-
-        for (int y = y1; y != y2 + inc_y; y += inc_y) {
-            SDL_FillRect(surf, &(SDL_Rect){ x, y, c->size_line, c->size_line }, imp_rgba(c, color));
-            error += slope;
-            if (error >= 0) {
-                x += inc_x;
-                error += error_inc;
-            }
+// the history keeps drawing coordinates, so undo survives panning
+static void imp_canvas_touch(ImpCanvas *c, SDL_Rect area) {
+    imp_history_touch(c->history, (SDL_Rect){c->origin.x + area.x, c->origin.y + area.y, area.w, area.h});
+}
+
+// the history compares against the drawing, which must have every edit of the step
+static void imp_canvas_commit(ImpCanvas *c) {
+    imp_canvas_flush(c);
+    imp_history_commit(c->history);
+}
+
+// copy of the painted part of the drawing, or of the window when nothing is painted yet
+static SDL_Surface *imp_canvas_snapshot(ImpCanvas *c, SDL_Rect *area) {
+    imp_canvas_update(c);
+    imp_canvas_flush(c);
+    if (!imp_tiles_painted(c->doc, area)) {
+        *area = (SDL_Rect){c->origin.x, c->origin.y, c->surf->w, c->surf->h};
+    }
+    SDL_Surface *snapshot = SDL_CreateRGBSurfaceWithFormat(0, area->w, area->h, 32, c->surf->format->format);
+    if (!snapshot) {
+        return NULL;
+    }
+    imp_tiles_read(c->doc, *area, snapshot->pixels, snapshot->pitch / 4);
+    return snapshot;
+}
+
+void imp_canvas_update(ImpCanvas *c) {
+    if (!c->nsamples) {
+        return;
+    }
+    // bounds of the segments from where the stroke stands through every queued sample
+    int x0 = c->samples[0].x, y0 = c->samples[0].y, x1 = x0, y1 = y0;
+    if (c->stroke.started) {
+        x0 = x1 = lroundf(c->stroke.x);
+        y0 = y1 = lroundf(c->stroke.y);
+    }
+    for (int i = 0; i < c->nsamples; ++i) {
+        x0 = min(x0, c->samples[i].x);
+        y0 = min(y0, c->samples[i].y);
+        x1 = max(x1, c->samples[i].x);
+        y1 = max(y1, c->samples[i].y);
+    }
+    int r = c->brush.size / 2 + 1;
+    SDL_Rect area = {x0 - r, y0 - r, x1 - x0 + 2 * r + 1, y1 - y0 + 2 * r + 1};
+
+    imp_canvas_touch(c, area);
+    ImpImage image = imp_canvas_image(c);
+    for (int i = 0; i < c->nsamples; ++i) {
+        brush_stroke_to(&c->stroke, &c->brush, &image, c->samples[i].x, c->samples[i].y, c->color);
+    }
+    c->nsamples = 0;
+    imp_canvas_damage(c, area);
+}
+
+// pencil input is only queued here, imp_canvas_update stamps it once per frame
+static void imp_canvas_pencil_sample(ImpCanvas *canvas, ImpCursor *cursor) {
+    if (canvas->nsamples == IMP_CANVAS_MAX_SAMPLES) {
+        imp_canvas_update(canvas);
+    }
+    canvas->samples[canvas->nsamples++] = (SDL_Point){
+        cursor->rect.x - canvas->rect.x, cursor->rect.y - canvas->rect.y
+    };
+}
+
+static void imp_canvas_pencil_begin(ImpCanvas *canvas, ImpCursor *cursor) {
+    int size = cursor->w_pencil;
+    ImpBrush *b = &canvas->brush;
+    if (!b->mask || b->size != size || b->shape != canvas->brush_shape || b->subpixel != canvas->antialias) {
+        brush_free(b);
+        if (brush_init(b, canvas->brush_shape, size, canvas->antialias) != 0) {
+            fprintf(stderr, "could not create a brush of size %d\n", size);
+            return;
         }
     }
+    canvas->stroke = (ImpStroke){0};
+    imp_canvas_color(canvas, cursor);
+    cursor->pencil_locked = true;
+    imp_canvas_pencil_sample(canvas, cursor);
+}
+
+static void imp_canvas_bucket_fill(ImpCanvas *canvas, ImpCursor *cursor) {
+    int xrel = cursor->rect.x - canvas->rect.x;
+    int yrel = cursor->rect.y - canvas->rect.y;
+    if (xrel < 0 || yrel < 0 || xrel >= canvas->surf->w || yrel >= canvas->surf->h) {
+        return;
+    }
+    // the filled area is only known afterwards, unchanged tiles are dropped again on commit
+    imp_canvas_touch(canvas, (SDL_Rect){0, 0, canvas->surf->w, canvas->surf->h});
+    ImpImage image = imp_canvas_image(canvas);
+    ImpFillArea area;
+    if (flood_fill(&image, xrel, yrel, imp_canvas_color(canvas, cursor), canvas->fill_tolerance,
+                   canvas->fill_diagonal, &area) != 0) {
+        fprintf(stderr, "bucket fill: out of memory\n");
+    }
+    imp_canvas_damage(canvas, (SDL_Rect){area.x, area.y, area.w, area.h});
 }
 
 // midpoint circle algorithm
@@ -232,110 +337,62 @@ static void imp_canvas_line_guide(ImpCanvas *canvas, ImpCursor *cursor) {
     canvas->line_guide = guide;
 }
 
-// static SDL_Surface* create_circle_surface(ImpCanvas *canvas, int radius, u32 color) {
-//     int diameter = 2 * radius;
-//     // SDL_Surface *circ_surf = SDL_CreateRGBSurface(0, diameter, diameter, 32, canvas->masks.r,
-//     //     canvas->masks.g, canvas->masks.b, canvas->masks.a);
-//     SDL_Surface *circ_surf = SDL_CreateRGBSurfaceWithFormat(0, diameter, diameter, 32, canvas->pixel_format->format);
-//     printf("format=%s\n", SDL_GetPixelFormatName(circ_surf->format->format));
-    
-//     // Fill the surface with pixels that form the circle
-//     Uint32* pixels = (Uint32*)circ_surf->pixels;
-//     for (int y = 0; y < diameter; ++y) {
-//         for (int x = 0; x < diameter; ++x) {
-//             int dx = radius - x;
-//             int dy = radius - y;
-//             if ((dx * dx + dy * dy) <= (radius * radius)) {
-//                 pixels[y * diameter + x] = SDL_MapRGB(circ_surf->format, color, 0, 0);
-//             } else {
-//                 pixels[y * diameter + x] = SDL_MapRGB(circ_surf->format, 0, 0, 0); // transparent
-//             }
-//         }
-//     }
-
-//     return circ_surf;
-// }
-
-// static void imp_canvas_circle_guide_draw(ImpCanvas *canvas, ImpCursor *cursor) {
-//     SDL_Surface *circ_surf = create_circle_surface(canvas, canvas->circle_guide.r, cursor->color);
-
-//     int diameter = 2 * canvas->circle_guide.r;
-//     int x_start = canvas->circle_guide.x - canvas->rect.x - canvas->circle_guide.r;
-//     int y_start = canvas->circle_guide.y - canvas->rect.y - canvas->circle_guide.r;
-//     SDL_Rect dest_rect = {.x=x_start, .y=y_start, .w=diameter, .h=diameter};
-
-//     // clip dest_rect to the boundaries of the canvas
-//     if (dest_rect.x <= canvas->rect.x) {
-//         dest_rect.x = canvas->rect.x + 1;
-//     }
-//     if (dest_rect.y <= canvas->rect.y) {
-//         dest_rect.y = canvas->rect.y + 1;
-//     }
-//     if (dest_rect.x + dest_rect.w >= canvas->rect.x + canvas->rect.w) {
-//         dest_rect.w = canvas->rect.x + canvas->rect.w - dest_rect.x;
-//     }
-//     if (dest_rect.y + dest_rect.h >= canvas->rect.y + canvas->rect.h) {
-//         dest_rect.h = canvas->rect.y + canvas->rect.h - dest_rect.y;
-//     }
-
-//     SDL_BlitSurface(circ_surf, NULL, canvas->surf, &dest_rect);
-//     SDL_FreeSurface(circ_surf);
-// }
-
 static void imp_canvas_circle_guide_draw(ImpCanvas *canvas, ImpCursor *cursor) {
-    size_t diameter = 2*canvas->circle_guide.r;
-    int x_rect = diameter/2;
-    int y_rect = diameter/2;
-    uint32_t pixels[diameter * diameter];
-    for (size_t i = 0; i < diameter * diameter; ++i) {
-        int x = i % diameter;
-        int y = i / diameter;
-        bool within_circle = pow(abs(x - x_rect), 2) + pow(abs(y - y_rect), 2) <= pow(canvas->circle_guide.r, 2);
-        pixels[i] = within_circle ? imp_rgba(canvas, cursor->color) : 0;
+    ImpCircleGuide g = canvas->circle_guide;
+    if (g.r <= 0) {
+        return;
     }
-
-    SDL_Surface *circ_surf = SDL_CreateRGBSurfaceFrom(pixels, diameter, diameter, 32, 4 * diameter, canvas->masks.r,
-                                                      canvas->masks.g, canvas->masks.b, 0xFF);
-    size_t xrel = canvas->circle_guide.x - canvas->rect.x;
-    size_t yrel = canvas->circle_guide.y - canvas->rect.y;
-    SDL_BlitSurface(circ_surf, NULL, canvas->surf,
-                    &(SDL_Rect){xrel - canvas->circle_guide.r,
-                                yrel - canvas->circle_guide.r, diameter, diameter});
-    SDL_FreeSurface(circ_surf);
+    int cx = g.x - canvas->rect.x, cy = g.y - canvas->rect.y;
+    // antialiased edges reach half a pixel further
+    SDL_Rect area = {cx - g.r - 1, cy - g.r - 1, 2 * g.r + 3, 2 * g.r + 3};
+    imp_canvas_touch(canvas, area);
+    ImpImage image = imp_canvas_image(canvas);
+    if (canvas->antialias) {
+        raster_fill_circle_aa(&image, cx, cy, g.r, imp_canvas_color(canvas, cursor));
+    } else {
+        raster_fill_circle(&image, cx, cy, g.r, imp_canvas_color(canvas, cursor));
+    }
+    imp_canvas_damage(canvas, area);
 }
 
 static void imp_canvas_rectange_guide_draw(ImpCanvas *canvas, ImpCursor *cursor) {
-    SDL_Rect relative = { fmax(0, canvas->rectangle_guide.x - canvas->rect.x),
-                          fmax(0, canvas->rectangle_guide.y - canvas->rect.y),
+    SDL_Rect relative = { canvas->rectangle_guide.x - canvas->rect.x,
+                          canvas->rectangle_guide.y - canvas->rect.y,
                           canvas->rectangle_guide.w,
                           canvas->rectangle_guide.h };
-    SDL_FillRect(canvas->surf, &relative, imp_rgba(canvas, cursor->color));
+    imp_canvas_touch(canvas, relative);
+    ImpImage image = imp_canvas_image(canvas);
+    raster_fill_rect(&image, relative.x, relative.y, relative.w, relative.h, imp_canvas_color(canvas, cursor));
+    imp_canvas_damage(canvas, relative);
 }
 
 static void imp_canvas_line_guide_draw(ImpCanvas *canvas, ImpCursor *cursor) {
-    size_t w = canvas->rect.w;
-    size_t h = canvas->rect.h;
-
-    // literally making a copy of the entire canvas just to render a line lmao
-    // if noticable, use smaller buffer and map canvas coordinates into smaller buffer coordinates
-    SDL_Surface *line_surf =
-        SDL_CreateRGBSurface(0, w, h, 32, canvas->masks.r, canvas->masks.g, canvas->masks.b, 0xFF);
-    line_gradient(canvas, line_surf, cursor->color, canvas->line_guide.x1 - canvas->rect.x,
-                  canvas->line_guide.x2 - canvas->rect.x, canvas->line_guide.y1 - canvas->rect.y,
-                  canvas->line_guide.y2 - canvas->rect.y);
-    SDL_BlitSurface(line_surf, NULL, canvas->surf, NULL);
-    SDL_FreeSurface(line_surf);
+    ImpLineGuide l = canvas->line_guide;
+    int x1 = l.x1 - canvas->rect.x, x2 = l.x2 - canvas->rect.x;
+    int y1 = l.y1 - canvas->rect.y, y2 = l.y2 - canvas->rect.y;
+    int t = canvas->size_line + 1;
+    SDL_Rect area = {min(x1, x2) - t, min(y1, y2) - t, abs(x2 - x1) + 2 * t + 1, abs(y2 - y1) + 2 * t + 1};
+    imp_canvas_touch(canvas, area);
+    ImpImage image = imp_canvas_image(canvas);
+    if (canvas->antialias) {
+        raster_line_aa(&image, x1, y1, x2, y2, canvas->size_line, imp_canvas_color(canvas, cursor));
+    } else {
+        raster_line(&image, x1, y1, x2, y2, canvas->size_line, imp_canvas_color(canvas, cursor));
+    }
+    imp_canvas_damage(canvas, area);
 }
 
 void imp_canvas_event(ImpCanvas *canvas, SDL_Event *e, ImpCursor *cursor, ImpTool currtool) {
     switch (e->type) {
     case SDL_MOUSEBUTTONDOWN: {
-        if (cursor->pencil_locked) break;
+        // surf is only on screen 1:1 at zoom 1, other zooms are for looking around
+        if (cursor->pencil_locked || canvas->zoom != 1.0f) break;
 
         if (SDL_HasIntersection(&canvas->rect, &cursor->rect)) {
             if (cursor->mode == IMP_PENCIL) {
-                cursor->pencil_locked = true;
-                imp_canvas_pencil_draw(canvas, cursor);
+                imp_canvas_pencil_begin(canvas, cursor);
+            } else if (cursor->mode == IMP_BUCKET) {
+                imp_canvas_bucket_fill(canvas, cursor);
             } else if (cursor->mode == IMP_RECTANGLE || cursor->mode == IMP_CIRCLE || cursor->mode == IMP_LINE) {
                 cursor->pencil_locked = true;
                 int xcur, ycur;
@@ -347,11 +404,14 @@ void imp_canvas_event(ImpCanvas *canvas, SDL_Event *e, ImpCursor *cursor, ImpToo
 
     case SDL_MOUSEMOTION: {
         if (!cursor->pencil_locked) break;
+        // strokes follow the cursor off the canvas and back, stamps are clipped
+        if (cursor->mode == IMP_PENCIL) {
+            imp_canvas_pencil_sample(canvas, cursor);
+            break;
+        }
         if (!SDL_HasIntersection(&canvas->rect, &cursor->rect)) break;
 
-        if (cursor->mode == IMP_PENCIL) {
-            imp_canvas_pencil_draw(canvas, cursor);
-        } else if (cursor->mode == IMP_RECTANGLE) {
+        if (cursor->mode == IMP_RECTANGLE) {
             imp_canvas_rectangle_guide(canvas, cursor);
         } else if (cursor->mode == IMP_CIRCLE) {
             imp_canvas_circle_guide(canvas, cursor);
@@ -362,38 +422,116 @@ void imp_canvas_event(ImpCanvas *canvas, SDL_Event *e, ImpCursor *cursor, ImpToo
 
     case SDL_MOUSEBUTTONUP: {
         cursor->pencil_locked = false;
+        imp_canvas_update(canvas);
 
         if (cursor->mode == IMP_RECTANGLE) {
             imp_canvas_rectange_guide_draw(canvas, cursor);
             canvas->rectangle_guide = (SDL_Rect){0};
         } else if (cursor->mode == IMP_CIRCLE) {
-            if (!is_circle_oob(canvas->circle_guide, &canvas->rect)) {
-                // TODO: if circle guide is OOB, then paint the portion that is inbounds
-                imp_canvas_circle_guide_draw(canvas, cursor);
-            }
+            imp_canvas_circle_guide_draw(canvas, cursor);
             canvas->circle_guide = (ImpCircleGuide){0};
         } else if (cursor->mode == IMP_LINE) {
             imp_canvas_line_guide_draw(canvas, cursor);
             canvas->line_guide = (ImpLineGuide){0};
         }
-
+        // a stroke or a shape is one undo step
+        imp_canvas_commit(canvas);
     } break;
     }
 
-    if (!canvas->save_lock && currtool == IMP_TOOL_SAVE) {
-        // TODO: reset save_lock when a different tool than SAVE is selected
-        IMG_SavePNG(canvas->surf, canvas->output);
+    if (currtool && currtool != IMP_TOOL_SAVE) {
+        canvas->save_lock = false;
+    } else if (!canvas->save_lock && currtool == IMP_TOOL_SAVE) {
+        // encoding runs on the io thread, drawing continues on the live surface meanwhile
+        SDL_Rect area;
+        SDL_Surface *snapshot = imp_canvas_snapshot(canvas, &area);
+        if (!snapshot || imp_io_save(snapshot, canvas->output, &canvas->png, NULL) != 0) {
+            fprintf(stderr, "could not start saving to: %s\n", canvas->output);
+            return;
+        }
         canvas->save_lock = true;
-        printf("saving to: %s\n", canvas->output);
+        printf("saving %dx%d at (%d, %d) of the drawing to: %s\n", area.w, area.h, area.x, area.y,
+               canvas->output);
     }
 }
 
-void imp_canvas_render(SDL_Renderer *renderer, ImpCanvas *c) {
+ImpImage imp_canvas_image(ImpCanvas *c) {
+    SDL_Surface *surf = c->surf;
+    assert(surf->format->BytesPerPixel == 4 && (size_t)surf->pitch == 4 * (size_t)surf->w);
+    return (ImpImage){
+        .pixels = surf->pixels,
+        .width = surf->w,
+        .height = surf->h,
+        .format = pixel_format_packed32(surf->format->Rmask, surf->format->Gmask, surf->format->Bmask),
+    };
+}
+
+void imp_canvas_filter(ImpCanvas *c, const ImpFilter *filter) {
+    SDL_Rect all = {0, 0, c->surf->w, c->surf->h};
+    ImpImage image = imp_canvas_image(c);
+    imp_canvas_commit(c);
+    imp_canvas_touch(c, all);
+    apply_filter_image(filter, &image);
+    imp_canvas_damage(c, all);
+    imp_canvas_commit(c);
+}
+
+void imp_canvas_paste(ImpCanvas *c, SDL_Surface *surf) {
+    SDL_Rect area = {0, 0, surf->w, surf->h};
+    imp_canvas_commit(c);
+    imp_canvas_touch(c, area);
+    SDL_SetSurfaceBlendMode(surf, SDL_BLENDMODE_NONE);
+    SDL_BlitSurface(surf, NULL, c->surf, NULL);
+    imp_canvas_damage(c, area);
+    imp_canvas_commit(c);
+}
+
+void imp_canvas_undo(ImpCanvas *c) {
+    imp_canvas_update(c);
+    imp_canvas_flush(c);
+    SDL_Rect changed;
+    if (imp_history_undo(c->history, &changed)) {
+        imp_canvas_reload(c, changed);
+    }
+}
+
+void imp_canvas_redo(ImpCanvas *c) {
+    imp_canvas_update(c);
+    imp_canvas_flush(c);
+    SDL_Rect changed;
+    if (imp_history_redo(c->history, &changed)) {
+        imp_canvas_reload(c, changed);
+    }
+}
+
+void imp_canvas_render_static(SDL_Renderer *renderer, ImpCanvas *c) {
     SDL_RenderCopy(renderer, c->bg, NULL, &c->bg_rect);
+}
+
+void imp_canvas_pan(ImpCanvas *c, int dx, int dy) {
+    imp_canvas_update(c);
+    imp_canvas_flush(c);
+    SDL_Point o = {
+        clamp(c->origin.x + dx, 0, imp_tiles_width(c->doc) - c->surf->w),
+        clamp(c->origin.y + dy, 0, imp_tiles_height(c->doc) - c->surf->h),
+    };
+    if (o.x == c->origin.x && o.y == c->origin.y) {
+        return;
+    }
+    c->origin = o;
+    imp_canvas_reload(c, (SDL_Rect){o.x, o.y, c->surf->w, c->surf->h});
+}
 
-    SDL_Texture *canvas_texture = SDL_CreateTextureFromSurface(renderer, c->surf);
-    SDL_RenderCopy(renderer, canvas_texture, NULL, &c->rect);
-    SDL_DestroyTexture(canvas_texture);
+void imp_canvas_zoom(ImpCanvas *c, float factor) {
+    c->zoom = fminf(fmaxf(c->zoom * factor, MIN_ZOOM), MAX_ZOOM);
+}
+
+void imp_canvas_render(SDL_Renderer *renderer, ImpCanvas *c) {
+    imp_canvas_flush(c);
+    // the drawing point at the centre of the window stays there whatever the zoom
+    float x = c->origin.x + c->rect.w / 2.0f * (1.0f - 1.0f / c->zoom);
+    float y = c->origin.y + c->rect.h / 2.0f * (1.0f - 1.0f / c->zoom);
+    imp_tiles_render(renderer, c->doc, c->rect, x, y, c->zoom);
 
     SDL_SetRenderDrawColor(renderer, 0xFF, 0, 0xFF, 255);
     SDL_RenderDrawRect(renderer, &c->rectangle_guide);
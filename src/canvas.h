@@ -1,11 +1,18 @@
 #ifndef IMP_CANVAS_H
 #define IMP_CANVAS_H
+#include "brush.h"
 #include "cursor.h"
+#include "history.h"
+#include "image.h"
+#include "system/png.h"
+#include "tiles.h"
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 typedef uint32_t u32;   
+#define IMP_CANVAS_MAX_DIRTY 16
+#define IMP_CANVAS_MAX_SAMPLES 64
 typedef enum ImpTool ImpTool;
 typedef struct ImpCircleGuide ImpCircleGuide;
 
@@ -24,10 +31,14 @@ typedef struct ImpLineGuide {
 typedef struct  {
     SDL_Rect rect;
     SDL_Surface *surf;
+    ImpTiles *doc; // the whole drawing, surf is the rect.w x rect.h window of it at origin
+    SDL_Point origin;
+    float zoom; // screen pixels per drawing pixel, tools only draw at 1
+    SDL_Rect dirty[IMP_CANVAS_MAX_DIRTY]; // in surface coordinates, written back to doc before drawing
+    int ndirty;
     SDL_Texture *bg;
     SDL_Rect bg_rect;
     SDL_Window *window_ref;
-    SDL_PixelFormat *pixel_format;
     SDL_Rect rectangle_guide;
     ImpCircleGuide circle_guide;
     ImpLineGuide line_guide;
@@ -36,13 +47,66 @@ typedef struct  {
     size_t depth; // RGBA bits
     size_t size_line;
     char *output;
+    PNG_options png; // compression of saved pngs
+    ImpHistory *history; // undo steps of doc
+    int fill_tolerance; // bucket: max difference per channel from the clicked pixel, 0 for exact
+    bool fill_diagonal; // bucket: diagonal neighbours are connected
+    bool antialias; // smooth edges on lines, circles and brush strokes
+    u32 color_rgb, color; // last cursor color and it packed for surf
+    ImpBrushShape brush_shape; // pencil
+    ImpBrush brush; // mask of brush_shape at the pencil size, rebuilt when either changes
+    ImpStroke stroke;
+    SDL_Point samples[IMP_CANVAS_MAX_SAMPLES]; // pencil positions since the last frame
+    int nsamples;
     bool save_lock;
 } ImpCanvas;
 
 ImpCanvas *create_imp_canvas(SDL_Window *window, SDL_Renderer *renderer, char *output);
 void imp_canvas_event(ImpCanvas *c, SDL_Event *e, ImpCursor *cursor, ImpTool currtool);
+/** the border around the canvas, drawn into the cached ui layer */
+void imp_canvas_render_static(SDL_Renderer *renderer, ImpCanvas *c);
 void imp_canvas_render(SDL_Renderer *renderer, ImpCanvas *c);
 
+/** stamps the pencil samples queued since the last frame, damaging their bounds once */
+void imp_canvas_update(ImpCanvas *c);
+
 void imp_canvas_bounds_checking(ImpCanvas *canvas, int *x, int *y, int xoff, int yoff);
-u32 imp_rgba(ImpCanvas *c, u32 color);
+
+/** packs an 0xRRGGBB color into an opaque pixel of surf, whose masks are fixed per byte order */
+static inline u32 imp_pack_rgb(u32 rgb) {
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+    return (rgb & 0xFF) << 24 | (rgb & 0xFF00) << 8 | (rgb & 0xFF0000) >> 8 | 0xFF;
+#else
+    return (rgb & 0xFFFFFF) << 8 | 0xFF;
+#endif
+}
+
+/**
+ * moves the window by (dx, dy) drawing pixels, clamped to the drawing. surf is written back
+ * and reloaded, the undo history is in drawing coordinates and carries over
+ */
+void imp_canvas_pan(ImpCanvas *c, int dx, int dy);
+
+/** multiplies the zoom by factor around the centre of the window */
+void imp_canvas_zoom(ImpCanvas *c, float factor);
+
+/** marks a region of the surface (surface coordinates, clipped here) for upload on the next render */
+void imp_canvas_damage(ImpCanvas *c, SDL_Rect area);
+
+/**
+ * view of the canvas surface pixels for apply_filter/pipeline_run_image, no copy is made.
+ * whoever writes through it calls imp_canvas_damage
+ */
+ImpImage imp_canvas_image(ImpCanvas *c);
+void imp_canvas_filter(ImpCanvas *c, const ImpFilter *filter);
+
+/** copies surf onto the top-left corner of the canvas, clipped to its size */
+void imp_canvas_paste(ImpCanvas *c, SDL_Surface *surf);
+
+/**
+ * steps back and forth through the history, an edit in progress is committed first. the step
+ * may lie partly or wholly outside the window, the drawing changes either way
+ */
+void imp_canvas_undo(ImpCanvas *c);
+void imp_canvas_redo(ImpCanvas *c);
 #endif
\ No newline at end of file
@@ -0,0 +1,528 @@
+/* convolve.c - banded, ring-buffered spatial filters */
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "convolve.h"
+#include "system/arena.h"
+#include "system/parallel.h"
+
+// rows per band never drop below this, so halos stay small next to the band itself
+#define MIN_BAND_ROWS 32
+// largest box window whose column sums (255 * window) still fit in 16 bits after rounding
+#define MAX_WINDOW_U16 255
+
+static int clamp(int val, int lower, int upper) {
+    return val < lower ? lower : val > upper ? upper : val;
+}
+
+static int rgb_to_gray(uchar r, uchar g, uchar b) {
+    return (int)(0.2989 * r + 0.5870 * g + 0.1140 * b);
+}
+
+/**
+ * rows are moved in and out of the image as compact 3 byte per pixel rows, channels in the
+ * image's byte order so 24-bit images are a plain memcpy. gray[] maps r, g, b to compact slots
+ */
+typedef struct {
+    const ImpImage *image;
+    size_t w, h;
+    size_t stride, offsets[3];
+    size_t compact[3]; // image channel offset of compact slot i
+    int gray[3];       // compact slot of red, green, blue
+    size_t row_bytes;
+} RowIO;
+
+static void row_io_init(RowIO *io, const ImpImage *image) {
+    io->image = image;
+    io->w = image->width;
+    io->h = image->height;
+    io->row_bytes = 3 * io->w;
+    image_layout(image, &io->stride, io->offsets);
+
+    // sort channels by offset
+    int order[3] = {0, 1, 2};
+    for (int i = 0; i < 3; ++i)
+        for (int j = i + 1; j < 3; ++j)
+            if (io->offsets[order[j]] < io->offsets[order[i]]) {
+                int tmp = order[i];
+                order[i] = order[j];
+                order[j] = tmp;
+            }
+    for (int i = 0; i < 3; ++i) {
+        io->compact[i] = io->offsets[order[i]];
+        io->gray[order[i]] = i;
+    }
+}
+
+static void load_row(const RowIO *io, size_t y, uchar *row) {
+    const uchar *p = io->image->pixels + y * io->w * io->stride;
+    if (io->stride == 3) {
+        memcpy(row, p, io->row_bytes);
+        return;
+    }
+    for (size_t x = 0; x < io->w; ++x, p += io->stride, row += 3) {
+        row[0] = p[io->compact[0]];
+        row[1] = p[io->compact[1]];
+        row[2] = p[io->compact[2]];
+    }
+}
+
+static void store_row(const RowIO *io, size_t y, const uchar *row) {
+    uchar *p = io->image->pixels + y * io->w * io->stride;
+    if (io->stride == 3) {
+        memcpy(p, row, io->row_bytes);
+        return;
+    }
+    for (size_t x = 0; x < io->w; ++x, p += io->stride, row += 3) {
+        p[io->compact[0]] = row[0];
+        p[io->compact[1]] = row[1];
+        p[io->compact[2]] = row[2];
+    }
+}
+
+/**
+ * in-place banded execution. a band reads `reach` rows above and below itself, which the
+ * neighbouring bands overwrite, so those halo rows are copied out before any band starts
+ */
+typedef struct BandJob BandJob;
+typedef int (*band_fn)(BandJob *job, size_t y0, size_t y1, uchar *halo);
+
+struct BandJob {
+    RowIO io;
+    size_t band_rows, reach;
+    band_fn fn;
+    const void *args;
+    uchar **halos;
+    int status;
+};
+
+static size_t band_halo_rows(BandJob *job, size_t y0, size_t y1, size_t *top) {
+    size_t first = y0 > job->reach ? y0 - job->reach : 0;
+    size_t last = y1 + job->reach < job->io.h ? y1 + job->reach : job->io.h;
+    *top = y0 - first;
+    return (y0 - first) + (last - y1);
+}
+
+/** source row v (clamped into the image) as seen before the filter started */
+static const uchar *fetch_row(BandJob *job, size_t y0, size_t y1, const uchar *halo, long v, uchar *tmp) {
+    size_t y = clamp(v, 0, job->io.h - 1), top;
+    band_halo_rows(job, y0, y1, &top);
+    if (y < y0)
+        return halo + (y - (y0 - top)) * job->io.row_bytes;
+    if (y >= y1)
+        return halo + (top + y - y1) * job->io.row_bytes;
+    load_row(&job->io, y, tmp);
+    return tmp;
+}
+
+static void band_save_halo(void *ctx, size_t band, size_t begin, size_t end) {
+    (void)begin;
+    (void)end;
+    BandJob *job = ctx;
+    size_t y0 = band * job->band_rows;
+    size_t y1 = y0 + job->band_rows < job->io.h ? y0 + job->band_rows : job->io.h;
+    size_t top, n = band_halo_rows(job, y0, y1, &top);
+    for (size_t i = 0; i < n; ++i) {
+        size_t y = i < top ? y0 - top + i : y1 + (i - top);
+        load_row(&job->io, y, job->halos[band] + i * job->io.row_bytes);
+    }
+}
+
+static void band_run(void *ctx, size_t band, size_t begin, size_t end) {
+    (void)begin;
+    (void)end;
+    BandJob *job = ctx;
+    size_t y0 = band * job->band_rows;
+    size_t y1 = y0 + job->band_rows < job->io.h ? y0 + job->band_rows : job->io.h;
+    if (job->fn(job, y0, y1, job->halos[band]) != 0)
+        job->status = -1;
+}
+
+static int run_banded(const ImpImage *image, size_t reach, band_fn fn, const void *args) {
+    assert(image && image->pixels);
+    BandJob job = {.reach = reach, .fn = fn, .args = args};
+    row_io_init(&job.io, image);
+    if (!job.io.w || !job.io.h)
+        return 0;
+
+    size_t nthreads = parallel_nthreads();
+    job.band_rows = (job.io.h + 2 * nthreads - 1) / (2 * nthreads);
+    if (job.band_rows < MIN_BAND_ROWS)
+        job.band_rows = MIN_BAND_ROWS;
+    if (job.band_rows < 2 * reach)
+        job.band_rows = 2 * reach;
+    size_t nbands = (job.io.h + job.band_rows - 1) / job.band_rows;
+
+    // halos are filled and read by different threads, so they come from this thread's arena
+    ImpArena *arena = arena_thread();
+    ArenaMark mark = arena_mark(arena);
+    job.halos = arena_alloc(arena, nbands * sizeof(uchar *));
+    for (size_t i = 0; job.halos && i < nbands; ++i) {
+        size_t y0 = i * job.band_rows, top;
+        size_t y1 = y0 + job.band_rows < job.io.h ? y0 + job.band_rows : job.io.h;
+        if (!(job.halos[i] = arena_alloc(arena, band_halo_rows(&job, y0, y1, &top) * job.io.row_bytes)))
+            job.halos = NULL;
+    }
+    if (!job.halos) {
+        arena_release(arena, mark);
+        return -1;
+    }
+
+    parallel_for(nbands, 1, band_save_halo, &job);
+    parallel_for(nbands, 1, band_run, &job);
+    arena_release(arena, mark);
+    return job.status;
+}
+
+/** box average of one compact row along x, running sums so the cost is independent of r */
+static void box_row(const uchar *src, uchar *dst, size_t w, int r) {
+    uint64_t n = 2 * r + 1, half = n / 2;
+    uint64_t inv = ((1ULL << 32) + n - 1) / n;
+    long last = w - 1;
+    uint64_t sum[3];
+    for (int c = 0; c < 3; ++c) {
+        sum[c] = (uint64_t)(r + 1) * src[c];
+        for (long k = 1; k <= r; ++k)
+            sum[c] += src[3 * (k < last ? k : last) + c];
+    }
+
+    // only the first and last r pixels of the row read outside the image
+    long x = 0;
+    for (; x <= last; ++x) {
+        long in = x + r + 1, out = x - r;
+        if (out > 0 && in < last)
+            break;
+        for (int c = 0; c < 3; ++c) {
+            dst[3 * x + c] = ((sum[c] + half) * inv) >> 32;
+            sum[c] += src[3 * (in < last ? in : last) + c];
+            sum[c] -= src[3 * (out > 0 ? out : 0) + c];
+        }
+    }
+    const uchar *in = src + 3 * (x + r + 1), *out = src + 3 * (x - r);
+    for (; x + r + 1 < last; ++x, in += 3, out += 3) {
+        dst[3 * x] = ((sum[0] + half) * inv) >> 32;
+        dst[3 * x + 1] = ((sum[1] + half) * inv) >> 32;
+        dst[3 * x + 2] = ((sum[2] + half) * inv) >> 32;
+        sum[0] += in[0] - out[0];
+        sum[1] += in[1] - out[1];
+        sum[2] += in[2] - out[2];
+    }
+    for (; x <= last; ++x) {
+        long in_x = x + r + 1 < last ? x + r + 1 : last;
+        for (int c = 0; c < 3; ++c) {
+            dst[3 * x + c] = ((sum[c] + half) * inv) >> 32;
+            sum[c] += src[3 * in_x + c];
+            sum[c] -= src[3 * (x - r > 0 ? x - r : 0) + c];
+        }
+    }
+}
+
+// sum[i] += in[i] - out[i] over n bytes, 16-bit column sums
+static void column_update16(uint16_t *sum, const uchar *in, const uchar *out, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(out + i));
+        __m128i lo = _mm_loadu_si128((const __m128i *)(sum + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(sum + i + 8));
+        lo = _mm_sub_epi16(_mm_add_epi16(lo, _mm_unpacklo_epi8(a, zero)), _mm_unpacklo_epi8(b, zero));
+        hi = _mm_sub_epi16(_mm_add_epi16(hi, _mm_unpackhi_epi8(a, zero)), _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128((__m128i *)(sum + i), lo);
+        _mm_storeu_si128((__m128i *)(sum + i + 8), hi);
+    }
+#endif
+    for (; i < n; ++i)
+        sum[i] += in[i] - out[i];
+}
+
+#ifdef __SSE2__
+// x / window for 16-bit x: the rounded-up reciprocal overshoots by at most one, which the
+// (wrapped, signed) remainder detects
+static __m128i divide16(__m128i x, __m128i inv, __m128i window) {
+    __m128i q = _mm_mulhi_epu16(x, inv);
+    __m128i rem = _mm_sub_epi16(x, _mm_mullo_epi16(q, window));
+    return _mm_add_epi16(q, _mm_cmplt_epi16(rem, _mm_setzero_si128()));
+}
+#endif
+
+// dst[i] = round(sum[i] / window), window <= MAX_WINDOW_U16
+static void column_average16(uchar *dst, const uint16_t *sum, size_t n, unsigned window) {
+    uint16_t half = window / 2;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i vhalf = _mm_set1_epi16(half), vwindow = _mm_set1_epi16(window);
+    __m128i vinv = _mm_set1_epi16((65536 + window - 1) / window);
+    for (; i + 16 <= n; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(sum + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(sum + i + 8));
+        lo = divide16(_mm_add_epi16(lo, vhalf), vinv, vwindow);
+        hi = divide16(_mm_add_epi16(hi, vhalf), vinv, vwindow);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] = (sum[i] + half) / window;
+}
+
+/**
+ * one separable box pass over a band: a ring of 2r + 1 horizontally averaged rows feeds
+ * running column sums, every step drops the oldest ring row and adds the next one
+ */
+static int box_band(BandJob *job, size_t y0, size_t y1, uchar *halo) {
+    int r = *(const int *)job->args;
+    size_t w = job->io.w, nbytes = job->io.row_bytes;
+    size_t ring_rows = 2 * r + 1;
+    unsigned window = ring_rows;
+    bool narrow = window <= MAX_WINDOW_U16;
+
+    ImpArena *arena = arena_thread();
+    ArenaMark mark = arena_mark(arena);
+    uchar *ring = arena_alloc(arena, ring_rows * nbytes);
+    uchar *tmp = arena_alloc(arena, nbytes);
+    uchar *out = arena_alloc(arena, nbytes);
+    void *sums = arena_calloc(arena, nbytes, narrow ? sizeof(uint16_t) : sizeof(uint32_t));
+    if (!ring || !tmp || !out || !sums) {
+        arena_release(arena, mark);
+        return -1;
+    }
+    uint16_t *sum16 = sums;
+    uint32_t *sum32 = sums;
+
+#define RING(v) (ring + (size_t)((v) - ((long)y0 - r)) % ring_rows * nbytes)
+    for (long v = (long)y0 - r; v <= (long)y0 + r; ++v) {
+        box_row(fetch_row(job, y0, y1, halo, v, tmp), RING(v), w, r);
+        for (size_t i = 0; i < nbytes; ++i) {
+            if (narrow)
+                sum16[i] += RING(v)[i];
+            else
+                sum32[i] += RING(v)[i];
+        }
+    }
+
+    for (size_t y = y0; y < y1; ++y) {
+        if (narrow) {
+            column_average16(out, sum16, nbytes, window);
+        } else {
+            for (size_t i = 0; i < nbytes; ++i)
+                out[i] = (sum32[i] + window / 2) / window;
+        }
+        store_row(&job->io, y, out);
+        if (y + 1 == y1)
+            break;
+
+        // the slot of the outgoing row y - r is reused for the incoming row y + r + 1
+        long outgoing = (long)y - r, incoming = (long)y + r + 1;
+        memcpy(tmp, RING(outgoing), nbytes);
+        box_row(fetch_row(job, y0, y1, halo, incoming, out), RING(incoming), w, r);
+        if (narrow) {
+            column_update16(sum16, RING(incoming), tmp, nbytes);
+        } else {
+            for (size_t i = 0; i < nbytes; ++i)
+                sum32[i] += RING(incoming)[i] - tmp[i];
+        }
+    }
+#undef RING
+
+    arena_release(arena, mark);
+    return 0;
+}
+
+int box_blur(const ImpImage *image, int radius) {
+    if (radius <= 0)
+        return 0;
+    return run_banded(image, radius, box_band, &radius);
+}
+
+int gaussian_blur(const ImpImage *image, double sigma) {
+    if (sigma <= 0.0)
+        return 0;
+
+    // box widths whose three passes match the variance of the gaussian
+    // see https://www.peterkovesi.com/papers/FastGaussianSmoothing.pdf
+    int passes = 3;
+    double ideal = sqrt(12.0 * sigma * sigma / passes + 1);
+    int wl = (int)floor(ideal);
+    if (wl % 2 == 0)
+        --wl;
+    int wu = wl + 2;
+    double ideal_m = (12.0 * sigma * sigma - passes * wl * wl - 4.0 * passes * wl - 3.0 * passes) / (-4.0 * wl - 4);
+    int m = (int)round(ideal_m);
+
+    for (int i = 0; i < passes; ++i) {
+        int width = i < m ? wl : wu;
+        if (box_blur(image, (width - 1) / 2) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * 3x3 neighbourhood filters keep three compact rows (above, current, below) in a ring, the
+ * row above is a copy taken before it was overwritten. ring rows carry one replicated pixel
+ * on each side so the inner loops never clamp
+ */
+typedef enum { KERNEL_GENERIC, KERNEL_SOBEL, KERNEL_LAPLACIAN } Kernel3x3Type;
+
+typedef struct {
+    Kernel3x3Type type;
+    const int *kernel;
+    int divisor, bias;
+} Kernel3x3;
+
+static void pad_row(uchar *padded, const uchar *row, size_t w) {
+    memcpy(padded + 3, row, 3 * w);
+    memcpy(padded, row, 3);
+    memcpy(padded + 3 * (w + 1), row + 3 * (w - 1), 3);
+}
+
+// gray holds 3 * (w + 2) ints for the luminance kernels
+static void kernel_row(BandJob *job, const Kernel3x3 *k, uchar *rows[3], uchar *out, int *gray) {
+    size_t w = job->io.w;
+    if (k->type == KERNEL_GENERIC) {
+        const int *m = k->kernel;
+        const uchar *a = rows[0], *b = rows[1], *c = rows[2];
+        for (size_t i = 0; i < 3 * w; ++i) {
+            int sum = m[0] * a[i] + m[1] * a[i + 3] + m[2] * a[i + 6] +
+                      m[3] * b[i] + m[4] * b[i + 3] + m[5] * b[i + 6] +
+                      m[6] * c[i] + m[7] * c[i + 3] + m[8] * c[i + 6];
+            // integer division is the slowest step, most kernels do not need it
+            out[i] = clamp((k->divisor == 1 ? sum : sum / k->divisor) + k->bias, 0, 255);
+        }
+        return;
+    }
+
+    // luminance of the three padded rows
+    const int *g = job->io.gray;
+    for (int j = 0; j < 3; ++j) {
+        const uchar *p = rows[j];
+        for (size_t x = 0; x < w + 2; ++x, p += 3)
+            gray[j * (w + 2) + x] = rgb_to_gray(p[g[0]], p[g[1]], p[g[2]]);
+    }
+
+    const int *a = gray, *b = gray + (w + 2), *c = gray + 2 * (w + 2);
+    for (size_t x = 0; x < w; ++x) {
+        int value;
+        if (k->type == KERNEL_SOBEL) {
+            int gx = (a[x + 2] + 2 * b[x + 2] + c[x + 2]) - (a[x] + 2 * b[x] + c[x]);
+            int gy = (c[x] + 2 * c[x + 1] + c[x + 2]) - (a[x] + 2 * a[x + 1] + a[x + 2]);
+            value = (int)sqrtf((float)(gx * gx + gy * gy));
+        } else {
+            value = abs(4 * b[x + 1] - a[x + 1] - c[x + 1] - b[x] - b[x + 2]);
+        }
+        out[3 * x] = out[3 * x + 1] = out[3 * x + 2] = value > 255 ? 255 : value;
+    }
+}
+
+static int kernel_band(BandJob *job, size_t y0, size_t y1, uchar *halo) {
+    const Kernel3x3 *k = job->args;
+    size_t w = job->io.w, padded = 3 * (w + 2);
+    ImpArena *arena = arena_thread();
+    ArenaMark mark = arena_mark(arena);
+    uchar *buf = arena_alloc(arena, 3 * padded + 2 * job->io.row_bytes);
+    int *gray = arena_alloc(arena, 3 * (w + 2) * sizeof(int));
+    if (!buf || !gray) {
+        arena_release(arena, mark);
+        return -1;
+    }
+    uchar *ring[3] = {buf, buf + padded, buf + 2 * padded};
+    uchar *out = buf + 3 * padded, *tmp = out + job->io.row_bytes;
+
+    for (int j = 0; j < 3; ++j)
+        pad_row(ring[j], fetch_row(job, y0, y1, halo, (long)y0 - 1 + j, tmp), w);
+
+    for (size_t y = y0; y < y1; ++y) {
+        kernel_row(job, k, ring, out, gray);
+        store_row(&job->io, y, out);
+        if (y + 1 == y1)
+            break;
+
+        uchar *oldest = ring[0];
+        ring[0] = ring[1];
+        ring[1] = ring[2];
+        ring[2] = oldest;
+        pad_row(ring[2], fetch_row(job, y0, y1, halo, (long)y + 2, tmp), w);
+    }
+
+    arena_release(arena, mark);
+    return 0;
+}
+
+int convolve3x3(const ImpImage *image, const int kernel[9], int divisor, int bias) {
+    Kernel3x3 k = {.type = KERNEL_GENERIC, .kernel = kernel, .divisor = divisor ? divisor : 1, .bias = bias};
+    return run_banded(image, 1, kernel_band, &k);
+}
+
+int sharpen(const ImpImage *image) {
+    static const int kernel[9] = {0, -1, 0, -1, 5, -1, 0, -1, 0};
+    return convolve3x3(image, kernel, 1, 0);
+}
+
+int sobel(const ImpImage *image) {
+    Kernel3x3 k = {.type = KERNEL_SOBEL};
+    return run_banded(image, 1, kernel_band, &k);
+}
+
+int laplacian(const ImpImage *image) {
+    Kernel3x3 k = {.type = KERNEL_LAPLACIAN};
+    return run_banded(image, 1, kernel_band, &k);
+}
+
+typedef struct {
+    RowIO io;
+    const uchar *blurred;
+    double amount;
+    int threshold;
+    int status;
+} UnsharpJob;
+
+static void unsharp_rows(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    UnsharpJob *job = ctx;
+    ImpArena *arena = arena_thread();
+    ArenaMark mark = arena_mark(arena);
+    uchar *row = arena_alloc(arena, job->io.row_bytes);
+    if (!row) {
+        job->status = -1;
+        return;
+    }
+    for (size_t y = begin; y < end; ++y) {
+        const uchar *blur = job->blurred + y * job->io.row_bytes;
+        load_row(&job->io, y, row);
+        for (size_t i = 0; i < job->io.row_bytes; ++i) {
+            int diff = row[i] - blur[i];
+            if (abs(diff) >= job->threshold)
+                row[i] = clamp((int)lround(row[i] + job->amount * diff), 0, 255);
+        }
+        store_row(&job->io, y, row);
+    }
+    arena_release(arena, mark);
+}
+
+int unsharp_mask(const ImpImage *image, double sigma, double amount, int threshold) {
+    UnsharpJob job = {.amount = amount, .threshold = threshold};
+    row_io_init(&job.io, image);
+    uchar *copy = malloc(job.io.row_bytes * job.io.h + 1);
+    if (!copy)
+        return -1;
+    for (size_t y = 0; y < job.io.h; ++y)
+        load_row(&job.io, y, copy + y * job.io.row_bytes);
+
+    ImpImage blurred = {.pixels = copy, .width = job.io.w, .height = job.io.h,
+                        .format = {.bytes_per_pixel = 3, .red = 0, .green = 1, .blue = 2}};
+    if (gaussian_blur(&blurred, sigma) != 0) {
+        free(copy);
+        return -1;
+    }
+
+    job.blurred = copy;
+    parallel_for(job.io.h, MIN_BAND_ROWS, unsharp_rows, &job);
+    free(copy);
+    return job.status;
+}
@@ -0,0 +1,32 @@
+/* convolve.h - spatial filters: blur, sharpen and edge detection */
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+#include "image.h"
+
+/**
+ * all functions work in place on any ImpImage format, touch only the color channels, replicate
+ * edge pixels and return 0 on success or -1 when scratch memory could not be allocated.
+ * images are processed in row bands across threads, each band keeping a small ring of rows
+ */
+
+/** mean of the (2 * radius + 1)^2 neighbourhood, cost does not depend on radius */
+int box_blur(const ImpImage *image, int radius);
+
+/** three box passes approximating a gaussian, cost does not depend on sigma */
+int gaussian_blur(const ImpImage *image, double sigma);
+
+/** per channel 3x3 kernel: clamp(sum(kernel * pixels) / divisor + bias) */
+int convolve3x3(const ImpImage *image, const int kernel[9], int divisor, int bias);
+int sharpen(const ImpImage *image);
+
+/** edge magnitude of the luminance, written as grayscale */
+int sobel(const ImpImage *image);
+int laplacian(const ImpImage *image);
+
+/**
+ * orig + amount * (orig - gaussian_blur(orig)) wherever the difference exceeds threshold.
+ * needs a 3 byte per pixel copy of the image
+ */
+int unsharp_mask(const ImpImage *image, double sigma, double amount, int threshold);
+
+#endif
@@ -0,0 +1,115 @@
+/* fill-test.c - flood_fill against a plain pixel by pixel breadth-first fill on random images */
+#include "fill-test.h"
+#include "fill.h"
+#include "random.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SIDE 80
+#define RUNS 3000
+
+static const ImpPixelFormat FORMAT = {4, 2, 1, 0, false};
+
+// a few close and a few far apart colors, so tolerance changes which regions connect
+static const uint32_t COLORS[] = {0xFF202020, 0xFF232120, 0xFF2A2A2A, 0xFFF0F0F0, 0xFF000000, 0x00202020};
+
+static bool within(uint32_t a, uint32_t b, int tolerance) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        if (abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF)) > tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// fills src into dest one pixel at a time, with a queue over a copy of the original
+static void reference_fill(const uint32_t *src, uint32_t *dest, int w, int h, int x, int y,
+                           uint32_t color, int tolerance, bool diagonal, ImpFillArea *area) {
+    uchar *seen = calloc((size_t)w * h, 1);
+    int *queue = malloc((size_t)w * h * sizeof(int));
+    assert(seen && queue);
+    uint32_t target = src[y * w + x];
+    int head = 0, tail = 0;
+    int x0 = x, y0 = y, x1 = x, y1 = y;
+    queue[tail++] = y * w + x;
+    seen[y * w + x] = 1;
+    while (head < tail) {
+        int i = queue[head++], px = i % w, py = i / w;
+        dest[i] = color;
+        x0 = px < x0 ? px : x0;
+        x1 = px > x1 ? px : x1;
+        y0 = py < y0 ? py : y0;
+        y1 = py > y1 ? py : y1;
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                int nx = px + dx, ny = py + dy;
+                if ((!dx && !dy) || (dx && dy && !diagonal) || nx < 0 || ny < 0 || nx >= w || ny >= h) {
+                    continue;
+                }
+                int n = ny * w + nx;
+                if (!seen[n] && within(src[n], target, tolerance)) {
+                    seen[n] = 1;
+                    queue[tail++] = n;
+                }
+            }
+        }
+    }
+    *area = (ImpFillArea){x0, y0, x1 - x0 + 1, y1 - y0 + 1, tail};
+    free(seen);
+    free(queue);
+}
+
+int fill_selftest(void) {
+    uint32_t *src = malloc(MAX_SIDE * MAX_SIDE * 4);
+    uint32_t *expected = malloc(MAX_SIDE * MAX_SIDE * 4);
+    uint32_t *actual = malloc(MAX_SIDE * MAX_SIDE * 4);
+    assert(src && expected && actual);
+    ImpRng rng;
+    rng_seed(&rng, 45);
+
+    for (int run = 0; run < RUNS; ++run) {
+        int w = 1 + rng_next(&rng) % MAX_SIDE, h = 1 + rng_next(&rng) % MAX_SIDE;
+        // noise of two colors makes mazes, blocks of all of them make plain regions
+        int ncolors = run % 2 ? 2 : sizeof(COLORS) / sizeof(COLORS[0]);
+        int block = 1 + rng_next(&rng) % 8;
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                ImpRng cell;
+                rng_seed_stream(&cell, run, (uint64_t)(y / block) * MAX_SIDE + x / block);
+                src[y * w + x] = COLORS[rng_next(&cell) % ncolors];
+            }
+        }
+        int x = rng_next(&rng) % w, y = rng_next(&rng) % h;
+        int tolerance = (int[]){0, 0, 3, 10, 255}[rng_next(&rng) % 5];
+        bool diagonal = rng_next(&rng) & 1;
+        // sometimes the fill color is the clicked one, or within tolerance of it
+        uint32_t color = rng_next(&rng) % 4 ? COLORS[rng_next(&rng) % 6] : src[y * w + x];
+
+        memcpy(expected, src, (size_t)w * h * 4);
+        memcpy(actual, src, (size_t)w * h * 4);
+        ImpFillArea want, got;
+        reference_fill(src, expected, w, h, x, y, color, tolerance, diagonal, &want);
+        ImpImage image = {(uchar *)actual, w, h, FORMAT};
+        assert(flood_fill(&image, x, y, color, tolerance, diagonal, &got) == 0);
+
+        assert(memcmp(expected, actual, (size_t)w * h * 4) == 0);
+        if (color == src[y * w + x] && tolerance == 0) {
+            // nothing to change, nothing reported
+            assert(got.count == 0 && got.w == 0 && got.h == 0);
+        } else {
+            assert(memcmp(&want, &got, sizeof(want)) == 0);
+        }
+    }
+
+    // out of bounds or unsupported formats are refused
+    ImpImage image = {(uchar *)actual, 4, 4, FORMAT};
+    assert(flood_fill(&image, 4, 0, 0, 0, false, NULL) == -1);
+    image.format.bytes_per_pixel = 3;
+    assert(flood_fill(&image, 0, 0, 0, 0, false, NULL) == -1);
+
+    free(src);
+    free(expected);
+    free(actual);
+    return 1;
+}
@@ -0,0 +1,8 @@
+/* fill-test.h - tests for the flood fill */
+#ifndef FILL_TEST_H
+#define FILL_TEST_H
+
+/** asserts on failure, returns 1 when every case passed */
+int fill_selftest(void);
+
+#endif
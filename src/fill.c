@@ -0,0 +1,144 @@
+#include "fill.h"
+#include "system/arena.h"
+#include "vector.h"
+
+/** a row to scan for runs touching [x1, x2], dy points away from the row that queued it */
+typedef struct {
+    int y, x1, x2, dy;
+} Span;
+
+VECTOR_DEFINE_STATIC(SpanVec, Span)
+
+typedef struct {
+    uint32_t *pixels;
+    int w, h;
+    uint32_t target, color;
+    int tolerance;
+    uchar *mask;            // when color is itself within tolerance: pixels already filled
+    int d;                  // 1 when diagonals connect
+    SpanVec stack;
+    bool failed;
+    int x0, y0, x1, y1;     // bounding box so far
+    size_t count;
+} Fill;
+
+static int max(int a, int b) { return a > b ? a : b; }
+
+static int min(int a, int b) { return a < b ? a : b; }
+
+static bool within(uint32_t a, uint32_t b, int tolerance) {
+    if (a == b)
+        return true;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int d = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+        if (d > tolerance || -d > tolerance)
+            return false;
+    }
+    return true;
+}
+
+static bool matches(const Fill *f, size_t i) {
+    if (f->tolerance == 0)
+        return f->pixels[i] == f->target;
+    if (f->mask && f->mask[i])
+        return false;
+    return within(f->pixels[i], f->target, f->tolerance);
+}
+
+static void push(Fill *f, int y, int x1, int x2, int dy) {
+    x1 = max(x1, 0);
+    x2 = min(x2, f->w - 1);
+    if (y < 0 || y >= f->h || x1 > x2)
+        return;
+    if (SpanVec_push(&f->stack, (Span){y, x1, x2, dy}) != 0)
+        f->failed = true;
+}
+
+static void fill_run(Fill *f, int y, int l, int r) {
+    size_t row = (size_t)y * f->w;
+    for (int x = l; x <= r; ++x)
+        f->pixels[row + x] = f->color;
+    if (f->mask)
+        memset(f->mask + row + l, 1, r - l + 1);
+    f->x0 = min(f->x0, l);
+    f->x1 = max(f->x1, r);
+    f->y0 = min(f->y0, y);
+    f->y1 = max(f->y1, y);
+    f->count += r - l + 1;
+}
+
+// fills the runs of a row that touch the span and queues the rows next to them
+static void scan(Fill *f, Span s) {
+    size_t row = (size_t)s.y * f->w;
+    int x = s.x1;
+    while (x <= s.x2) {
+        if (!matches(f, row + x)) {
+            ++x;
+            continue;
+        }
+        int l = x, r = x;
+        while (l > 0 && matches(f, row + l - 1))
+            --l;
+        while (r + 1 < f->w && matches(f, row + r + 1))
+            ++r;
+        fill_run(f, s.y, l, r);
+
+        push(f, s.y + s.dy, l - f->d, r + f->d, s.dy);
+        // a run reaching past the span can leak back around the ends of the row it came from
+        if (l - f->d < s.x1)
+            push(f, s.y - s.dy, l - f->d, s.x1 - 1, -s.dy);
+        if (r + f->d > s.x2)
+            push(f, s.y - s.dy, s.x2 + 1, r + f->d, -s.dy);
+        x = r + 2;
+    }
+}
+
+int flood_fill(const ImpImage *image, size_t x, size_t y, uint32_t color, int tolerance,
+               bool diagonal, ImpFillArea *area) {
+    if (area) {
+        *area = (ImpFillArea){0};
+    }
+    if (image->format.planar || image->format.bytes_per_pixel != 4 || x >= image->width ||
+        y >= image->height) {
+        return -1;
+    }
+
+    Fill f = {
+        .pixels = (uint32_t *)image->pixels,
+        .w = (int)image->width,
+        .h = (int)image->height,
+        .color = color,
+        .tolerance = tolerance > 0 ? tolerance : 0,
+        .d = diagonal ? 1 : 0,
+        .x0 = (int)x, .y0 = (int)y, .x1 = (int)x, .y1 = (int)y,
+    };
+    f.target = f.pixels[y * image->width + x];
+    if (f.target == color && f.tolerance == 0) {
+        return 0;
+    }
+
+    ImpArena *arena = arena_thread();
+    ArenaMark mark = arena_mark(arena);
+    // filled pixels that still match would be filled again forever without a mask
+    if (f.tolerance && within(color, f.target, f.tolerance)) {
+        f.mask = arena_calloc(arena, image->width * image->height, 1);
+        if (!f.mask) {
+            arena_release(arena, mark);
+            return -1;
+        }
+    }
+
+    SpanVec_init(&f.stack);
+    scan(&f, (Span){(int)y, (int)x, (int)x, 1});
+    push(&f, (int)y - 1, (int)x, (int)x, -1);
+    while (f.stack.size && !f.failed) {
+        scan(&f, f.stack.arr[--f.stack.size]);
+    }
+    SpanVec_free(&f.stack);
+    arena_release(arena, mark);
+
+    if (area && f.count) {
+        *area = (ImpFillArea){f.x0, f.y0, f.x1 - f.x0 + 1, f.y1 - f.y0 + 1, f.count};
+    }
+    return f.failed ? -1 : 0;
+}
@@ -0,0 +1,24 @@
+/* fill.h - flood fill of connected regions */
+#ifndef FILL_H
+#define FILL_H
+#include "image.h"
+
+typedef struct ImpFillArea {
+    size_t x, y, w, h;      // bounding box of the filled pixels, w and h are 0 when none were
+    size_t count;           // pixels filled
+} ImpFillArea;
+
+/**
+ * sets the pixels connected to (x, y) that are within tolerance of its value to color. the
+ * image must have 4 bytes per pixel and color is a raw pixel in its format. pixels are
+ * compared byte by byte, a pixel matches when no byte differs by more than tolerance (0 for
+ * exact matches). diagonal neighbours connect when diagonal is set.
+ *
+ * whole runs of a row are filled at once and the rows above and below queued as spans on a
+ * heap stack, so any region shape works without recursion. area may be NULL, returns 0 or -1
+ * when memory could not be allocated, in which case the region may be partially filled
+ */
+int flood_fill(const ImpImage *image, size_t x, size_t y, uint32_t color, int tolerance,
+               bool diagonal, ImpFillArea *area);
+
+#endif
@@ -0,0 +1,115 @@
+/* history-test.c - random edits to a tiled drawing, undone and redone against full snapshots */
+#include "history-test.h"
+#include "history.h"
+#include "random.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define W 900
+#define H 700
+#define STEPS 40
+#define BACKGROUND 0xFFFFFFFF
+
+static void snapshot(ImpTiles *doc, uint32_t *dest) {
+    imp_tiles_read(doc, (SDL_Rect){0, 0, W, H}, dest, W);
+}
+
+static bool same_as(ImpTiles *doc, const uint32_t *expected, uint32_t *scratch) {
+    snapshot(doc, scratch);
+    return memcmp(expected, scratch, (size_t)W * H * 4) == 0;
+}
+
+// one step: area is touched, then filled with a pattern of color
+static SDL_Rect edit(ImpHistory *hist, ImpTiles *doc, ImpRng *rng, uint32_t *buf) {
+    SDL_Rect r = {rng_next(rng) % W, rng_next(rng) % H, 1 + rng_next(rng) % 200, 1 + rng_next(rng) % 200};
+    r.w = SDL_min(r.w, W - r.x);
+    r.h = SDL_min(r.h, H - r.y);
+    uint32_t color = (uint32_t)rng_next(rng);
+    for (int i = 0; i < r.w * r.h; ++i) {
+        buf[i] = color + (i & 3);
+    }
+    imp_history_touch(hist, r);
+    assert(imp_tiles_write(doc, r, buf, r.w) == 0);
+    imp_history_commit(hist);
+    return r;
+}
+
+static void undo_redo_all(bool compress) {
+    ImpTiles *doc = create_imp_tiles(W, H, 0, BACKGROUND);
+    ImpHistory *hist = create_imp_history(doc, (size_t)1 << 30, compress);
+    uint32_t *states = malloc((size_t)(STEPS + 1) * W * H * 4);
+    uint32_t *buf = malloc((size_t)W * H * 4);
+    assert(doc && hist && states && buf);
+    ImpRng rng;
+    rng_seed(&rng, 44);
+
+    snapshot(doc, states);
+    for (int k = 1; k <= STEPS; ++k) {
+        edit(hist, doc, &rng, buf);
+        snapshot(doc, states + (size_t)k * W * H);
+    }
+
+    SDL_Rect changed;
+    for (int k = STEPS; k > 0; --k) {
+        assert(imp_history_undo(hist, &changed));
+        assert(same_as(doc, states + (size_t)(k - 1) * W * H, buf));
+    }
+    assert(!imp_history_undo(hist, &changed));
+    for (int k = 1; k <= STEPS; ++k) {
+        assert(imp_history_redo(hist, &changed));
+        assert(same_as(doc, states + (size_t)k * W * H, buf));
+    }
+    assert(!imp_history_redo(hist, &changed));
+
+    // a new edit after undoing drops the redo steps
+    assert(imp_history_undo(hist, &changed));
+    edit(hist, doc, &rng, buf);
+    assert(!imp_history_redo(hist, &changed));
+
+    imp_history_free(hist);
+    imp_tiles_free(doc);
+    free(states);
+    free(buf);
+}
+
+int history_selftest(void) {
+    undo_redo_all(false);
+    undo_redo_all(true);
+
+    ImpTiles *doc = create_imp_tiles(W, H, 0, BACKGROUND);
+    ImpHistory *hist = create_imp_history(doc, (size_t)1 << 30, true);
+    uint32_t *buf = malloc((size_t)W * H * 4);
+    assert(doc && hist && buf);
+    ImpRng rng;
+    rng_seed(&rng, 45);
+    SDL_Rect changed;
+
+    // touching without changing anything leaves no step
+    imp_history_touch(hist, (SDL_Rect){-10, -10, W + 20, H + 20});
+    imp_history_commit(hist);
+    assert(!imp_history_undo(hist, &changed));
+    assert(imp_history_bytes(hist) == 0);
+
+    // changed covers the edit, rounded out to history tiles
+    SDL_Rect r = edit(hist, doc, &rng, buf);
+    assert(imp_history_undo(hist, &changed));
+    SDL_Rect both;
+    SDL_UnionRect(&changed, &r, &both);
+    assert(SDL_RectEquals(&both, &changed));
+    assert(changed.x % IMP_HISTORY_TILE == 0 && changed.y % IMP_HISTORY_TILE == 0);
+
+    // over budget the oldest steps go, the newest one always stays
+    imp_history_clear(hist);
+    imp_history_set_budget(hist, 1);
+    for (int k = 0; k < 5; ++k) {
+        edit(hist, doc, &rng, buf);
+    }
+    assert(imp_history_undo(hist, &changed));
+    assert(!imp_history_undo(hist, &changed));
+
+    imp_history_free(hist);
+    imp_tiles_free(doc);
+    free(buf);
+    return 1;
+}
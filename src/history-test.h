@@ -0,0 +1,8 @@
+/* history-test.h - tests for the undo history */
+#ifndef HISTORY_TEST_H
+#define HISTORY_TEST_H
+
+/** asserts on failure, returns 1 when every case passed */
+int history_selftest(void);
+
+#endif
@@ -0,0 +1,354 @@
+#include "history.h"
+#include "system/arena.h"
+#include "system/lz.h"
+#include "system/parallel.h"
+#include "tiles.h"
+#include "vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TILE IMP_HISTORY_TILE
+#define TILE_BYTES (TILE * TILE * 4)
+// steps this close to the present stay raw, undoing a few times in a row costs no decompression
+#define HOT_STEPS 4
+
+typedef struct {
+    uint32_t index;     // row major tile number
+    uint32_t size;      // bytes in data
+    bool compressed;
+    uchar *data;        // raw: the tile's rows back to back
+} Tile;
+
+VECTOR_DEFINE_STATIC(TileVec, Tile)
+
+typedef struct {
+    TileVec tiles;
+    size_t bytes;
+    bool compressed;    // every tile went through LZ_compress, the incompressible ones stay raw
+} Step;
+
+VECTOR_DEFINE_STATIC(StepVec, Step)
+
+struct ImpHistory {
+    ImpTiles *doc;
+    int w, h;
+    int cols, rows;
+    StepVec steps;      // undo steps are [0, current), redo steps [current, size)
+    size_t current;
+    Step pending;       // tiles saved since the last commit
+    uchar *saved;       // per tile, set while pending holds it
+    size_t bytes;       // all steps and pending
+    size_t budget;
+    bool compress;
+};
+
+static SDL_Rect tile_rect(const ImpHistory *hist, uint32_t index) {
+    int x = (int)(index % hist->cols) * TILE;
+    int y = (int)(index / hist->cols) * TILE;
+    return (SDL_Rect){x, y, SDL_min(TILE, hist->w - x), SDL_min(TILE, hist->h - y)};
+}
+
+static size_t rect_bytes(SDL_Rect r) {
+    return 4 * (size_t)r.w * r.h;
+}
+
+// tiles are kept with their rows back to back, r.w pixels apart
+static void copy_out(ImpHistory *hist, SDL_Rect r, uchar *dest) {
+    imp_tiles_read(hist->doc, r, (uint32_t *)dest, r.w);
+}
+
+static bool copy_in(ImpHistory *hist, SDL_Rect r, const uchar *src) {
+    return imp_tiles_write(hist->doc, r, (const uint32_t *)src, r.w) == 0;
+}
+
+// without scratch memory a tile counts as changed and is kept
+static bool tile_unchanged(ImpHistory *hist, SDL_Rect r, const uchar *data, uchar *scratch) {
+    if (!scratch) {
+        return false;
+    }
+    copy_out(hist, r, scratch);
+    return memcmp(scratch, data, rect_bytes(r)) == 0;
+}
+
+static void step_free(Step *s) {
+    for (size_t i = 0; i < s->tiles.size; ++i)
+        free(s->tiles.arr[i].data);
+    TileVec_free(&s->tiles);
+    s->bytes = 0;
+    s->compressed = false;
+}
+
+static void drop_step(ImpHistory *hist, size_t i) {
+    Step *steps = hist->steps.arr;
+    hist->bytes -= steps[i].bytes;
+    step_free(&steps[i]);
+    memmove(&steps[i], &steps[i + 1], (hist->steps.size - i - 1) * sizeof(Step));
+    hist->steps.size--;
+    if (i < hist->current)
+        hist->current--;
+}
+
+void imp_history_clear(ImpHistory *hist) {
+    while (hist->steps.size)
+        drop_step(hist, hist->steps.size - 1);
+    for (size_t i = 0; i < hist->pending.tiles.size; ++i)
+        hist->saved[hist->pending.tiles.arr[i].index] = 0;
+    step_free(&hist->pending);
+    hist->bytes = 0;
+}
+
+ImpHistory *create_imp_history(ImpTiles *doc, size_t budget, bool compress) {
+    ImpHistory *hist = calloc(1, sizeof(ImpHistory));
+    if (!hist) {
+        return NULL;
+    }
+    int w = imp_tiles_width(doc), h = imp_tiles_height(doc);
+    hist->doc = doc;
+    hist->w = w;
+    hist->h = h;
+    hist->cols = (w + TILE - 1) / TILE;
+    hist->rows = (h + TILE - 1) / TILE;
+    hist->saved = calloc((size_t)hist->cols * hist->rows, 1);
+    if (!hist->saved) {
+        free(hist);
+        return NULL;
+    }
+    StepVec_init(&hist->steps);
+    TileVec_init(&hist->pending.tiles);
+    hist->budget = budget;
+    hist->compress = compress;
+    return hist;
+}
+
+void imp_history_free(ImpHistory *hist) {
+    if (!hist) {
+        return;
+    }
+    imp_history_clear(hist);
+    StepVec_free(&hist->steps);
+    free(hist->saved);
+    free(hist);
+}
+
+void imp_history_touch(ImpHistory *hist, SDL_Rect area) {
+    SDL_Rect bounds = {0, 0, hist->w, hist->h};
+    if (!SDL_IntersectRect(&area, &bounds, &area)) {
+        return;
+    }
+    int tx0 = area.x / TILE, tx1 = (area.x + area.w - 1) / TILE;
+    int ty0 = area.y / TILE, ty1 = (area.y + area.h - 1) / TILE;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            uint32_t index = (uint32_t)(ty * hist->cols + tx);
+            if (hist->saved[index]) {
+                continue;
+            }
+            SDL_Rect r = tile_rect(hist, index);
+            Tile tile = {index, (uint32_t)rect_bytes(r), false, malloc(rect_bytes(r))};
+            if (!tile.data || TileVec_push(&hist->pending.tiles, tile) != 0) {
+                free(tile.data);
+                fprintf(stderr, "imp_history_touch: out of memory, undo history cleared\n");
+                imp_history_clear(hist);
+                return;
+            }
+            copy_out(hist, r, tile.data);
+            hist->saved[index] = 1;
+            hist->pending.bytes += tile.size;
+            hist->bytes += tile.size;
+        }
+    }
+}
+
+static void compress_tiles(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void) chunk;
+    Step *s = ctx;
+    ImpArena *arena = arena_thread();
+    ArenaMark mark = arena_mark(arena);
+    uchar *buf = arena_alloc(arena, LZ_BOUND(TILE_BYTES));
+    for (size_t i = begin; i < end && buf; ++i) {
+        Tile *t = &s->tiles.arr[i];
+        if (t->compressed) {
+            continue;
+        }
+        size_t n = LZ_compress(t->data, t->size, buf, LZ_BOUND(TILE_BYTES));
+        uchar *data = n && n < t->size ? malloc(n) : NULL;
+        if (!data) {
+            continue;
+        }
+        memcpy(data, buf, n);
+        free(t->data);
+        t->data = data;
+        t->size = (uint32_t)n;
+        t->compressed = true;
+    }
+    arena_release(arena, mark);
+}
+
+// compresses the steps that left the hot window around the present
+static void history_compress_cold(ImpHistory *hist) {
+    if (!hist->compress) {
+        return;
+    }
+    for (size_t i = 0; i < hist->steps.size; ++i) {
+        size_t distance = i < hist->current ? hist->current - i : i - hist->current + 1;
+        Step *s = &hist->steps.arr[i];
+        if (distance <= HOT_STEPS || s->compressed) {
+            continue;
+        }
+        parallel_for(s->tiles.size, 16, compress_tiles, s);
+        size_t bytes = 0;
+        for (size_t t = 0; t < s->tiles.size; ++t)
+            bytes += s->tiles.arr[t].size;
+        hist->bytes = hist->bytes - s->bytes + bytes;
+        s->bytes = bytes;
+        s->compressed = true;
+    }
+}
+
+// the oldest undo steps go first, then the furthest redo steps. the nearest of each stays
+static void history_trim(ImpHistory *hist) {
+    while (hist->bytes > hist->budget && hist->current > 1)
+        drop_step(hist, 0);
+    while (hist->bytes > hist->budget && hist->steps.size > hist->current + 1)
+        drop_step(hist, hist->steps.size - 1);
+}
+
+void imp_history_commit(ImpHistory *hist) {
+    Step *p = &hist->pending;
+    if (!p->tiles.size) {
+        return;
+    }
+    ImpArena *arena = arena_thread();
+    ArenaMark mark = arena_mark(arena);
+    uchar *scratch = arena_alloc(arena, TILE_BYTES);
+    size_t kept = 0;
+    for (size_t i = 0; i < p->tiles.size; ++i) {
+        Tile t = p->tiles.arr[i];
+        hist->saved[t.index] = 0;
+        if (tile_unchanged(hist, tile_rect(hist, t.index), t.data, scratch)) {
+            p->bytes -= t.size;
+            hist->bytes -= t.size;
+            free(t.data);
+        } else {
+            p->tiles.arr[kept++] = t;
+        }
+    }
+    p->tiles.size = kept;
+    arena_release(arena, mark);
+    if (!kept) {
+        return;
+    }
+
+    // a new edit ends the branch that could have been redone
+    while (hist->steps.size > hist->current)
+        drop_step(hist, hist->steps.size - 1);
+    if (StepVec_push(&hist->steps, *p) != 0) {
+        fprintf(stderr, "imp_history_commit: out of memory, undo history cleared\n");
+        imp_history_clear(hist);
+        return;
+    }
+    hist->current++;
+    TileVec_init(&p->tiles);
+    p->bytes = 0;
+
+    history_compress_cold(hist);
+    history_trim(hist);
+}
+
+// exchanges the tiles of s with the pixels under them, s then holds the other side raw
+static bool step_swap(ImpHistory *hist, Step *s, SDL_Rect *changed) {
+    ImpArena *arena = arena_thread();
+    ArenaMark mark = arena_mark(arena);
+    uchar *scratch = arena_alloc(arena, TILE_BYTES);
+    bool ok = scratch != NULL;
+    size_t bytes = 0;
+    *changed = (SDL_Rect){0};
+
+    for (size_t i = 0; i < s->tiles.size && ok; ++i) {
+        Tile *t = &s->tiles.arr[i];
+        SDL_Rect r = tile_rect(hist, t->index);
+        size_t size = rect_bytes(r);
+        if (t->compressed) {
+            uchar *data = malloc(size);
+            ok = data && LZ_decompress(t->data, t->size, scratch, size) == 0;
+            if (!ok) {
+                free(data);
+                break;
+            }
+            copy_out(hist, r, data);
+            ok = copy_in(hist, r, scratch);
+            if (!ok) {
+                free(data);
+                break;
+            }
+            free(t->data);
+            t->data = data;
+            t->size = (uint32_t)size;
+            t->compressed = false;
+        } else {
+            copy_out(hist, r, scratch);
+            ok = copy_in(hist, r, t->data);
+            if (!ok) {
+                break;
+            }
+            memcpy(t->data, scratch, size);
+        }
+        bytes += size;
+        if (i == 0) {
+            *changed = r;
+        } else {
+            SDL_UnionRect(changed, &r, changed);
+        }
+    }
+    arena_release(arena, mark);
+
+    if (!ok) {
+        // some tiles may already be swapped, so the canvas is redrawn and the history dropped
+        fprintf(stderr, "imp_history: could not restore a step, undo history cleared\n");
+        *changed = (SDL_Rect){0, 0, hist->w, hist->h};
+        imp_history_clear(hist);
+        return false;
+    }
+    hist->bytes = hist->bytes - s->bytes + bytes;
+    s->bytes = bytes;
+    s->compressed = false;
+    return true;
+}
+
+bool imp_history_undo(ImpHistory *hist, SDL_Rect *changed) {
+    imp_history_commit(hist);
+    if (hist->current == 0) {
+        return false;
+    }
+    if (!step_swap(hist, &hist->steps.arr[hist->current - 1], changed)) {
+        return true;
+    }
+    hist->current--;
+    history_compress_cold(hist);
+    history_trim(hist);
+    return true;
+}
+
+bool imp_history_redo(ImpHistory *hist, SDL_Rect *changed) {
+    imp_history_commit(hist);
+    if (hist->current == hist->steps.size) {
+        return false;
+    }
+    if (!step_swap(hist, &hist->steps.arr[hist->current], changed)) {
+        return true;
+    }
+    hist->current++;
+    history_compress_cold(hist);
+    history_trim(hist);
+    return true;
+}
+
+size_t imp_history_bytes(ImpHistory *hist) {
+    return hist->bytes;
+}
+
+void imp_history_set_budget(ImpHistory *hist, size_t budget) {
+    hist->budget = budget;
+    history_trim(hist);
+}
@@ -0,0 +1,44 @@
+/* history.h - undo and redo of canvas edits, kept as 64x64 tiles */
+#ifndef IMP_HISTORY_H
+#define IMP_HISTORY_H
+#include "tiles.h"
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define IMP_HISTORY_TILE 64
+
+typedef struct ImpHistory ImpHistory;
+
+/**
+ * history of a tiled drawing, in its coordinates, so steps stay valid whatever part of it is
+ * on screen. a step holds only the tiles its edit touched, copied just before their first
+ * write. steps further than a few from the present are LZ compressed when compress is set,
+ * and the oldest ones are dropped once all of them take more than budget bytes (the newest
+ * step is kept whatever its size). doc must be up to date whenever the history reads it
+ */
+ImpHistory *create_imp_history(ImpTiles *doc, size_t budget, bool compress);
+void imp_history_free(ImpHistory *hist);
+
+/** the step in progress saves the tiles under area (clipped), call before writing to it */
+void imp_history_touch(ImpHistory *hist, SDL_Rect area);
+
+/** ends the step in progress, tiles that did not change are dropped and so are redo steps */
+void imp_history_commit(ImpHistory *hist);
+
+/**
+ * swaps the tiles of the previous (next) step back into the drawing, changed is set to their
+ * bounding rect. commits first, returns false when there is nothing to undo (redo). if a step
+ * can't be restored the history is cleared and changed covers the whole drawing
+ */
+bool imp_history_undo(ImpHistory *hist, SDL_Rect *changed);
+bool imp_history_redo(ImpHistory *hist, SDL_Rect *changed);
+
+/** drops every step and the one in progress */
+void imp_history_clear(ImpHistory *hist);
+
+/** bytes held by all steps, compressed tiles count at their compressed size */
+size_t imp_history_bytes(ImpHistory *hist);
+void imp_history_set_budget(ImpHistory *hist, size_t budget);
+
+#endif
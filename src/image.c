@@ -6,11 +6,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "image.h"
+#include "random.h"
+#include "system/palette.h"
+#include "system/parallel.h"
 #define rgb_red(rgb) ((rgb & 0xFF0000) >> 16)
 #define rgb_green(rgb) ((rgb & 0x00FF00) >> 8)
 #define rgb_blue(rgb) (rgb & 0x0000FF)
 
+// pixels per noise rng stream, a multiple of the 64 pixels covered by one bernoulli draw
+#define NOISE_BLOCK_PIXELS 4096
+// pixels per parallel_for chunk of the whole-buffer filter functions
+#define FILTER_CHUNK_PIXELS (16 * NOISE_BLOCK_PIXELS)
+#define GAUSSIAN_TABLE_BITS 12
+#define GAUSSIAN_TABLE_SIZE (1 << GAUSSIAN_TABLE_BITS)
+
 static int max(int a, int b) {
    return a > b ? a : b;
 }
@@ -19,10 +34,6 @@ static int min(int a, int b) {
    return a < b ? a : b;
 }
 
-static bool bernoulli_trial() {
-   return rand() % 2 ? true : false;
-}
-
 // clamp val into range [lower, upper]
 static int clamp(int val, int lower, int upper) {
    return max(lower, min(upper, val));
@@ -38,55 +49,349 @@ static double distance_rgb(int32_t tone1, int32_t tone2) {
                 pow(abs(rgb_blue(tone1) - rgb_blue(tone2)), 2) );
 }
 
-void invert(uchar *buf, size_t size) {
-   for (size_t i = 0; i < size; ++i)
-      buf[i] = 255 - buf[i];
+// sign_mask3/4[bits][i] is 0xFF when byte i belongs to one of the 8 pixels whose bit is set
+static uchar sign_mask3[256][24];
+static uchar sign_mask4[256][32];
+// standard normal quantiles at the centers of GAUSSIAN_TABLE_SIZE equiprobable intervals
+static float unit_gaussian[GAUSSIAN_TABLE_SIZE];
+static pthread_once_t noise_tables_once = PTHREAD_ONCE_INIT;
+
+static void init_noise_tables(void) {
+   for (int bits = 0; bits < 256; ++bits) {
+      for (int i = 0; i < 24; ++i)
+         sign_mask3[bits][i] = (bits >> (i / 3)) & 1 ? 0xFF : 0x00;
+      for (int i = 0; i < 32; ++i)
+         sign_mask4[bits][i] = (bits >> (i / 4)) & 1 ? 0xFF : 0x00;
+   }
+   for (int i = 0; i < GAUSSIAN_TABLE_SIZE; ++i)
+      unit_gaussian[i] = normal_quantile((i + 0.5) / GAUSSIAN_TABLE_SIZE);
+}
+
+const ImpPixelFormat IMP_FORMAT_BGR24 = { .bytes_per_pixel = 3, .red = 2, .green = 1, .blue = 0 };
+const ImpPixelFormat IMP_FORMAT_RGB_PLANAR = { .bytes_per_pixel = 1, .red = 0, .green = 1, .blue = 2, .planar = true };
+
+static uchar mask_byte_offset(uint32_t mask) {
+   int shift = 0;
+   while (shift < 24 && !((mask >> shift) & 0xFF))
+      shift += 8;
+   const uint16_t probe = 1;
+   bool little_endian = *(const uchar *) &probe == 1;
+   return little_endian ? shift / 8 : 3 - shift / 8;
+}
+
+ImpPixelFormat pixel_format_packed32(uint32_t rmask, uint32_t gmask, uint32_t bmask) {
+   return (ImpPixelFormat){ .bytes_per_pixel = 4, .red = mask_byte_offset(rmask),
+                            .green = mask_byte_offset(gmask), .blue = mask_byte_offset(bmask) };
+}
+
+/**
+ * ImpImage resolved for the kernels: channel c of pixel i is at base[i * stride + c], planar
+ * images just have stride 1 and plane sized channel offsets
+ */
+typedef struct {
+   uchar *base;
+   size_t stride;
+   size_t r, g, b;
+   size_t width;
+   // packed only: 0xFF for every color byte of a pixel, 0x00 for alpha, repeated for 16 pixels
+   uchar color_bytes[64];
+} PixelLayout;
+
+void image_layout(const ImpImage *image, size_t *stride, size_t offsets[3]) {
+   const ImpPixelFormat *fmt = &image->format;
+   size_t plane = fmt->planar ? image->width * image->height : 1;
+   *stride = fmt->planar ? 1 : fmt->bytes_per_pixel;
+   offsets[0] = fmt->red * plane;
+   offsets[1] = fmt->green * plane;
+   offsets[2] = fmt->blue * plane;
 }
 
-void add_uniform_bernoulli_noise(uchar *buf, size_t size_bytes) {
-   size_t adjusted_end = size_bytes - (size_bytes % 3);
-   for (size_t i = 0; i < adjusted_end; i += 3) {
-      int difference = 50;
-      int result = bernoulli_trial() ? difference : -difference;
-      buf[i + 2] = clamp(buf[i + 2] + result, 0, 255);
-      buf[i + 1] = clamp(buf[i + 1] + result, 0, 255);
-      buf[i] = clamp(buf[i] + result, 0, 255);
+static void resolve_layout(PixelLayout *L, const ImpImage *image) {
+   size_t offsets[3];
+   image_layout(image, &L->stride, offsets);
+   L->base = image->pixels;
+   L->width = image->width;
+   L->r = offsets[0];
+   L->g = offsets[1];
+   L->b = offsets[2];
+   if (image->format.planar)
+      return;
+
+   for (size_t i = 0; i < 16 * L->stride; ++i) {
+      size_t k = i % L->stride;
+      L->color_bytes[i] = k == L->r || k == L->g || k == L->b ? 0xFF : 0x00;
    }
 }
 
-void grayscale(uchar *buf, size_t size_bytes) {
-   size_t adjusted_end = size_bytes - (size_bytes % 3);
-   for (size_t px = 0; px < adjusted_end; px += 3) {
-      uchar gray = rgb_to_gray(buf[px + 2], buf[px + 1], buf[px]);
-      buf[px + 2] = gray;
-      buf[px + 1] = gray;
-      buf[px] = gray;
+static inline void add_to_pixel(const PixelLayout *L, size_t px, int value) {
+   uchar *p = L->base + px * L->stride;
+   p[L->r] = clamp(p[L->r] + value, 0, 255);
+   p[L->g] = clamp(p[L->g] + value, 0, 255);
+   p[L->b] = clamp(p[L->b] + value, 0, 255);
+}
+
+// saturating buf[i] + plus[i] - minus[i], n is a multiple of 16
+static void saturate_bytes(uchar *buf, const uchar *plus, const uchar *minus, size_t n) {
+#ifdef __SSE2__
+   for (size_t v = 0; v < n; v += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(buf + v));
+      x = _mm_adds_epu8(x, _mm_loadu_si128((const __m128i *)(plus + v)));
+      x = _mm_subs_epu8(x, _mm_loadu_si128((const __m128i *)(minus + v)));
+      _mm_storeu_si128((__m128i *)(buf + v), x);
    }
+#else
+   for (size_t i = 0; i < n; ++i)
+      buf[i] = clamp(buf[i] + plus[i] - minus[i], 0, 255);
+#endif
 }
 
-void two_tone(uchar *buf, size_t bytes, uint32_t tone1, uint32_t tone2) {
-   size_t adjusted_end = bytes - (bytes % 3);
-   for (size_t px = 0; px < adjusted_end; px += 3) {
+static void rng_discard(ImpRng *rng, size_t n) {
+   while (n--)
+      rng_next(rng);
+}
+
+/**
+ * noise kernels get pixels [base + lo, base + hi) of the NOISE_BLOCK_PIXELS block starting at
+ * pixel base and seed the block's own stream, so any tiling of the image, and any pixel format,
+ * draws the same numbers per pixel. packed formats take 16 pixel SIMD steps
+ */
+
+// whole 64 pixel groups of a packed layout from px on, s is passed as a constant so the 16 pixel
+// steps unroll. returns the first pixel not processed
+static inline size_t bernoulli_noise_simd(ImpRng *rng, const PixelLayout *L, size_t base, size_t px,
+                                          size_t hi, int amplitude, const size_t s) {
+   uchar amp[64];
+   for (size_t i = 0; i < 16 * s; ++i)
+      amp[i] = amplitude & L->color_bytes[i];
+   for (; px + 64 <= hi; px += 64) {
+      uint64_t bits = rng_next(rng);
+      for (int block = 0; block < 4; ++block, bits >>= 16) {
+         uchar plus[64], minus[64];
+         memcpy(plus, s == 3 ? sign_mask3[bits & 0xFF] : sign_mask4[bits & 0xFF], 8 * s);
+         memcpy(plus + 8 * s, s == 3 ? sign_mask3[(bits >> 8) & 0xFF] : sign_mask4[(bits >> 8) & 0xFF], 8 * s);
+         for (size_t i = 0; i < 16 * s; ++i) {
+            minus[i] = amp[i] & ~plus[i];
+            plus[i] &= amp[i];
+         }
+         saturate_bytes(L->base + (base + px + 16 * block) * s, plus, minus, 16 * s);
+      }
+   }
+   return px;
+}
+
+// pixel i of a block uses bit (i % 64) of draw (i / 64)
+static void bernoulli_noise_block(const ImpFilter *f, ImpRng *rng, const PixelLayout *L,
+                                  size_t base, size_t lo, size_t hi, const void *aux) {
+   (void) aux;
+   int amplitude = clamp(f->amplitude, 0, 255);
+   size_t px = lo;
+   rng_discard(rng, lo / 64);
+
+   if (px % 64) {
+      uint64_t bits = rng_next(rng) >> (px % 64);
+      for (; px < hi && px % 64; ++px, bits >>= 1)
+         add_to_pixel(L, base + px, bits & 1 ? amplitude : -amplitude);
+   }
+
+   if (L->stride == 3)
+      px = bernoulli_noise_simd(rng, L, base, px, hi, amplitude, 3);
+   else if (L->stride == 4)
+      px = bernoulli_noise_simd(rng, L, base, px, hi, amplitude, 4);
+
+   while (px < hi) {
+      uint64_t bits = rng_next(rng);
+      for (size_t n = 0; n < 64 && px < hi; ++n, ++px, bits >>= 1)
+         add_to_pixel(L, base + px, bits & 1 ? amplitude : -amplitude);
+   }
+}
+
+// saturating add of plus[i] - minus[i] to every color byte of 16 packed pixels from px on
+static inline void saturate_pixels16(const PixelLayout *L, size_t px, const uchar *plus,
+                                     const uchar *minus, const size_t s) {
+   uchar p[64], m[64];
+   for (size_t i = 0; i < 16; ++i) {
+      for (size_t k = 0; k < s; ++k) {
+         p[i * s + k] = plus[i] & L->color_bytes[k];
+         m[i * s + k] = minus[i] & L->color_bytes[k];
+      }
+   }
+   saturate_bytes(L->base + px * s, p, m, 16 * s);
+}
+
+// sigma * unit_gaussian, split into saturating positive and negative parts
+struct ImpNoiseTables {
+   uchar plus[GAUSSIAN_TABLE_SIZE], minus[GAUSSIAN_TABLE_SIZE];
+};
+
+static void gaussian_tables_build(struct ImpNoiseTables *t, double sigma) {
+   pthread_once(&noise_tables_once, init_noise_tables);
+   for (int i = 0; i < GAUSSIAN_TABLE_SIZE; ++i) {
+      int rounded = clamp((int) lrint(sigma * unit_gaussian[i]), -255, 255);
+      t->plus[i] = rounded > 0 ? rounded : 0;
+      t->minus[i] = rounded < 0 ? -rounded : 0;
+   }
+}
+
+int filter_prepare(ImpFilter *filter) {
+   if (filter->type != IMP_FILTER_GAUSSIAN_NOISE || filter->noise_tables)
+      return 0;
+   struct ImpNoiseTables *t = malloc(sizeof(*t));
+   if (!t)
+      return -1;
+   gaussian_tables_build(t, filter->sigma);
+   filter->noise_tables = t;
+   return 0;
+}
+
+void filter_release(ImpFilter *filter) {
+   free((void *) filter->noise_tables);
+   filter->noise_tables = NULL;
+}
+
+// every draw yields five 12-bit table indices, pixel i uses index (i % 5) of draw (i / 5)
+static void gaussian_noise_block(const ImpFilter *f, ImpRng *rng, const PixelLayout *L,
+                                 size_t base, size_t lo, size_t hi, const void *aux) {
+   (void) f;
+   const struct ImpNoiseTables *t = aux;
+   const int per_draw = 64 / GAUSSIAN_TABLE_BITS;
+   rng_discard(rng, lo / per_draw);
+   uint64_t bits = 0;
+   int remaining = 0;
+   if (lo % per_draw) {
+      bits = rng_next(rng) >> (GAUSSIAN_TABLE_BITS * (lo % per_draw));
+      remaining = per_draw - lo % per_draw;
+   }
+
+   for (size_t px = lo; px < hi;) {
+      size_t n = hi - px < 16 ? hi - px : 16;
+      uchar plus[16], minus[16];
+      for (size_t i = 0; i < n; ++i) {
+         if (!remaining) {
+            bits = rng_next(rng);
+            remaining = per_draw;
+         }
+         size_t index = bits & (GAUSSIAN_TABLE_SIZE - 1);
+         bits >>= GAUSSIAN_TABLE_BITS;
+         --remaining;
+         plus[i] = t->plus[index];
+         minus[i] = t->minus[index];
+      }
+
+      if (n == 16 && L->stride == 3)
+         saturate_pixels16(L, base + px, plus, minus, 3);
+      else if (n == 16 && L->stride == 4)
+         saturate_pixels16(L, base + px, plus, minus, 4);
+      else
+         for (size_t i = 0; i < n; ++i)
+            add_to_pixel(L, base + px + i, plus[i] - minus[i]);
+      px += n;
+   }
+}
+
+// one 32-bit uniform per pixel, below threshold/2 is salt, below threshold is pepper
+static void salt_and_pepper_noise_block(const ImpFilter *f, ImpRng *rng, const PixelLayout *L,
+                                        size_t base, size_t lo, size_t hi, const void *aux) {
+   (void) aux;
+   double density = f->density < 0.0 ? 0.0 : f->density > 1.0 ? 1.0 : f->density;
+   uint32_t threshold = density * UINT32_MAX;
+   rng_discard(rng, lo / 2);
+
+   uint64_t bits = lo % 2 ? rng_next(rng) >> 32 : 0;
+   for (size_t px = lo; px < hi; ++px) {
+      if (px % 2 == 0)
+         bits = rng_next(rng);
+      uint32_t u = (uint32_t) bits;
+      bits >>= 32;
+      if (u < threshold) {
+         uchar value = u < threshold / 2 ? 255 : 0;
+         uchar *p = L->base + (base + px) * L->stride;
+         p[L->r] = p[L->g] = p[L->b] = value;
+      }
+   }
+}
+
+// aux is extra per-call state of the noise type, eg. ImpNoiseTables
+typedef void (*noise_block_fn)(const ImpFilter *f, ImpRng *rng, const PixelLayout *L,
+                               size_t base, size_t lo, size_t hi, const void *aux);
+
+static void noise_range(const ImpFilter *f, noise_block_fn fn, const void *aux, const PixelLayout *L, size_t begin, size_t end) {
+   for (size_t block = begin / NOISE_BLOCK_PIXELS; block * NOISE_BLOCK_PIXELS < end; ++block) {
+      size_t base = block * NOISE_BLOCK_PIXELS;
+      size_t lo = begin > base ? begin - base : 0;
+      size_t hi = end - base < NOISE_BLOCK_PIXELS ? end - base : NOISE_BLOCK_PIXELS;
+      ImpRng rng;
+      rng_seed_stream(&rng, f->seed, block);
+      fn(f, &rng, L, base, lo, hi, aux);
+   }
+}
+
+static void gaussian_noise_range(const ImpFilter *f, const PixelLayout *L, size_t begin, size_t end) {
+   if (f->noise_tables) {
+      noise_range(f, gaussian_noise_block, f->noise_tables, L, begin, end);
+      return;
+   }
+   struct ImpNoiseTables t;
+   gaussian_tables_build(&t, f->sigma);
+   noise_range(f, gaussian_noise_block, &t, L, begin, end);
+}
+
+static void invert_range(const PixelLayout *L, size_t begin, size_t end) {
+   if (L->stride == 3) {
+      for (size_t i = 3 * begin; i < 3 * end; ++i)
+         L->base[i] = 255 - L->base[i];
+      return;
+   }
+   for (size_t px = begin; px < end; ++px) {
+      uchar *p = L->base + px * L->stride;
+      p[L->r] = 255 - p[L->r];
+      p[L->g] = 255 - p[L->g];
+      p[L->b] = 255 - p[L->b];
+   }
+}
+
+static void grayscale_range(const PixelLayout *L, size_t begin, size_t end) {
+   for (size_t px = begin; px < end; ++px) {
+      uchar *p = L->base + px * L->stride;
+      uchar gray = rgb_to_gray(p[L->r], p[L->g], p[L->b]);
+      p[L->r] = gray;
+      p[L->g] = gray;
+      p[L->b] = gray;
+   }
+}
+
+static void two_tone_range(const PixelLayout *L, size_t begin, size_t end, uint32_t tone1, uint32_t tone2) {
+   for (size_t px = begin; px < end; ++px) {
+      uchar *p = L->base + px * L->stride;
       uint32_t pixel = 0;
-      pixel = (buf[px + 2] << 16) | (buf[px + 1] << 8) | buf[px];
+      pixel = (p[L->r] << 16) | (p[L->g] << 8) | p[L->b];
       double dist1 = distance_rgb(tone1, pixel);
       double dist2 = distance_rgb(tone2, pixel);
 
       if (dist1 > dist2) {
-         buf[px + 2] = rgb_red(tone1);
-         buf[px + 1] = rgb_green(tone1);
-         buf[px] = rgb_blue(tone1);
+         p[L->r] = rgb_red(tone1);
+         p[L->g] = rgb_green(tone1);
+         p[L->b] = rgb_blue(tone1);
       } else {
-         buf[px + 2] = rgb_red(tone2);
-         buf[px + 1] = rgb_green(tone2);
-         buf[px] = rgb_blue(tone2);
+         p[L->r] = rgb_red(tone2);
+         p[L->g] = rgb_green(tone2);
+         p[L->b] = rgb_blue(tone2);
       }
    }
 }
 
 // compare the RGb components of both colors
-static void nearest_palette_color(uint32_t *palette, size_t palette_size, uchar *red, uchar *green, uchar* blue) {
-    assert(red && green && blue && palette);
+static void nearest_palette_color(const ImpFilter *f, uchar *red, uchar *green, uchar* blue) {
+    assert(red && green && blue && f->palette);
+    const uint32_t *palette = f->palette;
+    size_t palette_size = f->palette_size;
+
+    if (f->palette_index) {
+        uint32_t color = f->palette_index->colors[palette_nearest(f->palette_index, *red, *green, *blue)];
+        *red = rgb_red(color);
+        *green = rgb_green(color);
+        *blue = rgb_blue(color);
+        return;
+    }
 
     // find the color in the palette that is 'closest' to the input
     // use euclidean RGB distances to determine closeness
@@ -107,42 +412,6 @@ static void nearest_palette_color(uint32_t *palette, size_t palette_size, uchar
     *blue = rgb_blue(closest_color);
 }
 
-void ordered_dithering_triple_channel(uchar *buf, size_t size_bytes, size_t width_pixels, uint32_t *palette, size_t palette_size) {
-   int matrix_dim = 4;
-   float bayer_matrix[4][4] = {
-      { 0.0f, 8.0f, 2.0f, 10.0f },
-      { 12.0f, 4.0f, 14.0f, 6.0f },
-      { 3.0f, 11.0f, 1.0f, 9.0f },
-      { 15.0f, 7.0f, 13.0f, 5.0f }
-   };
-   // BMP supports 2^16 colors
-   int N = 4;
-   float spread = 256.0f/N;
-   // precompute threshold maps and normalize
-   for (int r = 0; r < matrix_dim; ++r) {
-      for (int c = 0; c < matrix_dim; ++c) {
-         bayer_matrix[r][c] = (bayer_matrix[r][c] / 16.0f) - 0.5f;
-      }
-   }
-
-   int pixel_count = 0;
-   size_t adjusted_end = size_bytes - (size_bytes % 3);
-   for (size_t px = 0; px < adjusted_end; px += 3, ++pixel_count) {
-      int x = pixel_count % width_pixels;
-      int y = pixel_count / width_pixels;
-      
-      uchar new_red = buf[px+2] + spread * bayer_matrix[y % matrix_dim][x % matrix_dim];
-      uchar new_green = buf[px+1] + spread * bayer_matrix[y % matrix_dim][x % matrix_dim];
-      uchar new_blue = buf[px] + spread * bayer_matrix[y % matrix_dim][x % matrix_dim];
-      
-      nearest_palette_color(palette, palette_size, &new_red, &new_green, &new_blue);
-
-      buf[px + 2] = new_red;
-      buf[px + 1] = new_green;
-      buf[px] = new_blue;
-   }
-}
-
 /**
  * ordered dithering with Bayer matrices
  * eq: color' = nearest_palette_color(color + r * (M(x % n, y % n) - 1/2))
@@ -150,50 +419,169 @@ void ordered_dithering_triple_channel(uchar *buf, size_t size_bytes, size_t widt
  * r = 256 / N (given an RGB palette with 2^3*N evenly distanced colors)
  * M = threshold map
  * (1/2 is the normalizing term)
+ * From wikipedia article on ordered dithering: https://en.wikipedia.org/wiki/Ordered_dithering
  */
-void ordered_dithering_single_channel(uchar *buf, size_t size_bytes, size_t width_pixels, uint32_t *palette, size_t palette_size) {
-    // From wikipedia article on ordered dithering: https://en.wikipedia.org/wiki/Ordered_dithering
-    int matrix_dim = 4;
-    float bayer_matrix[4][4] = {
-        { 0, 8, 2, 10 },
-        { 12, 4, 14, 6 },
-        { 3, 11, 1, 9 },
-        { 15, 7, 13, 5 }
-    };
-    // BMP supports 2^16 colors
-    int N = 4;
-    float spread = 256/N;
-
-    // precompute threshold maps and normalize
-    for (int r = 0; r < matrix_dim; ++r) {
-        for (int c = 0; c < matrix_dim; ++c) {
-            bayer_matrix[r][c] = (bayer_matrix[r][c] / 16.0f) - 0.5f;
-        }
-    }
+#define BAYER_DIM 4
+// BMP supports 2^16 colors
+#define BAYER_N 4
+
+// precomputed threshold map, normalized as (M / 16) - 1/2
+static const float bayer_matrix[BAYER_DIM][BAYER_DIM] = {
+   { 0.0f / 16 - 0.5f, 8.0f / 16 - 0.5f, 2.0f / 16 - 0.5f, 10.0f / 16 - 0.5f },
+   { 12.0f / 16 - 0.5f, 4.0f / 16 - 0.5f, 14.0f / 16 - 0.5f, 6.0f / 16 - 0.5f },
+   { 3.0f / 16 - 0.5f, 11.0f / 16 - 0.5f, 1.0f / 16 - 0.5f, 9.0f / 16 - 0.5f },
+   { 15.0f / 16 - 0.5f, 7.0f / 16 - 0.5f, 13.0f / 16 - 0.5f, 5.0f / 16 - 0.5f }
+};
+
+static void ordered_dithering_triple_channel_range(const PixelLayout *L, size_t begin, size_t end, const ImpFilter *f) {
+   float spread = 256.0f/BAYER_N;
+   for (size_t pixel_count = begin; pixel_count < end; ++pixel_count) {
+      uchar *p = L->base + pixel_count * L->stride;
+      int x = pixel_count % L->width;
+      int y = pixel_count / L->width;
+
+      uchar new_red = p[L->r] + spread * bayer_matrix[y % BAYER_DIM][x % BAYER_DIM];
+      uchar new_green = p[L->g] + spread * bayer_matrix[y % BAYER_DIM][x % BAYER_DIM];
+      uchar new_blue = p[L->b] + spread * bayer_matrix[y % BAYER_DIM][x % BAYER_DIM];
+
+      nearest_palette_color(f, &new_red, &new_green, &new_blue);
+
+      p[L->r] = new_red;
+      p[L->g] = new_green;
+      p[L->b] = new_blue;
+   }
+}
+
+static void ordered_dithering_single_channel_range(const PixelLayout *L, size_t begin, size_t end, const ImpFilter *f) {
+    float spread = 256/BAYER_N;
+    for (size_t pixel_count = begin; pixel_count < end; ++pixel_count) {
+        uchar *p = L->base + pixel_count * L->stride;
+        int x = pixel_count % L->width;
+        int y = pixel_count / L->width;
 
-    int pixel_count = 0;
-    size_t adjusted_end = size_bytes - (size_bytes % 3);
-    for (size_t px = 0; px < adjusted_end; px += 3, ++pixel_count) {
-        int x = pixel_count % width_pixels;
-        int y = pixel_count / width_pixels;
-        
         unsigned int color = 0, new_color = 0;
-        color = (buf[px + 2] << 16) | (buf[px + 1] << 8) | buf[px]; // temp conversion to rgb
-        new_color = color + spread * bayer_matrix[y % matrix_dim][x % matrix_dim];
-        
+        color = (p[L->r] << 16) | (p[L->g] << 8) | p[L->b]; // temp conversion to rgb
+        new_color = color + spread * bayer_matrix[y % BAYER_DIM][x % BAYER_DIM];
+
         uchar new_red = rgb_red(new_color);
         uchar new_green = rgb_green(new_color);
         uchar new_blue = rgb_blue(new_color);
-        nearest_palette_color(palette, palette_size, &new_red, &new_green, &new_blue);
-        buf[px + 2] = new_red;
-        buf[px + 1] = new_green;
-        buf[px] = new_blue;
+        nearest_palette_color(f, &new_red, &new_green, &new_blue);
+        p[L->r] = new_red;
+        p[L->g] = new_green;
+        p[L->b] = new_blue;
     }
 }
 
-void palette_quantization(uchar *buf, size_t size_bytes, uint32_t *palette_buf, size_t palette_buf_size) {
-   size_t adjusted_end = size_bytes - (size_bytes % 3);
-   for (size_t px = 0; px < adjusted_end; px += 3) {
-      nearest_palette_color(palette_buf, palette_buf_size, &buf[px + 2], &buf[px + 1], &buf[px]);
+static void palette_quantization_range(const PixelLayout *L, size_t begin, size_t end, const ImpFilter *f) {
+   for (size_t px = begin; px < end; ++px) {
+      uchar *p = L->base + px * L->stride;
+      nearest_palette_color(f, &p[L->r], &p[L->g], &p[L->b]);
+   }
+}
+
+void apply_filter(const ImpFilter *f, const ImpImage *image, size_t begin, size_t end) {
+   assert(f && image && image->pixels);
+   PixelLayout layout;
+   resolve_layout(&layout, image);
+   const PixelLayout *L = &layout;
+   pthread_once(&noise_tables_once, init_noise_tables);
+
+   switch (f->type) {
+   case IMP_FILTER_INVERT: invert_range(L, begin, end); break;
+   case IMP_FILTER_GRAYSCALE: grayscale_range(L, begin, end); break;
+   case IMP_FILTER_TWO_TONE: two_tone_range(L, begin, end, f->tone1, f->tone2); break;
+   case IMP_FILTER_BERNOULLI_NOISE: noise_range(f, bernoulli_noise_block, NULL, L, begin, end); break;
+   case IMP_FILTER_GAUSSIAN_NOISE: gaussian_noise_range(f, L, begin, end); break;
+   case IMP_FILTER_SALT_AND_PEPPER_NOISE:
+      noise_range(f, salt_and_pepper_noise_block, NULL, L, begin, end);
+      break;
+   case IMP_FILTER_DITHER_TRIPLE_CHANNEL:
+      ordered_dithering_triple_channel_range(L, begin, end, f);
+      break;
+   case IMP_FILTER_DITHER_SINGLE_CHANNEL:
+      ordered_dithering_single_channel_range(L, begin, end, f);
+      break;
+   case IMP_FILTER_PALETTE_QUANTIZATION:
+      palette_quantization_range(L, begin, end, f);
+      break;
+   }
+}
+
+typedef struct {
+   const ImpFilter *filter;
+   const ImpImage *image;
+} FilterJob;
+
+static void filter_chunk(void *ctx, size_t chunk, size_t begin, size_t end) {
+   (void) chunk;
+   FilterJob *job = ctx;
+   apply_filter(job->filter, job->image, begin, end);
+}
+
+// pixels [0, npixels) across threads, the noise tables are built once here instead of per chunk
+static void filter_pixels(const ImpFilter *filter, const ImpImage *image, size_t npixels) {
+   ImpFilter prepared = *filter;
+   struct ImpNoiseTables tables;
+   if (prepared.type == IMP_FILTER_GAUSSIAN_NOISE && !prepared.noise_tables) {
+      gaussian_tables_build(&tables, prepared.sigma);
+      prepared.noise_tables = &tables;
    }
+   FilterJob job = { .filter = &prepared, .image = image };
+   parallel_for(npixels, FILTER_CHUNK_PIXELS, filter_chunk, &job);
+}
+
+void apply_filter_image(const ImpFilter *filter, const ImpImage *image) {
+   filter_pixels(filter, image, image->width * image->height);
+}
+
+// whole-buffer form for the 24-bit BGR functions below
+static void run_filter(ImpFilter filter, uchar *buf, size_t size_bytes, size_t width_pixels) {
+   size_t npixels = size_bytes / 3;
+   ImpImage image = { .pixels = buf, .width = width_pixels, .height = npixels / width_pixels,
+                      .format = IMP_FORMAT_BGR24 };
+   filter_pixels(&filter, &image, npixels);
+}
+
+void invert(uchar *buf, size_t size) {
+   for (size_t i = 0; i < size; ++i)
+      buf[i] = 255 - buf[i];
+}
+
+void add_uniform_bernoulli_noise(uchar *buf, size_t size_bytes, int amplitude, uint64_t seed) {
+   run_filter((ImpFilter){ .type = IMP_FILTER_BERNOULLI_NOISE, .amplitude = amplitude, .seed = seed },
+              buf, size_bytes, 1);
+}
+
+void add_gaussian_noise(uchar *buf, size_t size_bytes, double sigma, uint64_t seed) {
+   run_filter((ImpFilter){ .type = IMP_FILTER_GAUSSIAN_NOISE, .sigma = sigma, .seed = seed },
+              buf, size_bytes, 1);
+}
+
+void add_salt_and_pepper_noise(uchar *buf, size_t size_bytes, double density, uint64_t seed) {
+   run_filter((ImpFilter){ .type = IMP_FILTER_SALT_AND_PEPPER_NOISE, .density = density, .seed = seed },
+              buf, size_bytes, 1);
+}
+
+void grayscale(uchar *buf, size_t size_bytes) {
+   run_filter((ImpFilter){ .type = IMP_FILTER_GRAYSCALE }, buf, size_bytes, 1);
+}
+
+void two_tone(uchar *buf, size_t bytes, uint32_t tone1, uint32_t tone2) {
+   run_filter((ImpFilter){ .type = IMP_FILTER_TWO_TONE, .tone1 = tone1, .tone2 = tone2 }, buf, bytes, 1);
+}
+
+void ordered_dithering_triple_channel(uchar *buf, size_t size_bytes, size_t width_pixels, uint32_t *palette, size_t palette_size) {
+   run_filter((ImpFilter){ .type = IMP_FILTER_DITHER_TRIPLE_CHANNEL, .palette = palette, .palette_size = palette_size },
+              buf, size_bytes, width_pixels);
+}
+
+void ordered_dithering_single_channel(uchar *buf, size_t size_bytes, size_t width_pixels, uint32_t *palette, size_t palette_size) {
+   run_filter((ImpFilter){ .type = IMP_FILTER_DITHER_SINGLE_CHANNEL, .palette = palette, .palette_size = palette_size },
+              buf, size_bytes, width_pixels);
+}
+
+void palette_quantization(uchar *buf, size_t size_bytes, uint32_t *palette_buf, size_t palette_buf_size) {
+   run_filter((ImpFilter){ .type = IMP_FILTER_PALETTE_QUANTIZATION, .palette = palette_buf, .palette_size = palette_buf_size },
+              buf, size_bytes, 1);
 }
@@ -2,6 +2,7 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 #include <stdint.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 typedef unsigned char uchar;
@@ -9,8 +10,14 @@ typedef unsigned char uchar;
 /** all functions are format agnostic, ie the inputs are treated as raw bytes */
 void invert(uchar *buf, size_t size);
 
-/** assumes seeded rand */
-void add_uniform_bernoulli_noise(uchar *buf, size_t size_bytes);
+/**
+ * noise functions are reproducible: the same seed gives the same output regardless of platform
+ * and thread count. amplitude is the +/- offset added to every pixel, sigma the standard
+ * deviation and density the fraction of pixels set to white or black
+ */
+void add_uniform_bernoulli_noise(uchar *buf, size_t size_bytes, int amplitude, uint64_t seed);
+void add_gaussian_noise(uchar *buf, size_t size_bytes, double sigma, uint64_t seed);
+void add_salt_and_pepper_noise(uchar *buf, size_t size_bytes, double density, uint64_t seed);
 void grayscale(uchar *buf, size_t size_bytes);
 
 /** tones must be in RGB, MSB format */
@@ -18,4 +25,78 @@ void two_tone(uchar *buf, size_t bytes, uint32_t tone1, uint32_t tone2);
 void ordered_dithering_triple_channel(uchar *buf, size_t size_bytes, size_t width_pixels, uint32_t *palette, size_t palette_size);
 void ordered_dithering_single_channel(uchar *buf, size_t size_bytes, size_t width_pixels, uint32_t *palette, size_t palette_size);
 void palette_quantization(uchar *buf, size_t size_bytes, uint32_t *palette_buf, size_t palette_buf_size);
+
+typedef enum ImpFilterType {
+    IMP_FILTER_INVERT,
+    IMP_FILTER_GRAYSCALE,
+    IMP_FILTER_TWO_TONE,
+    IMP_FILTER_BERNOULLI_NOISE,
+    IMP_FILTER_GAUSSIAN_NOISE,
+    IMP_FILTER_SALT_AND_PEPPER_NOISE,
+    IMP_FILTER_DITHER_TRIPLE_CHANNEL,
+    IMP_FILTER_DITHER_SINGLE_CHANNEL,
+    IMP_FILTER_PALETTE_QUANTIZATION,
+} ImpFilterType;
+
+struct ImpPalette;
+struct ImpNoiseTables;
+
+/** one per-pixel filter and its arguments, only the fields used by type are read */
+typedef struct ImpFilter {
+    ImpFilterType type;
+    uint32_t tone1, tone2;          // two tone
+    int amplitude;                  // bernoulli noise
+    double sigma;                   // gaussian noise
+    double density;                 // salt and pepper noise
+    uint64_t seed;                  // all noise types
+    const uint32_t *palette;        // dithering and quantization
+    size_t palette_size;
+    const struct ImpPalette *palette_index; // optional, replaces palette with an indexed lookup
+    const struct ImpNoiseTables *noise_tables; // optional, set by filter_prepare
+} ImpFilter;
+
+/**
+ * builds what a filter would otherwise recompute on every range, eg. the gaussian noise lookup
+ * for its sigma, so a filter applied tile by tile builds it once. returns 0 or -1, and
+ * filter_release frees it. apply_filter also works on unprepared filters
+ */
+int filter_prepare(ImpFilter *filter);
+void filter_release(ImpFilter *filter);
+
+/**
+ * memory layout of a pixel buffer. packed formats interleave the channels of a pixel, red/green/blue
+ * are byte offsets within the pixel and any 4th byte (alpha) is left untouched by the filters.
+ * planar formats store one full plane per channel and red/green/blue are plane indices
+ */
+typedef struct ImpPixelFormat {
+    uchar bytes_per_pixel; // 3 or 4 when packed, 1 when planar
+    uchar red, green, blue;
+    bool planar;
+} ImpPixelFormat;
+
+/** BMP_file::image_raw and the buffers taken by the functions above */
+extern const ImpPixelFormat IMP_FORMAT_BGR24;
+extern const ImpPixelFormat IMP_FORMAT_RGB_PLANAR;
+
+/** 32-bit packed format described by SDL-style channel masks, eg. SDL_Surface::format->Rmask */
+ImpPixelFormat pixel_format_packed32(uint32_t rmask, uint32_t gmask, uint32_t bmask);
+
+/** a view of width * height pixels, rows must be contiguous (pitch == width * bytes_per_pixel) */
+typedef struct ImpImage {
+    uchar *pixels;
+    size_t width, height;
+    ImpPixelFormat format;
+} ImpImage;
+
+/** byte distance between two pixels and byte offsets of the red, green and blue channel of pixel 0 */
+void image_layout(const ImpImage *image, size_t *stride, size_t offsets[3]);
+
+/**
+ * applies filter to pixels [begin, end) of image, counted row by row from the top-left pixel.
+ * the result does not depend on how an image is split into ranges nor on its pixel format
+ */
+void apply_filter(const ImpFilter *filter, const ImpImage *image, size_t begin, size_t end);
+
+/** apply_filter over the whole image, split across threads */
+void apply_filter_image(const ImpFilter *filter, const ImpImage *image);
 #endif
@@ -4,6 +4,7 @@
 #include "ui/actionmenu.h"
 #include "ui/colormenu.h"
 #include "ui/toolmenu.h"
+#include "system/asyncio.h"
 #include <SDL2/SDL_image.h>
 #include <assert.h>
 #include <stdbool.h>
@@ -12,6 +13,8 @@
 
 #define MAX(a, b) (a > b ? a : b)
 #define DEFAULT_OUTPUT_FILENAME "out.png"
+// canvas pixels an arrow key pans by at zoom 1, the same screen distance at other zooms
+#define PAN_STEP 256
 
 typedef struct Imp {
     SDL_Renderer *renderer;
@@ -24,6 +27,12 @@ typedef struct Imp {
 
     SDL_Texture *bg;
     int w_bg, h_bg;
+    bool redraw;
+
+    // background tiles, borders, menu backgrounds and buttons pre-composited at output size
+    SDL_Texture *ui_layer;
+    int w_ui, h_ui;
+    bool ui_stale;
 } Imp;
 
 Imp *create_imp(SDL_Renderer *renderer, SDL_Window *window) {
@@ -48,17 +57,90 @@ Imp *create_imp(SDL_Renderer *renderer, SDL_Window *window) {
     imp->bg = SDL_CreateTextureFromSurface(renderer, bg_surf);
     imp->w_bg = bg_surf->w;
     imp->h_bg = bg_surf->h;
+    imp->redraw = true;
+    imp->ui_layer = NULL;
+    imp->w_ui = imp->h_ui = 0;
+    imp->ui_stale = true;
 
     return imp;
 }
 
 
+int imp_open(Imp *imp, const char *path) {
+    return imp_io_load(path, imp->canvas->surf->format->format, NULL);
+}
+
+// completion of a load or save queued on the io thread
+static void imp_io_event(Imp *imp, SDL_Event *e) {
+    ImpIoResult *result = e->user.data1;
+    if (result->status == 0 && result->kind == IMP_IO_LOAD) {
+        imp_canvas_paste(imp->canvas, result->surface);
+    } else if (result->status == 0) {
+        printf("saved to: %s\n", result->path);
+    }
+    imp_io_result_free(result);
+}
+
+// arrows pan the canvas, + and - zoom it and 0 goes back to 1:1
+static void imp_view_key(Imp *imp, SDL_Keycode key) {
+    ImpCanvas *canvas = imp->canvas;
+    int step = (int)(PAN_STEP / canvas->zoom);
+    if (key == SDLK_LEFT || key == SDLK_RIGHT) {
+        imp_canvas_pan(canvas, key == SDLK_LEFT ? -step : step, 0);
+    } else if (key == SDLK_UP || key == SDLK_DOWN) {
+        imp_canvas_pan(canvas, 0, key == SDLK_UP ? -step : step);
+    } else if (key == SDLK_PLUS || key == SDLK_EQUALS) {
+        imp_canvas_zoom(canvas, 2.0f);
+    } else if (key == SDLK_MINUS) {
+        imp_canvas_zoom(canvas, 0.5f);
+    } else if (key == SDLK_0) {
+        imp_canvas_zoom(canvas, 1.0f / canvas->zoom);
+    } else {
+        return;
+    }
+    imp->redraw = true;
+}
+
 int imp_event(Imp *imp, SDL_Event *e) {
+    if (e->type == imp_io_event_type()) {
+        imp_io_event(imp, e);
+        imp->redraw = true;
+        return 1;
+    }
+    // motion only shows while a stroke or a guide is being dragged
+    bool dragging = imp->cursor->pencil_locked;
+    if (e->type == SDL_MOUSEBUTTONDOWN || e->type == SDL_MOUSEBUTTONUP || e->type == SDL_WINDOWEVENT ||
+        (e->type == SDL_MOUSEMOTION && dragging)) {
+        imp->redraw = true;
+    }
+    // some backends drop the contents of render targets
+    if (e->type == SDL_RENDER_TARGETS_RESET || e->type == SDL_RENDER_DEVICE_RESET) {
+        imp->ui_stale = true;
+        imp->redraw = true;
+    }
+
     if (e->type == SDL_MOUSEBUTTONDOWN || e->type == SDL_MOUSEBUTTONUP || e->type == SDL_MOUSEMOTION) {
         imp->cursor->rect.x = e->button.x;
         imp->cursor->rect.y = e->button.y;
     } else if (e->type == SDL_QUIT || (e->type == SDL_KEYDOWN && e->key.keysym.sym == SDLK_ESCAPE)) {
         return 0;
+    } else if (e->type == SDL_KEYDOWN && (e->key.keysym.mod & KMOD_CTRL)) {
+        // ctrl+z undoes, ctrl+y and ctrl+shift+z redo
+        SDL_Keycode key = e->key.keysym.sym;
+        if (key == SDLK_z && !(e->key.keysym.mod & KMOD_SHIFT)) {
+            imp_canvas_undo(imp->canvas);
+            imp->redraw = true;
+        } else if (key == SDLK_y || key == SDLK_z) {
+            imp_canvas_redo(imp->canvas);
+            imp->redraw = true;
+        }
+    } else if (e->type == SDL_KEYDOWN && e->key.keysym.sym == SDLK_a) {
+        imp->canvas->antialias = !imp->canvas->antialias;
+    } else if (e->type == SDL_KEYDOWN && e->key.keysym.sym == SDLK_b) {
+        // cycles the pencil through the brush shapes, the mask is rebuilt on the next stroke
+        imp->canvas->brush_shape = (imp->canvas->brush_shape + 1) % (IMP_BRUSH_SOFT + 1);
+    } else if (e->type == SDL_KEYDOWN) {
+        imp_view_key(imp, e->key.keysym.sym);
     }
 
     
@@ -75,28 +157,71 @@ int imp_event(Imp *imp, SDL_Event *e) {
 
 
 void imp_update(Imp *imp, float dt) {
-    // TODO
     (void) dt;
-    (void) imp;
+    imp_canvas_update(imp->canvas);
 }
 
 
-void imp_render(Imp *imp, SDL_Window *window) {
-    SDL_RenderClear(imp->renderer);
+bool imp_needs_redraw(Imp *imp) {
+    return imp->redraw || imp->canvas->ndirty > 0 || imp->canvas->nsamples > 0;
+}
+
 
-    // render bg/window
-    SDL_Rect wind = {0};
-    SDL_GetWindowSize(window, &wind.w, &wind.h);
-    for (int i = 0; i < wind.w; i += imp->w_bg) {
-        for (int j = -20; j < wind.h; j += imp->h_bg) {
+static void imp_render_static(Imp *imp, int w, int h) {
+    for (int i = 0; i < w; i += imp->w_bg) {
+        for (int j = -20; j < h; j += imp->h_bg) {
             SDL_RenderCopy(imp->renderer, imp->bg, NULL, &(SDL_Rect){ i, j, imp->w_bg, imp->h_bg });
         }
     }
+    imp_canvas_render_static(imp->renderer, imp->canvas);
+    imp_toolmenu_render_static(imp->renderer, imp->toolmenu);
+    imp_actionmenu_render_static(imp->renderer, imp->actionmenu);
+    imp_colormenu_render_static(imp->renderer, imp->colormenu);
+}
+
+// redraws the static layer after a resize or a lost target, returns false without one
+static bool imp_update_ui_layer(Imp *imp, int w, int h) {
+    if (imp->ui_layer && !imp->ui_stale && w == imp->w_ui && h == imp->h_ui) {
+        return true;
+    }
+    if (!imp->ui_layer || w != imp->w_ui || h != imp->h_ui) {
+        SDL_DestroyTexture(imp->ui_layer);
+        imp->ui_layer = SDL_CreateTexture(imp->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                          SDL_TEXTUREACCESS_TARGET, w, h);
+        imp->w_ui = w;
+        imp->h_ui = h;
+    }
+    if (!imp->ui_layer || SDL_SetRenderTarget(imp->renderer, imp->ui_layer) != 0) {
+        return false;
+    }
+    SDL_SetRenderDrawColor(imp->renderer, 0, 0, 0, 255);
+    SDL_RenderClear(imp->renderer);
+    imp_render_static(imp, w, h);
+    SDL_SetRenderTarget(imp->renderer, NULL);
+    SDL_SetTextureBlendMode(imp->ui_layer, SDL_BLENDMODE_NONE);
+    imp->ui_stale = false;
+    return true;
+}
+
+
+void imp_render(Imp *imp, SDL_Window *window) {
+    (void) window;
+    imp->redraw = false;
+    int w, h;
+    SDL_GetRendererOutputSize(imp->renderer, &w, &h);
+
+    // one copy of the cached layer, or everything drawn directly without render targets
+    SDL_RenderClear(imp->renderer);
+    if (imp_update_ui_layer(imp, w, h)) {
+        SDL_RenderCopy(imp->renderer, imp->ui_layer, NULL, NULL);
+    } else {
+        imp_render_static(imp, w, h);
+    }
 
     // render canvas
     imp_canvas_render(imp->renderer, imp->canvas);
 
-    // render ui
+    // render the parts of the ui that change
     imp_toolmenu_render(imp->renderer, imp->toolmenu);
     imp_actionmenu_render(imp->renderer, imp->actionmenu);
     imp_colormenu_render(imp->renderer, imp->colormenu);
@@ -15,4 +15,10 @@ int imp_event(Imp *imp, SDL_Event *e);
 void imp_update(Imp *imp, float dt);
 void imp_render(Imp *imp, SDL_Window *window);
 
+/** true when an event or background job changed what is on screen since the last imp_render */
+bool imp_needs_redraw(Imp *imp);
+
+/** loads an image onto the canvas in the background, returns 0 when the load was queued */
+int imp_open(Imp *imp, const char *path);
+
 #endif
\ No newline at end of file
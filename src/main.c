@@ -1,26 +1,43 @@
+#include "batch.h"
 #include "image.h"
 #include "imp.h"
+#include "system/asyncio.h"
 #include "system/bmp.h"
 #include "system/palette.h"
 #include "vector.h"
 #include <stdio.h>
+#include <string.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <assert.h>
-#include <time.h>
 #define DEFAULT_WINDOW_H 1000
 #define DEFAULT_WINDOW_W 1300
 #define PROGNAME "imp"
 #define MAX(a, b) (a > b ? a : b)
+// shortest time between two frames and longest sleep while idle, in ms
+#define FRAME_MS (1000.0 / 120.0)
+#define IDLE_TIMEOUT_MS 500
 
-static void usage() { fprintf(stderr, "%s [input]\n", PROGNAME); }
+static void usage() { fprintf(stderr, "%s [input]\n%s --batch ...\n", PROGNAME, PROGNAME); }
 
-// Assumes Little-endian, 24bit bmp
-// bmp data is stored starting at bottom-left corner
+// BMP_load decodes every format to top-down BGR or BGRA
 static SDL_Texture *make_texture_from_bmp(SDL_Renderer *renderer, BMP_file *bmp) {
-    int depth = 24;
-    int pitch = 3 * bmp->w;
-    uint32_t rmask, gmask, bmask;
+    int depth = 8 * bmp->bytes_per_pixel;
+    int pitch = bmp->bytes_per_pixel * bmp->w;
+    uint32_t rmask, gmask, bmask, amask;
+    if (bmp->bytes_per_pixel == 4) {
+    #if SDL_BYTEORDER == SDL_BIG_ENDIAN
+        rmask = 0x0000FF00;
+        gmask = 0x00FF0000;
+        bmask = 0xFF000000;
+        amask = 0x000000FF;
+    #else
+        rmask = 0x00FF0000;
+        gmask = 0x0000FF00;
+        bmask = 0x000000FF;
+        amask = 0xFF000000;
+    #endif
+    } else {
     #if SDL_BYTEORDER == SDL_BIG_ENDIAN
         rmask = 0x0000FF;
         gmask = 0x00FF00;
@@ -30,10 +47,12 @@ static SDL_Texture *make_texture_from_bmp(SDL_Renderer *renderer, BMP_file *bmp)
         gmask = 0x00FF00;
         bmask = 0x0000FF;
     #endif
+        amask = 0;
+    }
 
     SDL_Surface *surf =
         SDL_CreateRGBSurfaceFrom(bmp->image_raw, bmp->w, bmp->h, depth, pitch,
-                                 rmask, gmask, bmask, 0);
+                                 rmask, gmask, bmask, amask);
 
     SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surf);
     SDL_FreeSurface(surf);
@@ -41,7 +60,7 @@ static SDL_Texture *make_texture_from_bmp(SDL_Renderer *renderer, BMP_file *bmp)
 }
 
 
-static int sdl_ui() {
+static int sdl_ui(const char *input) {
     SDL_Window *window = SDL_CreateWindow("imp", SDL_WINDOWPOS_UNDEFINED,
         SDL_WINDOWPOS_UNDEFINED, DEFAULT_WINDOW_W,
         DEFAULT_WINDOW_H, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
@@ -57,43 +76,60 @@ static int sdl_ui() {
     SDL_Surface *surf = IMG_Load("res/icons/window.png");
     SDL_SetWindowIcon(window, surf);
     SDL_FreeSurface(surf);
-    // TODO: load the user's file
-    // SDL_Surface *surf = IMG_Load(src);
-    // SDL_Surface *formatted = SDL_ConvertSurfaceFormat(surf, SDL_GetWindowPixelFormat(window), 0);
+    if (imp_io_init() != 0) {
+        return fprintf(stderr, "Could not start the io thread\n");
+    }
 
     Imp *imp = create_imp(renderer, window);
     if (!imp) {
         return fprintf(stderr, "imp was NULL\n");
     }
+    if (input && imp_open(imp, input) != 0) {
+        fprintf(stderr, "Could not open: %s\n", input);
+    }
 
     SDL_Event e;
-    float dt = 1000.0f / 60.0f;
+    uint64_t freq = SDL_GetPerformanceFrequency();
+    uint64_t last_frame = SDL_GetPerformanceCounter();
     while (1) {
-        uint64_t t0 = SDL_GetTicks64();
-
-        while (SDL_PollEvent(&e)) {
+        // sleep in the event queue while nothing needs drawing. when a frame is wanted sooner
+        // than FRAME_MS after the last one, keep collecting events until it is due
+        int timeout = IDLE_TIMEOUT_MS;
+        if (imp_needs_redraw(imp)) {
+            double elapsed = (double)(SDL_GetPerformanceCounter() - last_frame) * 1000.0 / freq;
+            timeout = elapsed >= FRAME_MS ? 0 : (int)(FRAME_MS - elapsed) + 1;
+        }
+        int pending = timeout > 0 ? SDL_WaitEventTimeout(&e, timeout) : SDL_PollEvent(&e);
+        while (pending) {
             if (imp_event(imp, &e) == 0) {
+                // pending saves are written before exiting
+                imp_io_quit();
                 return 0;
             }
+            pending = SDL_PollEvent(&e);
+        }
+
+        uint64_t now = SDL_GetPerformanceCounter();
+        float dt = (float)(now - last_frame) * 1000.0f / freq;
+        if (!imp_needs_redraw(imp) || dt < FRAME_MS) {
+            continue;
         }
+        last_frame = now;
 
         imp_update(imp, dt);
         imp_render(imp, window);
         SDL_RenderPresent(renderer);
-
-        uint64_t t1 = SDL_GetTicks64();
-        SDL_Delay(MAX(10, dt - (t1 - t0)));
     }
     return 0;
 }
 
 
 int main(int argc, char *argv[]) {
-    (void) argc;
-    (void) argv;
-    srand(time(NULL));
+    if (argc > 1 && !strcmp(argv[1], "--batch")) {
+        return batch_main(argc - 1, argv + 1);
+    }
 
-    int ret_code = sdl_ui();
+    int ret_code = sdl_ui(argc > 1 ? argv[1] : NULL);
     if (ret_code != 0) {
         perror("main");
         return EXIT_FAILURE;
@@ -0,0 +1,95 @@
+/* pipeline.c - tiled single-pass execution of filter chains */
+#include <assert.h>
+#include <stdlib.h>
+#include "pipeline.h"
+#include "system/parallel.h"
+
+#define INITIAL_STAGES 4
+// 32K pixels = 96 KiB of 24-bit data, stays in L2 while all stages run over it. a multiple of
+// the noise block size so no tile starts mid-stream
+#define TILE_PIXELS (32 * 1024)
+
+struct ImpPipeline {
+    ImpFilter *stages;
+    size_t n, cap;
+};
+
+typedef struct {
+    ImpPipeline *pipeline;
+    const ImpImage *image;
+} PipelineJob;
+
+ImpPipeline *pipeline_create(void) {
+    ImpPipeline *pipeline = malloc(sizeof(ImpPipeline));
+    if (!pipeline)
+        return NULL;
+
+    pipeline->stages = malloc(INITIAL_STAGES * sizeof(ImpFilter));
+    if (!pipeline->stages) {
+        free(pipeline);
+        return NULL;
+    }
+    pipeline->n = 0;
+    pipeline->cap = INITIAL_STAGES;
+    return pipeline;
+}
+
+int pipeline_push(ImpPipeline *pipeline, ImpFilter filter) {
+    assert(pipeline);
+    // every stage owns its prepared state, built once for all the tiles of all runs
+    filter.noise_tables = NULL;
+    if (filter_prepare(&filter) != 0)
+        return -1;
+    if (pipeline->n == pipeline->cap) {
+        ImpFilter *stages = realloc(pipeline->stages, 2 * pipeline->cap * sizeof(ImpFilter));
+        if (!stages) {
+            filter_release(&filter);
+            return -1;
+        }
+        pipeline->stages = stages;
+        pipeline->cap *= 2;
+    }
+    pipeline->stages[pipeline->n++] = filter;
+    return 0;
+}
+
+size_t pipeline_size(ImpPipeline *pipeline) {
+    assert(pipeline);
+    return pipeline->n;
+}
+
+static void pipeline_tile(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void)chunk;
+    PipelineJob *job = ctx;
+    for (size_t i = 0; i < job->pipeline->n; ++i)
+        apply_filter(&job->pipeline->stages[i], job->image, begin, end);
+}
+
+void pipeline_run(ImpPipeline *pipeline, uchar *buf, size_t size_bytes, size_t width_pixels) {
+    assert(buf && width_pixels);
+    ImpImage image = {.pixels = buf,
+                      .width = width_pixels,
+                      .height = size_bytes / 3 / width_pixels,
+                      .format = IMP_FORMAT_BGR24};
+    pipeline_run_image(pipeline, &image);
+}
+
+void pipeline_run_image(ImpPipeline *pipeline, const ImpImage *image) {
+    assert(pipeline && image);
+    if (!pipeline->n)
+        return;
+    // keep a tile near the same number of bytes whatever the pixel size
+    size_t tile = TILE_PIXELS * 3 / (image->format.planar ? 3 : image->format.bytes_per_pixel);
+    tile -= tile % 4096;
+    PipelineJob job = {.pipeline = pipeline, .image = image};
+    parallel_for(image->width * image->height, tile, pipeline_tile, &job);
+}
+
+void pipeline_free(ImpPipeline *pipeline) {
+    if (!pipeline)
+        return;
+    for (size_t i = 0; i < pipeline->n; ++i)
+        filter_release(&pipeline->stages[i]);
+    free(pipeline->stages);
+    free(pipeline);
+}
@@ -0,0 +1,25 @@
+/* pipeline.h - fused chains of per-pixel filters */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include <stddef.h>
+#include "image.h"
+
+typedef struct ImpPipeline ImpPipeline;
+
+ImpPipeline *pipeline_create(void);
+
+/** appends a stage, stages run in insertion order. on success returns 0 */
+int pipeline_push(ImpPipeline *pipeline, ImpFilter filter);
+size_t pipeline_size(ImpPipeline *pipeline);
+
+/**
+ * runs every stage over one cache-sized tile before moving on to the next, so a chain of N
+ * filters traverses the buffer once instead of N times. tiles are spread over threads
+ */
+void pipeline_run(ImpPipeline *pipeline, uchar *buf, size_t size_bytes, size_t width_pixels);
+
+/** pipeline_run over any pixel format, eg. a 32-bit canvas surface in place */
+void pipeline_run_image(ImpPipeline *pipeline, const ImpImage *image);
+void pipeline_free(ImpPipeline *pipeline);
+
+#endif
@@ -0,0 +1,426 @@
+/* quantize.c - median-cut and k-means palette generation in a 5-bit histogram space */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "quantize.h"
+
+#define HIST_BITS 5
+#define HIST_SIDE (1 << HIST_BITS)
+#define HIST_BINS (HIST_SIDE * HIST_SIDE * HIST_SIDE)
+#define HIST_INDEX(r, g, b) ((((r) >> 3) << 10) | (((g) >> 3) << 5) | ((b) >> 3))
+#define rgb_pack(r, g, b) (((uint32_t)(r) << 16) | ((uint32_t)(g) << 8) | (uint32_t)(b))
+#define rgb_red(rgb) ((rgb & 0xFF0000) >> 16)
+#define rgb_green(rgb) ((rgb & 0x00FF00) >> 8)
+#define rgb_blue(rgb) (rgb & 0x0000FF)
+
+// one non-empty histogram bin, c[] is the mean color of the pixels that fell into it
+typedef struct {
+    uchar c[3]; // r, g, b
+    uint32_t count;
+    uint64_t sum[3];
+} ColorBin;
+
+struct ColorHistogram {
+    ColorBin *bins;
+    size_t n;
+};
+
+// a range [start, end) of ColorHistogram::bins
+typedef struct {
+    size_t start, end;
+    uint64_t count;
+    int axis;
+    int lo, range; // along axis
+} ColorBox;
+
+ColorHistogram *color_histogram_create(const uchar *buf, size_t size_bytes, size_t bytes_per_pixel) {
+    assert(buf);
+    uint32_t *count = calloc(HIST_BINS, sizeof(uint32_t));
+    uint64_t *sum = calloc(3 * HIST_BINS, sizeof(uint64_t));
+    ColorHistogram *hist = malloc(sizeof(ColorHistogram));
+    if (!count || !sum || !hist) {
+        free(count);
+        free(sum);
+        free(hist);
+        return NULL;
+    }
+
+    size_t adjusted_end = size_bytes - (size_bytes % bytes_per_pixel);
+    for (size_t px = 0; px < adjusted_end; px += bytes_per_pixel) {
+        uchar r = buf[px + 2], g = buf[px + 1], b = buf[px];
+        size_t i = HIST_INDEX(r, g, b);
+        count[i]++;
+        sum[3 * i] += r;
+        sum[3 * i + 1] += g;
+        sum[3 * i + 2] += b;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < HIST_BINS; ++i)
+        n += count[i] != 0;
+
+    hist->n = 0;
+    hist->bins = malloc((n ? n : 1) * sizeof(ColorBin));
+    if (!hist->bins) {
+        free(count);
+        free(sum);
+        free(hist);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < HIST_BINS; ++i) {
+        if (!count[i])
+            continue;
+        ColorBin *bin = &hist->bins[hist->n++];
+        bin->count = count[i];
+        for (int ch = 0; ch < 3; ++ch) {
+            bin->sum[ch] = sum[3 * i + ch];
+            bin->c[ch] = (bin->sum[ch] + count[i] / 2) / count[i];
+        }
+    }
+
+    free(count);
+    free(sum);
+    return hist;
+}
+
+size_t color_histogram_ncolors(ColorHistogram *hist) {
+    assert(hist);
+    return hist->n;
+}
+
+void color_histogram_free(ColorHistogram *hist) {
+    if (!hist)
+        return;
+    free(hist->bins);
+    free(hist);
+}
+
+// recompute the pixel count and the widest axis of box
+static void color_box_shrink(ColorHistogram *hist, ColorBox *box) {
+    uchar lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+    box->count = 0;
+    for (size_t i = box->start; i < box->end; ++i) {
+        ColorBin *bin = &hist->bins[i];
+        box->count += bin->count;
+        for (int ch = 0; ch < 3; ++ch) {
+            if (bin->c[ch] < lo[ch]) lo[ch] = bin->c[ch];
+            if (bin->c[ch] > hi[ch]) hi[ch] = bin->c[ch];
+        }
+    }
+
+    box->axis = 0;
+    box->range = hi[0] - lo[0];
+    for (int ch = 1; ch < 3; ++ch) {
+        if (hi[ch] - lo[ch] > box->range) {
+            box->range = hi[ch] - lo[ch];
+            box->axis = ch;
+        }
+    }
+    box->lo = lo[box->axis];
+}
+
+/**
+ * partitions the bins of box around the pixel-weighted median of its widest axis, in O(n) using
+ * a 256 entry count of that axis instead of sorting. returns the number of bins in the lower half
+ */
+static size_t color_box_partition(ColorHistogram *hist, ColorBox *box) {
+    uint64_t weight[256] = {0};
+    ColorBin *bins = hist->bins;
+    int axis = box->axis;
+    for (size_t i = box->start; i < box->end; ++i)
+        weight[bins[i].c[axis]] += bins[i].count;
+
+    // distinct 5-bit cells always differ on the widest axis, so range > 0 and both sides are
+    // non-empty as long as the split value stays below lo + range
+    uint64_t half = box->count / 2, acc = 0;
+    int split = box->lo;
+    while (split < box->lo + box->range - 1 && acc + weight[split] <= half)
+        acc += weight[split++];
+
+    size_t i = box->start, j = box->end;
+    while (i < j) {
+        if (bins[i].c[axis] <= split) {
+            ++i;
+        } else {
+            ColorBin tmp = bins[i];
+            bins[i] = bins[--j];
+            bins[j] = tmp;
+        }
+    }
+    return i - box->start;
+}
+
+static uint32_t color_box_mean(ColorHistogram *hist, ColorBox *box) {
+    uint64_t sum[3] = {0};
+    uint64_t count = 0;
+    for (size_t i = box->start; i < box->end; ++i) {
+        for (int ch = 0; ch < 3; ++ch)
+            sum[ch] += hist->bins[i].sum[ch];
+        count += hist->bins[i].count;
+    }
+    if (!count)
+        return 0;
+    return rgb_pack((sum[0] + count / 2) / count, (sum[1] + count / 2) / count,
+                    (sum[2] + count / 2) / count);
+}
+
+size_t palette_median_cut(ColorHistogram *hist, uint32_t *palette, size_t ncolors) {
+    assert(hist && palette);
+    if (!ncolors || !hist->n)
+        return 0;
+
+    ColorBox *boxes = malloc(ncolors * sizeof(ColorBox));
+    if (!boxes)
+        return 0;
+
+    size_t nboxes = 1;
+    boxes[0] = (ColorBox){.start = 0, .end = hist->n};
+    color_box_shrink(hist, &boxes[0]);
+
+    while (nboxes < ncolors) {
+        // split the box spanning the most pixels times color range
+        ColorBox *target = NULL;
+        uint64_t best = 0;
+        for (size_t i = 0; i < nboxes; ++i) {
+            uint64_t score = boxes[i].count * (uint64_t)boxes[i].range;
+            if (boxes[i].end - boxes[i].start > 1 && score >= best) {
+                best = score;
+                target = &boxes[i];
+            }
+        }
+        if (!target)
+            break;
+
+        size_t cut = color_box_partition(hist, target);
+        ColorBox *upper = &boxes[nboxes++];
+        *upper = (ColorBox){.start = target->start + cut, .end = target->end};
+        target->end = target->start + cut;
+        color_box_shrink(hist, target);
+        color_box_shrink(hist, upper);
+    }
+
+    for (size_t i = 0; i < nboxes; ++i)
+        palette[i] = color_box_mean(hist, &boxes[i]);
+
+    free(boxes);
+    return nboxes;
+}
+
+static uint32_t distance_sq(const uchar *c, uint32_t rgb) {
+    int dr = (int)c[0] - (int)rgb_red(rgb);
+    int dg = (int)c[1] - (int)rgb_green(rgb);
+    int db = (int)c[2] - (int)rgb_blue(rgb);
+    return dr * dr + dg * dg + db * db;
+}
+
+// xorshift32, only used for k-means++ seeding so the result is reproducible
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// weighted random pick, cumulative[] holds running weight sums ending at total
+static size_t pick_weighted(const uint64_t *cumulative, size_t n, uint64_t total, uint32_t *state) {
+    // separate statements, the order of two calls in one expression is unspecified
+    uint64_t high = next_random(state);
+    uint64_t low = next_random(state);
+    uint64_t r = (high << 32 | low) % total;
+    size_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cumulative[mid] > r)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+size_t palette_kmeans(ColorHistogram *hist, uint32_t *palette, size_t ncolors, size_t iterations,
+                      uint32_t seed) {
+    assert(hist && palette);
+    size_t n = hist->n;
+    if (!ncolors || !n)
+        return 0;
+    if (ncolors > n)
+        ncolors = n;
+
+    uint32_t *nearest = malloc(n * sizeof(uint32_t));
+    uint64_t *cumulative = malloc(n * sizeof(uint64_t));
+    if (!nearest || !cumulative) {
+        free(nearest);
+        free(cumulative);
+        return 0;
+    }
+
+    uint32_t state = seed ? seed : 0x9E3779B9;
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; ++i)
+        cumulative[i] = total += hist->bins[i].count;
+
+    ColorBin *bin = &hist->bins[pick_weighted(cumulative, n, total, &state)];
+    palette[0] = rgb_pack(bin->c[0], bin->c[1], bin->c[2]);
+    for (size_t i = 0; i < n; ++i)
+        nearest[i] = distance_sq(hist->bins[i].c, palette[0]);
+
+    // k-means++: every next center is drawn with probability ~ count * D^2
+    size_t k = 1;
+    for (; k < ncolors; ++k) {
+        total = 0;
+        for (size_t i = 0; i < n; ++i)
+            cumulative[i] = total += (uint64_t)hist->bins[i].count * nearest[i];
+        if (!total)
+            break;
+
+        bin = &hist->bins[pick_weighted(cumulative, n, total, &state)];
+        palette[k] = rgb_pack(bin->c[0], bin->c[1], bin->c[2]);
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t d = distance_sq(hist->bins[i].c, palette[k]);
+            if (d < nearest[i])
+                nearest[i] = d;
+        }
+    }
+
+    free(nearest);
+    free(cumulative);
+    palette_kmeans_refine(hist, palette, k, iterations);
+    return k;
+}
+
+// palette index together with the palette color's component along the search axis
+typedef struct {
+    int key;
+    uint32_t index;
+} CenterKey;
+
+static int compare_center_key(const void *a, const void *b) {
+    return ((const CenterKey *)a)->key - ((const CenterKey *)b)->key;
+}
+
+/**
+ * nearest palette color to c, with the centers sorted along one axis: search outward from the
+ * position of c on that axis and stop each direction once the axis distance alone exceeds the
+ * best full distance found so far, starting from the distance to palette[hint]
+ */
+static uint32_t nearest_center(const uchar *c, const uint32_t *palette, const CenterKey *sorted,
+                               size_t ncolors, int axis, uint32_t hint) {
+    int v = c[axis];
+    size_t lo = 0, hi = ncolors;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sorted[mid].key < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    // the previous assignment usually stays nearest and gives a tight bound from the start
+    uint32_t best = hint, min = distance_sq(c, palette[hint]);
+    size_t up = lo, down = lo;
+    bool up_open = up < ncolors, down_open = down > 0;
+    while (up_open || down_open) {
+        if (up_open) {
+            int dk = sorted[up].key - v;
+            if ((uint32_t)(dk * dk) >= min) {
+                up_open = false;
+            } else {
+                uint32_t d = distance_sq(c, palette[sorted[up].index]);
+                if (d < min) {
+                    min = d;
+                    best = sorted[up].index;
+                }
+                up_open = ++up < ncolors;
+            }
+        }
+        if (down_open) {
+            int dk = v - sorted[down - 1].key;
+            if ((uint32_t)(dk * dk) >= min) {
+                down_open = false;
+            } else {
+                uint32_t d = distance_sq(c, palette[sorted[down - 1].index]);
+                if (d < min) {
+                    min = d;
+                    best = sorted[down - 1].index;
+                }
+                down_open = --down > 0;
+            }
+        }
+    }
+    return best;
+}
+
+void palette_kmeans_refine(ColorHistogram *hist, uint32_t *palette, size_t ncolors,
+                           size_t iterations) {
+    assert(hist && palette);
+    size_t n = hist->n;
+    if (!ncolors || !n)
+        return;
+
+    uint32_t *assignment = calloc(n, sizeof(uint32_t));
+    uint64_t *sums = malloc(4 * ncolors * sizeof(uint64_t));
+    CenterKey *sorted = malloc(ncolors * sizeof(CenterKey));
+    if (!assignment || !sums || !sorted) {
+        free(assignment);
+        free(sums);
+        free(sorted);
+        return;
+    }
+
+    for (size_t iter = 0; iter < iterations; ++iter) {
+        size_t changed = 0;
+        memset(sums, 0, 4 * ncolors * sizeof(uint64_t));
+
+        // search along the axis the centers are most spread out on
+        int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+        for (size_t k = 0; k < ncolors; ++k) {
+            int c[3] = {rgb_red(palette[k]), rgb_green(palette[k]), rgb_blue(palette[k])};
+            for (int ch = 0; ch < 3; ++ch) {
+                if (c[ch] < lo[ch]) lo[ch] = c[ch];
+                if (c[ch] > hi[ch]) hi[ch] = c[ch];
+            }
+        }
+        int axis = 0;
+        for (int ch = 1; ch < 3; ++ch)
+            if (hi[ch] - lo[ch] > hi[axis] - lo[axis])
+                axis = ch;
+
+        for (size_t k = 0; k < ncolors; ++k) {
+            sorted[k].index = k;
+            sorted[k].key = (palette[k] >> (16 - 8 * axis)) & 0xFF;
+        }
+        qsort(sorted, ncolors, sizeof(CenterKey), compare_center_key);
+
+        for (size_t i = 0; i < n; ++i) {
+            ColorBin *bin = &hist->bins[i];
+            uint32_t best = nearest_center(bin->c, palette, sorted, ncolors, axis, assignment[i]);
+            changed += assignment[i] != best;
+            assignment[i] = best;
+
+            uint64_t *s = &sums[4 * best];
+            s[0] += bin->sum[0];
+            s[1] += bin->sum[1];
+            s[2] += bin->sum[2];
+            s[3] += bin->count;
+        }
+
+        // empty clusters keep their previous center
+        for (size_t k = 0; k < ncolors; ++k) {
+            uint64_t *s = &sums[4 * k];
+            if (s[3])
+                palette[k] = rgb_pack((s[0] + s[3] / 2) / s[3], (s[1] + s[3] / 2) / s[3],
+                                      (s[2] + s[3] / 2) / s[3]);
+        }
+
+        if (!changed && iter)
+            break;
+    }
+
+    free(assignment);
+    free(sums);
+    free(sorted);
+}
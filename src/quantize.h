@@ -0,0 +1,34 @@
+/* quantize.h - palette generation from image content */
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned char uchar;
+typedef struct ColorHistogram ColorHistogram;
+
+/**
+ * 5-bit-per-channel (32x32x32) histogram of a packed BGR buffer, as used by image.c, with
+ * bytes_per_pixel 3 or 4 (BGRA, alpha ignored).
+ * every bin keeps the exact channel sums of its pixels, so generated colors are not snapped
+ * to the 5-bit grid. returns NULL on allocation failure.
+ */
+ColorHistogram *color_histogram_create(const uchar *buf, size_t size_bytes, size_t bytes_per_pixel);
+size_t color_histogram_ncolors(ColorHistogram *hist);
+void color_histogram_free(ColorHistogram *hist);
+
+/**
+ * all palette_* functions write RGB, MSB colors (same as load_palette) into palette and return
+ * how many were written, which is less than ncolors when the image has fewer distinct bins
+ */
+size_t palette_median_cut(ColorHistogram *hist, uint32_t *palette, size_t ncolors);
+
+/** k-means++ seeding followed by palette_kmeans_refine, deterministic for a given seed */
+size_t palette_kmeans(ColorHistogram *hist, uint32_t *palette, size_t ncolors, size_t iterations,
+                      uint32_t seed);
+
+/** Lloyd iterations over the histogram bins, starting from the colors already in palette */
+void palette_kmeans_refine(ColorHistogram *hist, uint32_t *palette, size_t ncolors,
+                           size_t iterations);
+
+#endif
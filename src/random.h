@@ -0,0 +1,37 @@
+/* random.h - seeded, reproducible pseudo random numbers (xoshiro256**) */
+#ifndef RANDOM_H
+#define RANDOM_H
+#include <stdint.h>
+
+typedef struct {
+    uint64_t s[4];
+} ImpRng;
+
+/** expands seed with splitmix64, equal seeds give equal streams on every platform */
+void rng_seed(ImpRng *rng, uint64_t seed);
+
+/** independent stream number `stream` of seed, used to give each work chunk its own generator */
+void rng_seed_stream(ImpRng *rng, uint64_t seed, uint64_t stream);
+
+/** 64 uniformly distributed bits, ie 64 fair bernoulli trials per call */
+static inline uint64_t rng_next(ImpRng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t x = s[1] * 5;
+    uint64_t result = ((x << 7) | (x >> 57)) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+/** uniform in [0, 1) */
+double rng_uniform(ImpRng *rng);
+
+/** inverse of the standard normal cdf for p in (0, 1), used to build noise lookup tables */
+double normal_quantile(double p);
+
+#endif
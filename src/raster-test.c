@@ -0,0 +1,100 @@
+/* raster-test.c - coverage blending against its formula, antialiased shapes against their area */
+#include "raster-test.h"
+#include "raster.h"
+#include "random.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define W 200
+#define H 150
+
+static const ImpPixelFormat FORMAT = {4, 2, 1, 0, false};
+
+// summed coverage of a shape drawn in 255 over 0 on the low byte, in pixels
+static double covered(const uint32_t *pixels) {
+    double sum = 0;
+    for (size_t i = 0; i < W * H; ++i) {
+        sum += (pixels[i] & 0xFF) / 255.0;
+    }
+    return sum;
+}
+
+static void blend_span(ImpRng *rng) {
+    uint32_t dst[40], expected[40];
+    uchar coverage[40];
+    for (int run = 0; run < 2000; ++run) {
+        size_t n = rng_next(rng) % 41;
+        uint32_t color = (uint32_t)rng_next(rng);
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] = (uint32_t)rng_next(rng);
+            // whole groups of 0 and 255 take the shortcuts of the vector path
+            int kind = run % 3 ? (int)(rng_next(rng) % 3) : (int)(i / 4 % 2) * 2;
+            coverage[i] = kind == 0 ? 0 : kind == 2 ? 255 : (uchar)rng_next(rng);
+            expected[i] = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t c = color >> shift & 0xFF, d = dst[i] >> shift & 0xFF, a = coverage[i];
+                expected[i] |= (c * a + d * (255 - a) + 127) / 255 << shift;
+            }
+        }
+        raster_blend_span(dst, coverage, n, color);
+        assert(memcmp(dst, expected, n * 4) == 0);
+    }
+}
+
+int raster_selftest(void) {
+    uint32_t *pixels = malloc(W * H * 4), *aliased = malloc(W * H * 4);
+    assert(pixels && aliased);
+    ImpImage image = {(uchar *)pixels, W, H, FORMAT};
+    ImpImage reference = {(uchar *)aliased, W, H, FORMAT};
+    ImpRng rng;
+    rng_seed(&rng, 48);
+
+    blend_span(&rng);
+
+    // a 1 pixel wide axis aligned line covers its pixels exactly, as the aliased one does
+    for (int steep = 0; steep <= 1; ++steep) {
+        memset(pixels, 0, W * H * 4);
+        memset(aliased, 0, W * H * 4);
+        int x0 = steep ? 70 : 10, y0 = steep ? 10 : 70, x1 = steep ? 70 : 180, y1 = steep ? 140 : 70;
+        raster_line_aa(&image, x0, y0, x1, y1, 1.0f, 0xFF);
+        raster_line(&reference, x0, y0, x1, y1, 1, 0xFF);
+        assert(memcmp(pixels, aliased, W * H * 4) == 0);
+    }
+
+    // each major step covers thickness * sqrt(1 + slope^2) pixels across it
+    for (int run = 0; run < 200; ++run) {
+        memset(pixels, 0, W * H * 4);
+        int x0 = 20 + rng_next(&rng) % 160, y0 = 20 + rng_next(&rng) % 110;
+        int x1 = 20 + rng_next(&rng) % 160, y1 = 20 + rng_next(&rng) % 110;
+        float thickness = 1.0f + rng_next(&rng) % 12;
+        raster_line_aa(&image, x0, y0, x1, y1, thickness, 0xFF);
+        int dx = abs(x1 - x0), dy = abs(y1 - y0), major = dx > dy ? dx : dy, minor = dx > dy ? dy : dx;
+        double slope = major ? (double)minor / major : 0.0;
+        double area = (major + 1) * thickness * sqrt(1.0 + slope * slope);
+        assert(fabs(covered(pixels) - area) <= 0.01 * area + 1.0);
+    }
+
+    // discs: the inside is solid, the outside untouched and the area about pi r^2
+    for (int run = 0; run < 200; ++run) {
+        memset(pixels, 0, W * H * 4);
+        float cx = 60 + rng_next(&rng) % 80 + rng_uniform(&rng), cy = 60 + rng_next(&rng) % 30 + rng_uniform(&rng);
+        float r = 2.0f + rng_uniform(&rng) * 50.0f;
+        raster_fill_circle_aa(&image, cx, cy, r, 0xFF);
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                float d = hypotf(x - cx, y - cy);
+                uint32_t px = pixels[y * W + x];
+                assert(d > r - 1.0f || px == 0xFF);
+                assert(d < r + 1.0f || px == 0);
+            }
+        }
+        double area = M_PI * r * r;
+        assert(fabs(covered(pixels) - area) <= 0.01 * area + 1.0);
+    }
+
+    free(pixels);
+    free(aliased);
+    return 1;
+}
@@ -0,0 +1,8 @@
+/* raster-test.h - tests for the shape rasterizer */
+#ifndef RASTER_TEST_H
+#define RASTER_TEST_H
+
+/** asserts on failure, returns 1 when every case passed */
+int raster_selftest(void);
+
+#endif
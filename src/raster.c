@@ -0,0 +1,295 @@
+#include "raster.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define COVERAGE_CHUNK 256
+
+static int max(int a, int b) { return a > b ? a : b; }
+
+static int min(int a, int b) { return a < b ? a : b; }
+
+static uint32_t *pixel_at(const ImpImage *image, int x, int y) {
+    return (uint32_t *)image->pixels + (size_t)y * image->width + x;
+}
+
+// row y from x0 to x1 inclusive, clipped
+static void hspan(const ImpImage *image, int y, int x0, int x1, uint32_t color) {
+    if (y < 0 || y >= (int)image->height) {
+        return;
+    }
+    x0 = max(x0, 0);
+    x1 = min(x1, (int)image->width - 1);
+    uint32_t *p = x0 <= x1 ? pixel_at(image, x0, y) : NULL;
+    for (int x = x0; x <= x1; ++x) {
+        *p++ = color;
+    }
+}
+
+// column x from y0 to y1 inclusive, clipped
+static void vspan(const ImpImage *image, int x, int y0, int y1, uint32_t color) {
+    if (x < 0 || x >= (int)image->width) {
+        return;
+    }
+    y0 = max(y0, 0);
+    y1 = min(y1, (int)image->height - 1);
+    for (int y = y0; y <= y1; ++y) {
+        *pixel_at(image, x, y) = color;
+    }
+}
+
+void raster_fill_rect(const ImpImage *image, int x, int y, int w, int h, uint32_t color) {
+    int y1 = min(y + h, (int)image->height);
+    for (int row = max(y, 0); row < y1; ++row) {
+        hspan(image, row, x, x + w - 1, color);
+    }
+}
+
+void raster_line(const ImpImage *image, int x0, int y0, int x1, int y1, int thickness,
+                 uint32_t color) {
+    thickness = max(thickness, 1);
+    int before = (thickness - 1) / 2, after = thickness / 2;
+    // nothing to step through when the widened line misses the image
+    if (max(x0, x1) + after < 0 || min(x0, x1) - before >= (int)image->width ||
+        max(y0, y1) + after < 0 || min(y0, y1) - before >= (int)image->height) {
+        return;
+    }
+
+    int dx = abs(x1 - x0), dy = -abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    bool steep = -dy > dx;
+    while (1) {
+        if (steep) {
+            hspan(image, y0, x0 - before, x0 + after, color);
+        } else {
+            vspan(image, x0, y0 - before, y0 + after, color);
+        }
+        if (x0 == x1 && y0 == y1) {
+            break;
+        }
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+void raster_fill_circle(const ImpImage *image, int cx, int cy, int r, uint32_t color) {
+    if (r < 0) {
+        return;
+    }
+    // x is the half width of the row dy away from the centre, it only shrinks as dy grows
+    long long rr = (long long)r * r;
+    int x = r;
+    for (int dy = 0; dy <= r; ++dy) {
+        while ((long long)x * x + (long long)dy * dy > rr) {
+            --x;
+        }
+        hspan(image, cy + dy, cx - x, cx + x, color);
+        if (dy) {
+            hspan(image, cy - dy, cx - x, cx + x, color);
+        }
+    }
+}
+
+// (x + 128 + ((x + 128) >> 8)) >> 8 is x / 255 rounded for x <= 255 * 255, done here for the
+// two 16-bit lanes of x at once
+static uint32_t div255_pairs(uint32_t x) {
+    x += 0x00800080;
+    return ((x + ((x >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+}
+
+static uint32_t blend_pixel(uint32_t dst, uint32_t color, uint32_t a) {
+    uint32_t rb = (color & 0x00FF00FF) * a + (dst & 0x00FF00FF) * (255 - a);
+    uint32_t ag = ((color >> 8) & 0x00FF00FF) * a + ((dst >> 8) & 0x00FF00FF) * (255 - a);
+    return div255_pairs(rb) | div255_pairs(ag) << 8;
+}
+
+static uchar coverage_byte(float coverage) {
+    return coverage <= 0.0f ? 0 : coverage >= 1.0f ? 255 : (uchar)(coverage * 255.0f + 0.5f);
+}
+
+// minor axis positions of raster_line_aa are 16.16 fixed point, shifted by half a pixel so
+// pixel p covers [p, p + 1)
+#define FIX_SHIFT 16
+#define FIX_ONE (1 << FIX_SHIFT)
+
+static uint32_t fixed_alpha(int64_t coverage) {
+    return (uint32_t)((coverage * 255 + FIX_ONE / 2) >> FIX_SHIFT);
+}
+
+static void put_alpha(uint32_t *px, uint32_t a, uint32_t color) {
+    if (a >= 255) {
+        *px = color;
+    } else if (a) {
+        *px = blend_pixel(*px, color, a);
+    }
+}
+
+// blend_pixel of *p with coverage a and of *q with coverage b, both at once with SSE2
+static void blend_pair(uint32_t *p, uint32_t *q, uint32_t a, uint32_t b, uint32_t color) {
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i d = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)*p), _mm_cvtsi32_si128((int)*q));
+    d = _mm_unpacklo_epi8(d, zero);
+    __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+    __m128i cov = _mm_set_epi16(b, b, b, b, a, a, a, a);
+    __m128i r = _mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), cov)),
+                              _mm_mullo_epi16(c, cov));
+    r = _mm_add_epi16(r, _mm_set1_epi16(128));
+    r = _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(r, _mm_srli_epi16(r, 8)), 8), zero);
+    *p = (uint32_t)_mm_cvtsi128_si32(r);
+    *q = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(r, 4));
+#else
+    *p = blend_pixel(*p, color, a);
+    *q = blend_pixel(*q, color, b);
+#endif
+}
+
+// the span [a, b) of the minor axis at one major coordinate, base is its pixel 0 and step the
+// distance between pixels. only the two end pixels are partial, they are blended together and
+// the ones between are stored
+static void cross_span(uint32_t *base, size_t step, int n, int64_t a, int64_t b, uint32_t color) {
+    int p0 = (int)(a >> FIX_SHIFT), p1 = (int)(b >> FIX_SHIFT);
+    if (p0 == p1) {
+        if (p0 >= 0 && p0 < n) {
+            put_alpha(base + p0 * step, fixed_alpha(b - a), color);
+        }
+        return;
+    }
+    uint32_t a0 = fixed_alpha((int64_t)(p0 + 1) * FIX_ONE - a);
+    uint32_t a1 = fixed_alpha(b - (int64_t)p1 * FIX_ONE);
+    bool in0 = p0 >= 0 && p0 < n, in1 = p1 >= 0 && p1 < n;
+    if (in0 && in1) {
+        blend_pair(base + p0 * step, base + p1 * step, a0, a1, color);
+    } else if (in0) {
+        put_alpha(base + p0 * step, a0, color);
+    } else if (in1) {
+        put_alpha(base + p1 * step, a1, color);
+    }
+
+    int first = max(p0 + 1, 0), last = min(p1, n);
+    if (step == 1) {
+        for (int p = first; p < last; ++p) {
+            base[p] = color;
+        }
+    } else {
+        uint32_t *px = base + first * step;
+        for (int p = first; p < last; ++p, px += step) {
+            *px = color;
+        }
+    }
+}
+
+void raster_line_aa(const ImpImage *image, int x0, int y0, int x1, int y1, float thickness,
+                    uint32_t color) {
+    bool steep = abs(y1 - y0) > abs(x1 - x0);
+    int major0 = steep ? y0 : x0, major1 = steep ? y1 : x1;
+    int minor0 = steep ? x0 : y0, minor1 = steep ? x1 : y1;
+    int dmajor = major1 - major0;
+    float slope = dmajor ? (float)(minor1 - minor0) / dmajor : 0.0f;
+    // thickness is across the line, the span along the minor axis is longer by the slope
+    int64_t half = llrintf(fmaxf(thickness, 1.0f) / 2.0f * sqrtf(1.0f + slope * slope) * FIX_ONE);
+    int64_t step = dmajor ? llround((double)(minor1 - minor0) * FIX_ONE / dmajor) : 0;
+
+    int limit = steep ? (int)image->height : (int)image->width;
+    int n = steep ? (int)image->width : (int)image->height;
+    size_t cross = steep ? 1 : image->width, along = steep ? image->width : 1;
+    int m0 = max(min(major0, major1), 0), m1 = min(max(major0, major1), limit - 1);
+    if (m0 > m1) {
+        return;
+    }
+    // centre of the line at m0, then one step per major pixel
+    int64_t c = (int64_t)minor0 * FIX_ONE + FIX_ONE / 2 + step * (m0 - major0);
+    uint32_t *base = steep ? pixel_at(image, 0, m0) : pixel_at(image, m0, 0);
+    for (int m = m0; m <= m1; ++m, c += step, base += along) {
+        cross_span(base, cross, n, c - half, c + half, color);
+    }
+}
+
+// coverage of pixels x0..x1 of row y by the disc, from the distance of their centres to its edge
+static void circle_edge(const ImpImage *image, int y, int x0, int x1, float cx, float dy, float r,
+                        uint32_t color) {
+    uchar cov[COVERAGE_CHUNK];
+    x0 = max(x0, 0);
+    x1 = min(x1, (int)image->width - 1);
+    while (x0 <= x1) {
+        int n = min(x1 - x0 + 1, COVERAGE_CHUNK);
+        for (int i = 0; i < n; ++i) {
+            cov[i] = coverage_byte(r + 0.5f - hypotf(x0 + i - cx, dy));
+        }
+        raster_blend_span(pixel_at(image, x0, y), cov, n, color);
+        x0 += n;
+    }
+}
+
+void raster_fill_circle_aa(const ImpImage *image, float cx, float cy, float r, uint32_t color) {
+    if (r <= 0.0f) {
+        return;
+    }
+    float inner = r - 0.5f, outer = r + 0.5f;
+    int y0 = max((int)floorf(cy - outer), 0), y1 = min((int)ceilf(cy + outer), (int)image->height - 1);
+    for (int y = y0; y <= y1; ++y) {
+        float dy = y - cy;
+        float o2 = outer * outer - dy * dy, i2 = inner * inner - dy * dy;
+        if (o2 <= 0.0f) {
+            continue;
+        }
+        // centres within xo of cx are touched, within xi fully covered
+        float xo = sqrtf(o2);
+        int e0 = (int)ceilf(cx - xo), e1 = (int)floorf(cx + xo);
+        if (inner <= 0.0f || i2 <= 0.0f) {
+            circle_edge(image, y, e0, e1, cx, dy, r, color);
+            continue;
+        }
+        float xi = sqrtf(i2);
+        int i0 = (int)ceilf(cx - xi), i1 = (int)floorf(cx + xi);
+        circle_edge(image, y, e0, i0 - 1, cx, dy, r, color);
+        hspan(image, y, i0, i1, color);
+        circle_edge(image, y, i1 + 1, e1, cx, dy, r, color);
+    }
+}
+
+void raster_blend_span(uint32_t *dst, const uchar *coverage, size_t n, uint32_t color) {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128(), v255 = _mm_set1_epi16(255), v128 = _mm_set1_epi16(128);
+    __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+    for (; i + 4 <= n; i += 4) {
+        uint32_t m;
+        memcpy(&m, coverage + i, 4);
+        if (m == 0) {
+            continue;
+        }
+        // the coverage of each of the 4 pixels repeated over its 4 bytes
+        __m128i a = _mm_cvtsi32_si128((int)m);
+        a = _mm_unpacklo_epi8(a, a);
+        a = _mm_unpacklo_epi16(a, a);
+        __m128i alo = _mm_unpacklo_epi8(a, zero), ahi = _mm_unpackhi_epi8(a, zero);
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+        lo = _mm_add_epi16(_mm_mullo_epi16(lo, _mm_sub_epi16(v255, alo)), _mm_mullo_epi16(c, alo));
+        hi = _mm_add_epi16(_mm_mullo_epi16(hi, _mm_sub_epi16(v255, ahi)), _mm_mullo_epi16(c, ahi));
+        lo = _mm_add_epi16(lo, v128);
+        hi = _mm_add_epi16(hi, v128);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < n; ++i) {
+        if (coverage[i]) {
+            dst[i] = blend_pixel(dst[i], color, coverage[i]);
+        }
+    }
+}
+
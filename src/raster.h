@@ -0,0 +1,43 @@
+/* raster.h - opaque shapes drawn straight into 32-bit pixels */
+#ifndef RASTER_H
+#define RASTER_H
+#include "image.h"
+
+/**
+ * all functions take a 4 byte per pixel image and a raw pixel color, clip to the image and
+ * write every covered pixel once, so shapes partly or wholly outside the image are fine
+ */
+
+void raster_fill_rect(const ImpImage *image, int x, int y, int w, int h, uint32_t color);
+
+/**
+ * bresenham line from (x0, y0) to (x1, y1) inclusive. thickness > 1 widens each step into a
+ * span across the major axis, centred on the line
+ */
+void raster_line(const ImpImage *image, int x0, int y0, int x1, int y1, int thickness,
+                 uint32_t color);
+
+/** disc of the pixels with dx^2 + dy^2 <= r^2, filled as one span per row */
+void raster_fill_circle(const ImpImage *image, int cx, int cy, int r, uint32_t color);
+
+/**
+ * antialiased versions: edge pixels are blended by the fraction of them the shape covers,
+ * interiors are written as in the aliased functions, so the extra cost is a few blended
+ * pixels per row or column.
+ *
+ * raster_line_aa steps along the major axis with the minor coordinate in 16.16 fixed point and
+ * covers the exact span of a line thickness wide across it, a wu line when thickness is 1.
+ * raster_fill_circle_aa takes coverage from the distance of pixel centres to the edge
+ */
+void raster_line_aa(const ImpImage *image, int x0, int y0, int x1, int y1, float thickness,
+                    uint32_t color);
+void raster_fill_circle_aa(const ImpImage *image, float cx, float cy, float r, uint32_t color);
+
+/**
+ * every byte of dst[i] becomes (color * a + dst * (255 - a)) / 255 rounded, a = coverage[i].
+ * for an opaque color that is premultiplied "over" with the coverage as source alpha, alpha
+ * bytes included. SSE2 does 4 pixels per step, the scalar path gives the same results
+ */
+void raster_blend_span(uint32_t *dst, const uchar *coverage, size_t n, uint32_t color);
+
+#endif
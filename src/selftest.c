@@ -0,0 +1,25 @@
+/* selftest.c - runs the module self tests, built and run by `./build.sh test` */
+#include "fill-test.h"
+#include "history-test.h"
+#include "raster-test.h"
+#include "tiles-test.h"
+#include "system/bmp-test.h"
+#include "system/lz-test.h"
+#include "system/png-test.h"
+#include <stdio.h>
+#include <SDL2/SDL.h>
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+    int passed = 0;
+    passed += lz_selftest();
+    passed += history_selftest();
+    passed += fill_selftest();
+    passed += tiles_selftest();
+    passed += raster_selftest();
+    passed += bmp_selftest();
+    passed += png_selftest();
+    printf("%d self tests passed\n", passed);
+    return 0;
+}
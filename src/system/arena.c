@@ -0,0 +1,133 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ALIGNMENT 16
+#define THREAD_BLOCK_SIZE (256 * 1024)
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t size, used;
+    _Alignas(ALIGNMENT) unsigned char data[];
+};
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+// the arena itself lives in thread storage, only its blocks are allocated
+static _Thread_local ImpArena thread_arena;
+static _Thread_local bool thread_arena_ready = false;
+
+void arena_init(ImpArena *arena, size_t block_size) {
+    assert(arena);
+    arena->head = NULL;
+    arena->spare = NULL;
+    arena->block_size = block_size ? block_size : THREAD_BLOCK_SIZE;
+}
+
+// a spare block that fits, or a new one
+static ArenaBlock *take_block(ImpArena *arena, size_t size) {
+    for (ArenaBlock **p = &arena->spare; *p; p = &(*p)->next) {
+        if ((*p)->size >= size) {
+            ArenaBlock *block = *p;
+            *p = block->next;
+            return block;
+        }
+    }
+    size_t block_size = size > arena->block_size ? size : arena->block_size;
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + block_size);
+    if (block)
+        block->size = block_size;
+    return block;
+}
+
+void *arena_alloc(ImpArena *arena, size_t size) {
+    assert(arena);
+    size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+    ArenaBlock *head = arena->head;
+    if (!head || head->size - head->used < size) {
+        if (!(head = take_block(arena, size)))
+            return NULL;
+        head->used = 0;
+        head->next = arena->head;
+        arena->head = head;
+    }
+    void *ptr = head->data + head->used;
+    head->used += size;
+    return ptr;
+}
+
+void *arena_calloc(ImpArena *arena, size_t nmemb, size_t size) {
+    if (size && nmemb > SIZE_MAX / size)
+        return NULL;
+    void *ptr = arena_alloc(arena, nmemb * size);
+    if (ptr)
+        memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+ArenaMark arena_mark(ImpArena *arena) {
+    assert(arena);
+    return (ArenaMark){arena->head, arena->head ? arena->head->used : 0};
+}
+
+void arena_release(ImpArena *arena, ArenaMark mark) {
+    assert(arena);
+    while (arena->head && arena->head != mark.block) {
+        ArenaBlock *block = arena->head;
+        arena->head = block->next;
+        block->next = arena->spare;
+        arena->spare = block;
+    }
+    if (arena->head)
+        arena->head->used = mark.used;
+}
+
+void arena_reset(ImpArena *arena) {
+    arena_release(arena, (ArenaMark){0});
+    if (!arena->spare || !arena->spare->next)
+        return;
+
+    // the last round needed several blocks, replace them by one that holds all of it
+    size_t total = 0;
+    while (arena->spare) {
+        ArenaBlock *block = arena->spare;
+        arena->spare = block->next;
+        total += block->size;
+        free(block);
+    }
+    if ((arena->spare = malloc(sizeof(ArenaBlock) + total))) {
+        arena->spare->size = total;
+        arena->spare->next = NULL;
+    }
+}
+
+void arena_free(ImpArena *arena) {
+    arena_release(arena, (ArenaMark){0});
+    while (arena->spare) {
+        ArenaBlock *block = arena->spare;
+        arena->spare = block->next;
+        free(block);
+    }
+}
+
+static void thread_arena_destroy(void *arena) {
+    arena_free(arena);
+}
+
+static void thread_key_create(void) {
+    pthread_key_create(&thread_key, thread_arena_destroy);
+}
+
+ImpArena *arena_thread(void) {
+    if (thread_arena_ready)
+        return &thread_arena;
+    pthread_once(&thread_key_once, thread_key_create);
+    arena_init(&thread_arena, THREAD_BLOCK_SIZE);
+    pthread_setspecific(thread_key, &thread_arena);
+    thread_arena_ready = true;
+    return &thread_arena;
+}
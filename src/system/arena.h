@@ -0,0 +1,45 @@
+/* arena.h - bump allocation for scratch memory that dies together */
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+/**
+ * allocations are pointer bumps inside large blocks and are never freed one by one: everything
+ * is dropped at once with arena_reset or rolled back to an arena_mark. blocks are kept for
+ * reuse and merged into one on reset, so a workload that repeats (a filter run)
+ * stops calling malloc after its first round
+ */
+typedef struct ImpArena {
+    ArenaBlock *head;       // block being bumped, older ones behind it
+    ArenaBlock *spare;      // released blocks waiting for reuse
+    size_t block_size;      // minimum size of new blocks
+} ImpArena;
+
+typedef struct ArenaMark {
+    ArenaBlock *block;
+    size_t used;
+} ArenaMark;
+
+void arena_init(ImpArena *arena, size_t block_size);
+
+/** 16 byte aligned, NULL only when a new block could not be allocated */
+void *arena_alloc(ImpArena *arena, size_t size);
+void *arena_calloc(ImpArena *arena, size_t nmemb, size_t size);
+
+/** everything allocated after mark is released by arena_release(arena, mark) */
+ArenaMark arena_mark(ImpArena *arena);
+void arena_release(ImpArena *arena, ArenaMark mark);
+
+/** releases all allocations, keeping (merged) memory for the next round */
+void arena_reset(ImpArena *arena);
+void arena_free(ImpArena *arena);
+
+/**
+ * arena private to the calling thread, freed when the thread exits. use with mark/release.
+ * never NULL: blocks are allocated on demand, so only arena_alloc can fail
+ */
+ImpArena *arena_thread(void);
+
+#endif
@@ -0,0 +1,208 @@
+/* asyncio.c - image loads and saves on a background thread */
+#include "asyncio.h"
+#include "bmp.h"
+#include "image.h"
+#include <SDL2/SDL_image.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct IoJob {
+    ImpIoResult result;     // handed over to the event loop when done
+    Uint32 pixel_format;    // loads
+    PNG_options png;        // saves
+    struct IoJob *next;
+} IoJob;
+
+/** jobs run one at a time in the order they were queued */
+static struct {
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *wake;
+    IoJob *head, *tail;
+    int quit;
+    Uint32 event_type;
+} io;
+
+static int is_bmp(const char *path) {
+    size_t n = strlen(path);
+    return n >= 4 && path[n - 4] == '.' && tolower((uchar)path[n - 3]) == 'b' &&
+           tolower((uchar)path[n - 2]) == 'm' && tolower((uchar)path[n - 1]) == 'p';
+}
+
+// BMP_load gives top-down BGR or BGRA rows
+static SDL_Surface *load_bmp(const char *path, Uint32 pixel_format) {
+    BMP_file bmp;
+    if (BMP_load(&bmp, path) != 0)
+        return NULL;
+    int bpp = bmp.bytes_per_pixel;
+    SDL_Surface *view = SDL_CreateRGBSurfaceWithFormatFrom(
+        bmp.image_raw, bmp.w, bmp.h, 8 * bpp, bpp * bmp.w,
+        bpp == 4 ? SDL_PIXELFORMAT_BGRA32 : SDL_PIXELFORMAT_BGR24);
+    SDL_Surface *surf = view ? SDL_ConvertSurfaceFormat(view, pixel_format, 0) : NULL;
+    SDL_FreeSurface(view);
+    BMP_free(&bmp);
+    return surf;
+}
+
+static int copy_rows(void *ctx, size_t y0, size_t nrows, uchar *band) {
+    SDL_Surface *bgr = ctx;
+    size_t row = 3 * (size_t)bgr->w;
+    for (size_t y = 0; y < nrows; ++y)
+        memcpy(band + y * row, (uchar *)bgr->pixels + (y0 + y) * bgr->pitch, row);
+    return 0;
+}
+
+// PNG_write takes contiguous 32-bit rows as they are and anything else converted to RGBA
+static int save_png(SDL_Surface *snapshot, const char *path, const PNG_options *png) {
+    SDL_Surface *surf = snapshot;
+    if (surf->format->BytesPerPixel != 4 || surf->pitch != 4 * surf->w)
+        surf = SDL_ConvertSurfaceFormat(snapshot, SDL_PIXELFORMAT_RGBA32, 0);
+    if (!surf)
+        return -1;
+    ImpImage image = {
+        .pixels = surf->pixels,
+        .width = surf->w,
+        .height = surf->h,
+        .format = pixel_format_packed32(surf->format->Rmask, surf->format->Gmask, surf->format->Bmask),
+    };
+    int status = PNG_write(&image, png, path);
+    if (surf != snapshot)
+        SDL_FreeSurface(surf);
+    return status;
+}
+
+static int save(SDL_Surface *snapshot, const char *path, const PNG_options *png) {
+    if (!is_bmp(path))
+        return save_png(snapshot, path, png);
+
+    SDL_Surface *bgr = SDL_ConvertSurfaceFormat(snapshot, SDL_PIXELFORMAT_BGR24, 0);
+    int status = bgr ? BMP_write_bands(bgr->w, bgr->h, copy_rows, bgr, 256, path) : -1;
+    SDL_FreeSurface(bgr);
+    return status;
+}
+
+static void run(IoJob *job) {
+    ImpIoResult *r = &job->result;
+    if (r->kind == IMP_IO_LOAD) {
+        if (is_bmp(r->path)) {
+            r->surface = load_bmp(r->path, job->pixel_format);
+        } else {
+            SDL_Surface *surf = IMG_Load(r->path);
+            r->surface = surf ? SDL_ConvertSurfaceFormat(surf, job->pixel_format, 0) : NULL;
+            SDL_FreeSurface(surf);
+        }
+        r->status = r->surface ? 0 : -1;
+    } else {
+        r->status = save(r->surface, r->path, &job->png);
+        SDL_FreeSurface(r->surface);
+        r->surface = NULL;
+    }
+    if (r->status != 0)
+        fprintf(stderr, "could not %s '%s'\n", r->kind == IMP_IO_LOAD ? "load" : "save", r->path);
+}
+
+static int worker(void *arg) {
+    (void) arg;
+    SDL_LockMutex(io.lock);
+    while (1) {
+        while (!io.head && !io.quit)
+            SDL_CondWait(io.wake, io.lock);
+        IoJob *job = io.head;
+        if (!job)
+            break;
+        io.head = job->next;
+        if (!io.head)
+            io.tail = NULL;
+        SDL_UnlockMutex(io.lock);
+
+        run(job);
+        // the result is the first member, so the event loop frees the whole job
+        SDL_Event e = {0};
+        e.type = io.event_type;
+        e.user.code = job->result.kind;
+        e.user.data1 = &job->result;
+        if (SDL_PushEvent(&e) <= 0)
+            imp_io_result_free(&job->result);
+
+        SDL_LockMutex(io.lock);
+    }
+    SDL_UnlockMutex(io.lock);
+    return 0;
+}
+
+int imp_io_init(void) {
+    if (io.thread)
+        return 0;
+    io.event_type = SDL_RegisterEvents(1);
+    io.lock = SDL_CreateMutex();
+    io.wake = SDL_CreateCond();
+    if (io.event_type == (Uint32)-1 || !io.lock || !io.wake ||
+        !(io.thread = SDL_CreateThread(worker, "imp-io", NULL))) {
+        fprintf(stderr, "imp_io_init: %s\n", SDL_GetError());
+        return -1;
+    }
+    return 0;
+}
+
+void imp_io_quit(void) {
+    if (!io.thread)
+        return;
+    SDL_LockMutex(io.lock);
+    io.quit = 1;
+    SDL_CondSignal(io.wake);
+    SDL_UnlockMutex(io.lock);
+    SDL_WaitThread(io.thread, NULL);
+    SDL_DestroyCond(io.wake);
+    SDL_DestroyMutex(io.lock);
+    memset(&io, 0, sizeof(io));
+}
+
+Uint32 imp_io_event_type(void) {
+    return io.event_type;
+}
+
+static int push(ImpIoKind kind, const char *path, SDL_Surface *surface, Uint32 pixel_format,
+                const PNG_options *png, void *userdata) {
+    IoJob *job = calloc(1, sizeof(IoJob));
+    if (!io.thread || !job || !(job->result.path = strdup(path))) {
+        free(job);
+        return -1;
+    }
+    job->result.kind = kind;
+    job->result.surface = surface;
+    job->result.userdata = userdata;
+    job->pixel_format = pixel_format;
+    job->png = png ? *png : PNG_DEFAULT_OPTIONS;
+
+    SDL_LockMutex(io.lock);
+    if (io.tail)
+        io.tail->next = job;
+    else
+        io.head = job;
+    io.tail = job;
+    SDL_CondSignal(io.wake);
+    SDL_UnlockMutex(io.lock);
+    return 0;
+}
+
+int imp_io_load(const char *path, Uint32 pixel_format, void *userdata) {
+    return push(IMP_IO_LOAD, path, NULL, pixel_format, NULL, userdata);
+}
+
+int imp_io_save(SDL_Surface *snapshot, const char *path, const PNG_options *png, void *userdata) {
+    if (push(IMP_IO_SAVE, path, snapshot, 0, png, userdata) != 0) {
+        SDL_FreeSurface(snapshot);
+        return -1;
+    }
+    return 0;
+}
+
+void imp_io_result_free(ImpIoResult *result) {
+    if (!result)
+        return;
+    SDL_FreeSurface(result->surface);
+    free(result->path);
+    free(result);
+}
@@ -0,0 +1,46 @@
+/* asyncio.h - image loads and saves on a background thread */
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+#include <SDL2/SDL.h>
+#include "png.h"
+
+typedef enum ImpIoKind {
+    IMP_IO_LOAD,
+    IMP_IO_SAVE,
+} ImpIoKind;
+
+/**
+ * sent back as a user event of type imp_io_event_type(): event.user.code is the kind and
+ * event.user.data1 this result, which the receiver releases with imp_io_result_free
+ */
+typedef struct ImpIoResult {
+    ImpIoKind kind;
+    int status;             // 0 or -1
+    char *path;
+    SDL_Surface *surface;   // loads: the decoded image, set it to NULL to keep it
+    void *userdata;
+} ImpIoResult;
+
+/** starts the worker thread, call after SDL_Init. returns 0 or -1 */
+int imp_io_init(void);
+
+/** finishes queued jobs and stops the worker */
+void imp_io_quit(void);
+Uint32 imp_io_event_type(void);
+
+/**
+ * queues a load of path, converted to pixel_format (eg. SDL_Surface::format->format).
+ * .bmp files go through BMP_load, anything else through SDL_image
+ */
+int imp_io_load(const char *path, Uint32 pixel_format, void *userdata);
+
+/**
+ * queues a save of snapshot to path as BMP when it ends in .bmp and PNG otherwise, png may be
+ * NULL for PNG_DEFAULT_OPTIONS. the worker takes ownership of snapshot, pass a copy of
+ * anything the UI keeps drawing on
+ */
+int imp_io_save(SDL_Surface *snapshot, const char *path, const PNG_options *png, void *userdata);
+
+void imp_io_result_free(ImpIoResult *result);
+
+#endif
@@ -0,0 +1,150 @@
+/* bmp-test.c - round trips every written format and loads hand made RLE8 and top-down files */
+#include "bmp-test.h"
+#include "bmp.h"
+#include "random.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// build.sh creates build/, the file is removed again at the end
+#define TEST_FILE "build/selftest.bmp"
+
+static uchar *put16(uchar *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uchar *put32(uchar *p, uint32_t v) {
+    p = put16(p, v & 0xFFFF);
+    return put16(p, v >> 16);
+}
+
+// writes the 54 header bytes, ncolors BGR0 palette entries and n bytes of pixel data
+static void write_file(int32_t w, int32_t h, uint16_t bits, uint32_t compression,
+                       const uint32_t *palette, uint32_t ncolors, const uchar *data, size_t n) {
+    uchar header[54], *p = header;
+    uint32_t offset = sizeof(header) + 4 * ncolors;
+    p = put16(p, 0x4D42);
+    p = put32(p, offset + n);
+    p = put32(p, 0);
+    p = put32(p, offset);
+    p = put32(p, 40);
+    p = put32(p, w);
+    p = put32(p, h);
+    p = put16(p, 1);
+    p = put16(p, bits);
+    p = put32(p, compression);
+    p = put32(p, n);
+    p = put32(p, 2835);
+    p = put32(p, 2835);
+    p = put32(p, ncolors);
+    put32(p, 0);
+    FILE *fp = fopen(TEST_FILE, "wb");
+    assert(fp);
+    fwrite(header, 1, sizeof(header), fp);
+    for (uint32_t i = 0; i < ncolors; ++i) {
+        uchar entry[4];
+        put32(entry, palette[i]);
+        fwrite(entry, 1, 4, fp);
+    }
+    fwrite(data, 1, n, fp);
+    fclose(fp);
+}
+
+// loads TEST_FILE and checks it holds w x h pixels equal to the top-down image
+static void expect_file(const uchar *image, unsigned w, unsigned h, unsigned bytes_per_pixel) {
+    BMP_file bmp;
+    assert(BMP_load(&bmp, TEST_FILE) == 0);
+    assert(bmp.w == w && bmp.h == h && bmp.bytes_per_pixel == bytes_per_pixel);
+    assert(memcmp(bmp.image_raw, image, (size_t)w * h * bytes_per_pixel) == 0);
+    BMP_free(&bmp);
+}
+
+static void palette_color(uint32_t rgb, uchar *bgr) {
+    bgr[0] = rgb & 0xFF;
+    bgr[1] = rgb >> 8 & 0xFF;
+    bgr[2] = rgb >> 16 & 0xFF;
+}
+
+int bmp_selftest(void) {
+    ImpRng rng;
+    rng_seed(&rng, 34);
+    enum { W = 37, H = 23 };   // odd width, so 24bit rows are padded
+    uchar *image = malloc(W * H * 4);
+    assert(image);
+
+    // truecolor, 24 and 32bit
+    for (size_t i = 0; i < W * H * 4; ++i) {
+        image[i] = (uchar)rng_next(&rng);
+    }
+    assert(BMP_write_buffer(image, W, H, 3, TEST_FILE) == 0);
+    expect_file(image, W, H, 3);
+    assert(BMP_write_buffer(image, W, H, 4, TEST_FILE) == 0);
+    expect_file(image, W, H, 4);
+
+    BMP_view view;
+    assert(BMP_write_buffer(image, W, H, 3, TEST_FILE) == 0);
+    assert(BMP_view_open(&view, TEST_FILE) == 0);
+    for (size_t y = 0; y < H; ++y) {
+        assert(memcmp(BMP_view_row(&view, y), image + y * W * 3, W * 3) == 0);
+    }
+    BMP_view_close(&view);
+
+    // paletted, plain and RLE8: long runs, short runs and single pixels
+    uint32_t palette[16];
+    for (int i = 0; i < 16; ++i) {
+        palette[i] = (uint32_t)rng_next(&rng) & 0xFFFFFF;
+    }
+    for (size_t i = 0; i < W * H;) {
+        size_t run = 1 + rng_next(&rng) % (i % 3 ? 3 : 300);
+        uint32_t rgb = palette[rng_next(&rng) % 16];
+        for (; run && i < W * H; --run, ++i) {
+            palette_color(rgb, image + 3 * i);
+        }
+    }
+    for (int rle = 0; rle <= 1; ++rle) {
+        assert(BMP_write_paletted(image, W, H, palette, 16, rle, TEST_FILE) == 0);
+        expect_file(image, W, H, 3);
+    }
+
+    // hand made RLE8, bottom row first: a run, an odd absolute run, a delta skipping pixels
+    // (they stay index 0) and an early end of bitmap leaving the last row at index 0 too
+    const uint32_t colors[3] = {0x000000, 0xFF0000, 0x0000FF};
+    const uchar rle8[] = {
+        3, 1, 0, 3, 2, 1, 2, 0, 0, 0,      // 1 1 1 2 1 2, the absolute run is padded
+        2, 2, 0, 2, 3, 0, 1, 1, 0, 0,      // 2 2, skip 3 right and stay on the row, 1
+        0, 1,
+    };
+    const uchar expected_indices[3][6] = {
+        {0, 0, 0, 0, 0, 0},
+        {2, 2, 0, 0, 0, 1},
+        {1, 1, 1, 2, 1, 2},
+    };
+    write_file(6, 3, 8, BMP_RLE8, colors, 3, rle8, sizeof(rle8));
+    uchar expected[3 * 6 * 3];
+    for (int i = 0; i < 3 * 6; ++i) {
+        palette_color(colors[expected_indices[i / 6][i % 6]], expected + 3 * i);
+    }
+    expect_file(expected, 6, 3, 3);
+
+    // top-down 24bit, negative height: the first row in the file is the top one
+    uchar pixels[2 * 2 * 3], rows[2 * 8] = {0};
+    for (int i = 0; i < 2 * 2 * 3; ++i) {
+        pixels[i] = (uchar)rng_next(&rng);
+    }
+    memcpy(rows, pixels, 6);
+    memcpy(rows + 8, pixels + 6, 6);
+    write_file(2, -2, 24, BMP_RGB, NULL, 0, rows, sizeof(rows));
+    expect_file(pixels, 2, 2, 3);
+
+    // sizes whose byte counts overflow are refused before anything is allocated (prints an error)
+    write_file(0x7FFFFFFF, 0x7FFFFFFF, 32, BMP_RGB, NULL, 0, image, 16);
+    BMP_file bmp;
+    assert(BMP_load(&bmp, TEST_FILE) != 0);
+
+    remove(TEST_FILE);
+    free(image);
+    return 1;
+}
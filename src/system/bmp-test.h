@@ -0,0 +1,8 @@
+/* bmp-test.h - tests for BMP loading and writing */
+#ifndef BMP_TEST_H
+#define BMP_TEST_H
+
+/** asserts on failure, returns 1 when every case passed */
+int bmp_selftest(void);
+
+#endif
@@ -1,20 +1,23 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "bmp.h"
-#include "vector.h"
-
-static BMP_error bmp_err = 0;
-
-
-static int parse_headers(FILE *fp, BMP_file_header *file_header, BMP_info_header *info_header) {
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static BMP_error parse_headers(FILE *fp, BMP_file_header *file_header, BMP_info_header *info_header) {
    assert(INFOHEADER_SIZE == sizeof(BMP_info_header));
    fread(&file_header->ftype, sizeof(file_header->ftype), 1, fp);
-   if (file_header->ftype != BMP_MAGIC) {
-       bmp_err = NOT_A_BMP;
-       return -1;
-   }
+   if (file_header->ftype != BMP_MAGIC)
+       return NOT_A_BMP;
 
    fread(&file_header->fsize, sizeof(file_header->fsize), 1, fp);
    fread(&file_header->reserved1, sizeof(file_header->reserved1), 1, fp);
@@ -26,26 +29,28 @@ static int parse_headers(FILE *fp, BMP_file_header *file_header, BMP_info_header
 
 
 // copies and horizontally flips the bytes of src into dest
-// ie top-left pixel -> top-right pixel
+// ie top-left pixel -> top-right pixel. src and dest may be the same buffer
 void buf_flip_horiz(uchar *dest, uchar *src, uint height, uint width_bytes) {
     assert(src && dest);
     for (size_t row = 0; row < height; ++row) {
-        uchar row_buf[width_bytes];
-        for (size_t i = 0; i < width_bytes; ++i) {
-            size_t end_of_row = ((row + 1) * width_bytes) - 1;
-            row_buf[i] = src[end_of_row - i];
+        uchar *s = src + row * width_bytes, *d = dest + row * width_bytes;
+        // swap from both ends so no row buffer is needed when flipping in place
+        for (size_t i = 0, j = width_bytes; i < j--; ++i) {
+            uchar tmp = s[i];
+            d[i] = s[j];
+            d[j] = tmp;
         }
-        memcpy(dest + (row * width_bytes), row_buf, width_bytes);
     }
 }
 
 
-static void BMP_print_error(const char *filename) {
+static void BMP_print_error(BMP_error err, const char *filename) {
     char *fmt_str;
-    switch (bmp_err) {
+    switch (err) {
         case NOT_A_BMP: fmt_str = "BMP_Error: Corrupt or unsupported filetype: %s\n"; break;
         case NOT_FOUND: fmt_str = "BMP_Error: File not found: %s\n"; break;
         case MALLOC_FAILED: fmt_str = "BMP_Error: Memory allocation failed: %s\n"; break;
+        case WRITE_FAILED: fmt_str = "BMP_Error: Could not write: %s\n"; break;
         default: return;
     }
     fprintf(stderr, fmt_str, filename);
@@ -54,125 +59,550 @@ static void BMP_print_error(const char *filename) {
 
 void BMP_print_dimensions(BMP_file *bmp) {
     printf("image dimensions: %d x %d (w x h px)\n", bmp->w, bmp->h);
-    printf("image size: %d bytes\n", bmp->size_with_padding);
-    printf("padding per row: %d bytes\n", (bmp->size_with_padding - bmp->size_bytes) / bmp->w * 3);
+    printf("image size: %zu bytes\n", bmp->size_with_padding);
+    printf("padding per row: %zu bytes\n", (bmp->size_with_padding - bmp->size_bytes) / bmp->h);
+}
+
+
+// little-endian fields of raw header bytes
+static uint32_t read_u32(const uchar *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t read_u16(const uchar *p) {
+    return p[0] | p[1] << 8;
+}
+
+static void write_u16(uchar *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void write_u32(uchar *p, uint32_t v) {
+    write_u16(p, v);
+    write_u16(p + 2, v >> 16);
+}
+
+
+/** what the headers say about the pixel data beyond the fixed 40 byte info header */
+typedef struct {
+    size_t w, h;
+    int top_down;
+    uint32_t alpha_mask;
+    unsigned ncolors;
+    uchar palette[256][4]; // B, G, R, 0: 4 byte entries so expansion can copy a whole word
+} PixelLayout;
+
+// reads the bitfield masks and the color table, checks that the format is one we decode
+static int parse_layout(FILE *fp, const BMP_info_header *info, PixelLayout *layout) {
+    int32_t height = info->height_px;
+    layout->w = info->width_px;
+    layout->top_down = height < 0;
+    layout->h = height < 0 ? -(int64_t)height : height;
+    if ((int32_t)info->width_px <= 0 || height == 0 || info->header_size < INFOHEADER_SIZE)
+        return -1;
+    // w * h * 32 must fit a size_t, so every byte count of the decode (up to 4 bytes per pixel,
+    // w * bits / 8 per row) does too. only limits 32-bit builds
+    if (layout->w > SIZE_MAX / 32 / layout->h)
+        return -1;
+
+    // masks follow a 40 byte header and are part of the larger v3+ headers
+    uchar masks[16] = {0};
+    if (fread(masks, 1, sizeof(masks), fp) == 0 && info->compression_type == BMP_BITFIELDS)
+        return -1;
+
+    switch (info->bits_per_pixel) {
+    case 24:
+        return info->compression_type == BMP_RGB ? 0 : -1;
+    case 32:
+        if (info->compression_type == BMP_BITFIELDS) {
+            // only the BGRA byte order is decoded
+            if (read_u32(masks) != 0xFF0000 || read_u32(masks + 4) != 0xFF00 ||
+                read_u32(masks + 8) != 0xFF)
+                return -1;
+            if (info->header_size >= 56)
+                layout->alpha_mask = read_u32(masks + 12);
+        } else if (info->compression_type != BMP_RGB) {
+            return -1;
+        }
+        return 0;
+    case 8:
+        if (info->compression_type != BMP_RGB && info->compression_type != BMP_RLE8)
+            return -1;
+        if (info->compression_type == BMP_RLE8 && layout->top_down)
+            return -1;
+        layout->ncolors = info->colors_used && info->colors_used < 256 ? info->colors_used : 256;
+        memset(layout->palette, 0, sizeof(layout->palette));
+        if (fseek(fp, FILEHEADER_SIZE + info->header_size, SEEK_SET) != 0 ||
+            fread(layout->palette, 4, layout->ncolors, fp) != layout->ncolors)
+            return -1;
+        for (unsigned i = 0; i < 256; ++i)
+            layout->palette[i][3] = 0;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+// table-driven 8bit -> 24bit, every pixel is one 4 byte copy except the last of the row
+static void expand_indices(uchar *dest, const uchar *indices, size_t w, const uchar palette[256][4]) {
+    for (size_t x = 0; x + 1 < w; ++x)
+        memcpy(dest + 3 * x, palette[indices[x]], 4);
+    memcpy(dest + 3 * (w - 1), palette[indices[w - 1]], 3);
+}
+
+// top-down destination row of file row i
+static size_t dest_row(const PixelLayout *layout, size_t i) {
+    return layout->top_down ? i : layout->h - 1 - i;
+}
+
+// uncompressed rows are read straight into their destination row, paletted ones via one row
+// of indices, so the pixels are copied exactly once
+static BMP_error read_rows(FILE *fp, uchar *image, const PixelLayout *layout, unsigned bits) {
+    size_t w = layout->w, file_row = (w * bits / 8 + 3) & ~(size_t)3;
+    size_t width_bytes = w * (bits == 32 ? 4 : 3);
+    size_t padding = file_row - w * bits / 8;
+    uchar *scratch = malloc(file_row);
+    if (!scratch)
+        return MALLOC_FAILED;
+
+    BMP_error status = 0;
+    for (size_t i = 0; i < layout->h; ++i) {
+        uchar *dest = image + dest_row(layout, i) * width_bytes;
+        if (bits == 8) {
+            if (fread(scratch, 1, file_row, fp) != file_row) {
+                status = NOT_A_BMP;
+                break;
+            }
+            expand_indices(dest, scratch, w, layout->palette);
+            continue;
+        }
+        if (fread(dest, 1, width_bytes, fp) != width_bytes || fread(scratch, 1, padding, fp) != padding) {
+            status = NOT_A_BMP;
+            break;
+        }
+        // without an alpha mask the 4th byte is unused and usually 0
+        if (bits == 32 && !layout->alpha_mask)
+            for (size_t x = 0; x < w; ++x)
+                dest[4 * x + 3] = 0xFF;
+    }
+
+    free(scratch);
+    return status;
+}
+
+// decodes an RLE8 stream into one index per pixel in file row order, out of range runs clip
+static void decode_rle8(const uchar *data, size_t n, uchar *indices, size_t w, size_t h) {
+    size_t x = 0, y = 0, i = 0;
+    while (i + 1 < n && y < h) {
+        uchar count = data[i++], value = data[i++];
+        if (count) {
+            for (; count && x < w; --count)
+                indices[y * w + x++] = value;
+        } else if (value == 0) { // end of line
+            x = 0;
+            ++y;
+        } else if (value == 1) { // end of bitmap
+            break;
+        } else if (value == 2) { // delta
+            if (i + 1 >= n)
+                break;
+            x += data[i];
+            y += data[i + 1];
+            i += 2;
+        } else { // absolute run, padded to 16 bits
+            size_t run = value < n - i ? value : n - i;
+            for (size_t k = 0; k < run; ++k, ++x)
+                if (x < w)
+                    indices[y * w + x] = data[i + k];
+            i += value + (value & 1);
+        }
+    }
+}
+
+static BMP_error read_rle8(FILE *fp, uchar *image, const PixelLayout *layout, size_t *compressed) {
+    long start = ftell(fp);
+    if (start < 0 || fseek(fp, 0, SEEK_END) != 0)
+        return NOT_A_BMP;
+    size_t n = ftell(fp) - start;
+    uchar *data = malloc(n + 1);
+    uchar *indices = calloc(layout->w, layout->h);
+    if (!data || !indices) {
+        free(data);
+        free(indices);
+        return MALLOC_FAILED;
+    }
+
+    fseek(fp, start, SEEK_SET);
+    BMP_error status = fread(data, 1, n, fp) == n ? 0 : NOT_A_BMP;
+    if (status == 0) {
+        decode_rle8(data, n, indices, layout->w, layout->h);
+        for (size_t i = 0; i < layout->h; ++i)
+            expand_indices(image + dest_row(layout, i) * 3 * layout->w, indices + i * layout->w,
+                           layout->w, layout->palette);
+    }
+    *compressed = n;
+    free(data);
+    free(indices);
+    return status;
 }
 
 
 int BMP_load(BMP_file *bmp, const char *src) {
     assert(bmp && src);
-    printf("loading from file: '%s'\n", src);
     FILE *fp = NULL;
     if (!(fp = fopen(src, "rb"))) {
-        bmp_err = NOT_FOUND;
-        BMP_print_error(src);
-        return -1;
+        BMP_print_error(NOT_FOUND, src);
+        return NOT_FOUND;
     }
 
     BMP_file_header *file_header = malloc(sizeof(BMP_file_header));
     BMP_info_header *info_header = malloc(sizeof(BMP_info_header));
-    if (!file_header || !info_header) {
-        bmp_err = MALLOC_FAILED;
-        BMP_print_error(src);
-        return -1;
-    }
+    PixelLayout *layout = malloc(sizeof(PixelLayout));
+    uchar *image = NULL;
+    BMP_error status = MALLOC_FAILED;
+    if (file_header && info_header && layout &&
+        (status = parse_headers(fp, file_header, info_header)) == 0) {
+        unsigned bits = info_header->bits_per_pixel;
+        unsigned bytes_per_pixel = bits == 32 ? 4 : 3;
+        size_t file_bytes = 0;
+        memset(layout, 0, sizeof(*layout));
+        if (parse_layout(fp, info_header, layout) != 0) {
+            status = NOT_A_BMP;
+        } else if (!(image = malloc((size_t)bytes_per_pixel * layout->w * layout->h + 1))) {
+            status = MALLOC_FAILED;
+        } else if (fseek(fp, file_header->offset, SEEK_SET) != 0) {
+            status = NOT_A_BMP;
+        } else if (info_header->compression_type == BMP_RLE8) {
+            status = read_rle8(fp, image, layout, &file_bytes);
+        } else {
+            // rows are padded to 4 bytes, image_size_bytes may legally be 0 so derive it
+            status = read_rows(fp, image, layout, bits);
+            file_bytes = ((layout->w * bits / 8 + 3) & ~(size_t)3) * layout->h;
+        }
 
-    if (parse_headers(fp, file_header, info_header)) {
-        BMP_print_error(src);
-        return -1;
+        if (status == 0) {
+            bmp->w = layout->w;
+            bmp->h = layout->h;
+            bmp->bytes_per_pixel = bytes_per_pixel;
+            bmp->size_bytes = (size_t)bytes_per_pixel * layout->w * layout->h;
+            bmp->size_with_padding = file_bytes;
+        }
     }
-
-    bmp->size_with_padding = info_header->image_size_bytes;
-    bmp->w = info_header->width_px;
-    bmp->h = info_header->height_px;
-    bmp->image_raw = calloc(bmp->size_with_padding, 1);
+    fclose(fp);
+    free(layout);
+
+    if (status != 0) {
+        BMP_print_error(status, src);
+        free(image);
+        free(file_header);
+        free(info_header);
+        return status;
+    }
+    bmp->image_raw = image;
     bmp->file_header = file_header;
     bmp->info_header = info_header;
-    if (!bmp->image_raw) {
-        bmp_err = MALLOC_FAILED;
-        BMP_print_error(src);
-        return -1;
-    }
+    return 0;
+}
 
-    // read the image data
-    fseek(fp, file_header->offset, SEEK_SET);
-    fread(bmp->image_raw, 1, bmp->size_with_padding, fp);
 
-    // generate the raw image for buffer manipulation
-    // copy image data to buffer, strip end of row padding
-    UCharVec image_buffer;
-    UCharVec_init(&image_buffer);
-    unsigned width_bytes = bmp->size_with_padding / bmp->h;
-    unsigned padding = width_bytes - 3 * bmp->w;
-    for (size_t i = 0; i < bmp->size_with_padding; i++) {
-        // skip last two n bytes of every row (padding)
-        if (i % width_bytes > width_bytes - padding - 1)
-            continue;
-        UCharVec_push(&image_buffer, bmp->image_raw[i]);
+// padded rows are collected into one buffer of about this size per write call
+#define WRITE_BUFFER_BYTES (1 << 20)
+// 72 dpi
+#define DEFAULT_PPM 2835
+// slots of the color -> palette index cache used when writing paletted files
+#define INDEX_CACHE_SIZE 4096
+
+/**
+ * turns one top-down source row into its file representation and returns the byte count.
+ * last is set for the final row written, which is the top row
+ */
+typedef struct RowEncoder RowEncoder;
+struct RowEncoder {
+    size_t (*encode)(RowEncoder *enc, const uchar *row, uchar *out, int last);
+    unsigned w;
+    unsigned bytes_per_pixel;   // of the source rows
+    unsigned bits;              // of the file
+    unsigned compression;
+    size_t max_row_bytes;       // upper bound of encode()
+    const uint32_t *palette;
+    size_t ncolors;
+    uchar *indices;
+    uint32_t cache_keys[INDEX_CACHE_SIZE];
+    uchar cache_index[INDEX_CACHE_SIZE];
+};
+
+static size_t encode_copy(RowEncoder *enc, const uchar *row, uchar *out, int last) {
+    (void)last;
+    size_t n = (size_t)enc->w * enc->bytes_per_pixel;
+    memcpy(out, row, n);
+    memset(out + n, 0, enc->max_row_bytes - n);
+    return enc->max_row_bytes;
+}
+
+// exact palette members hit the cache, anything else maps to the nearest color
+static uchar palette_index(RowEncoder *enc, const uchar *bgr) {
+    uint32_t color = bgr[2] << 16 | bgr[1] << 8 | bgr[0];
+    size_t slot = (color * 2654435761u) >> 20 & (INDEX_CACHE_SIZE - 1);
+    if (enc->cache_keys[slot] == (color | 1u << 24))
+        return enc->cache_index[slot];
+
+    size_t best = 0;
+    long best_dist = -1;
+    for (size_t i = 0; i < enc->ncolors && best_dist != 0; ++i) {
+        long dr = (long)(enc->palette[i] >> 16 & 0xFF) - bgr[2];
+        long dg = (long)(enc->palette[i] >> 8 & 0xFF) - bgr[1];
+        long db = (long)(enc->palette[i] & 0xFF) - bgr[0];
+        long dist = dr * dr + dg * dg + db * db;
+        if (best_dist < 0 || dist < best_dist) {
+            best_dist = dist;
+            best = i;
+        }
     }
-    memcpy(bmp->image_raw, image_buffer.arr, image_buffer.size);
+    enc->cache_keys[slot] = color | 1u << 24;
+    enc->cache_index[slot] = best;
+    return best;
+}
 
-    bmp->size_bytes = image_buffer.size;
+static size_t encode_indexed(RowEncoder *enc, const uchar *row, uchar *out, int last) {
+    (void)last;
+    for (size_t x = 0; x < enc->w; ++x, row += enc->bytes_per_pixel)
+        out[x] = palette_index(enc, row);
+    memset(out + enc->w, 0, enc->max_row_bytes - enc->w);
+    return enc->max_row_bytes;
+}
 
-    // generate the image used for IO
-    // reverse the byte array (first pixel becomes last pixel, second becomes
-    // second-to-last, etc) reversed_bmp_buffer is only used for rendering
-    // purposes
-    size_t buf_size = UCharVec_size(&image_buffer);
-    BMP_reverse(bmp->image_raw, image_buffer.arr, bmp->h, 3*bmp->w, buf_size);
+// runs of 2+ equal indices become (count, index) pairs, the rest absolute runs of 3..255
+static size_t encode_rle8(RowEncoder *enc, const uchar *row, uchar *out, int last) {
+    uchar *idx = enc->indices, *p = out;
+    size_t w = enc->w;
+    for (size_t x = 0; x < w; ++x, row += enc->bytes_per_pixel)
+        idx[x] = palette_index(enc, row);
+
+    size_t x = 0;
+    while (x < w) {
+        size_t run = 1;
+        while (x + run < w && run < 255 && idx[x + run] == idx[x])
+            ++run;
+        if (run >= 2) {
+            *p++ = run;
+            *p++ = idx[x];
+            x += run;
+            continue;
+        }
 
-    UCharVec_free(&image_buffer);
-    fclose(fp);
-    return 0;
+        // literal stretch until the next pair of equal indices
+        size_t lit = 1;
+        while (x + lit < w && lit < 255 && (x + lit + 1 >= w || idx[x + lit] != idx[x + lit + 1]))
+            ++lit;
+        if (lit < 3) {
+            for (size_t k = 0; k < lit; ++k) {
+                *p++ = 1;
+                *p++ = idx[x + k];
+            }
+        } else {
+            *p++ = 0;
+            *p++ = lit;
+            memcpy(p, idx + x, lit);
+            p += lit;
+            if (lit & 1)
+                *p++ = 0;
+        }
+        x += lit;
+    }
+    *p++ = 0;
+    *p++ = last ? 1 : 0;
+    return p - out;
 }
 
+static void init_encoder(RowEncoder *enc, unsigned w, unsigned bytes_per_pixel,
+                         const uint32_t *palette, size_t ncolors, int rle) {
+    memset(enc, 0, sizeof(*enc));
+    enc->w = w;
+    enc->bytes_per_pixel = bytes_per_pixel;
+    enc->palette = palette;
+    enc->ncolors = ncolors;
+    if (!palette) {
+        enc->encode = encode_copy;
+        enc->bits = 8 * bytes_per_pixel;
+        enc->compression = bytes_per_pixel == 4 ? BMP_BITFIELDS : BMP_RGB;
+        enc->max_row_bytes = ((size_t)w * bytes_per_pixel + 3) & ~(size_t)3;
+    } else if (!rle) {
+        enc->encode = encode_indexed;
+        enc->bits = 8;
+        enc->max_row_bytes = ((size_t)w + 3) & ~(size_t)3;
+    } else {
+        enc->encode = encode_rle8;
+        enc->bits = 8;
+        enc->compression = BMP_RLE8;
+        // every pixel as a run of one plus the end of line code
+        enc->max_row_bytes = 2 * (size_t)w + 2;
+    }
+}
 
-int BMP_write(BMP_file *bmp, const char *dest) {
-    assert(bmp && dest);
-    assert(INFOHEADER_SIZE == sizeof(BMP_info_header));
-    printf("writing to file: '%s'\n", dest);
+/** header, bitfield masks and color table, returns the offset of the pixel data or 0 */
+static size_t write_header(FILE *fp, const RowEncoder *enc, unsigned h, uint32_t ppm) {
+    size_t info_size = enc->bits == 32 ? 56 : INFOHEADER_SIZE;
+    size_t offset = FILEHEADER_SIZE + info_size + 4 * (enc->palette ? enc->ncolors : 0);
+    uchar header[FILEHEADER_SIZE + 56] = {0};
+    write_u16(header, BMP_MAGIC);
+    write_u32(header + 10, offset);
+    uchar *info = header + FILEHEADER_SIZE;
+    write_u32(info, info_size);
+    write_u32(info + 4, enc->w);
+    write_u32(info + 8, h);
+    write_u16(info + 12, 1);
+    write_u16(info + 14, enc->bits);
+    write_u32(info + 16, enc->compression);
+    write_u32(info + 24, ppm);
+    write_u32(info + 28, ppm);
+    if (enc->palette)
+        write_u32(info + 32, enc->ncolors);
+    if (enc->bits == 32) {
+        write_u32(info + 40, 0xFF0000);
+        write_u32(info + 44, 0xFF00);
+        write_u32(info + 48, 0xFF);
+        write_u32(info + 52, 0xFF000000);
+    }
+    if (fwrite(header, FILEHEADER_SIZE + info_size, 1, fp) != 1)
+        return 0;
+
+    for (size_t i = 0; enc->palette && i < enc->ncolors; ++i) {
+        uchar entry[4] = {enc->palette[i] & 0xFF, enc->palette[i] >> 8 & 0xFF,
+                          enc->palette[i] >> 16 & 0xFF, 0};
+        if (fwrite(entry, 4, 1, fp) != 1)
+            return 0;
+    }
+    return offset;
+}
 
-    FILE *fp = NULL;
-    if (!(fp = fopen(dest, "wb"))) {
-        bmp_err = NOT_FOUND;
-        BMP_print_error(dest);
+// the file and pixel data sizes are only known once the rows are encoded
+static int patch_sizes(FILE *fp, size_t offset, size_t data_bytes) {
+    uchar size[4];
+    write_u32(size, offset + data_bytes);
+    if (fseek(fp, 2, SEEK_SET) != 0 || fwrite(size, 4, 1, fp) != 1)
         return -1;
+    write_u32(size, data_bytes);
+    if (fseek(fp, FILEHEADER_SIZE + 20, SEEK_SET) != 0 || fwrite(size, 4, 1, fp) != 1)
+        return -1;
+    return 0;
+}
+
+/**
+ * emits rows bottom-up as the format expects. rows come from image when it is set, otherwise
+ * from fn one band at a time, the only scratch is one band and a batch of encoded rows
+ */
+static BMP_error write_rows(FILE *fp, unsigned h, const uchar *image, BMP_band_fn fn, void *ctx,
+                      size_t band_rows, RowEncoder *enc, size_t *data_bytes) {
+    size_t width_bytes = (size_t)enc->w * enc->bytes_per_pixel;
+    size_t batch_size = WRITE_BUFFER_BYTES > enc->max_row_bytes ? WRITE_BUFFER_BYTES : enc->max_row_bytes;
+    if (image || band_rows == 0 || band_rows > h)
+        band_rows = h;
+    uchar *batch = malloc(batch_size);
+    uchar *band = image ? NULL : malloc(band_rows * width_bytes + 1);
+    enc->indices = malloc(enc->w + 1);
+    if (!batch || (!image && !band) || !enc->indices) {
+        free(batch);
+        free(band);
+        free(enc->indices);
+        return MALLOC_FAILED;
     }
 
-    fwrite(&bmp->file_header->ftype, sizeof(bmp->file_header->ftype), 1, fp);
-    fwrite(&bmp->file_header->fsize, sizeof(bmp->file_header->fsize), 1, fp);
-    fwrite(&bmp->file_header->reserved1, sizeof(bmp->file_header->reserved1), 1, fp);
-    fwrite(&bmp->file_header->reserved2, sizeof(bmp->file_header->reserved2), 1, fp);
-    fwrite(&bmp->file_header->offset, sizeof(bmp->file_header->offset), 1, fp);
-    fwrite(bmp->info_header, sizeof(BMP_info_header), 1, fp);
-    fseek(fp, bmp->file_header->offset, SEEK_SET);
-
-    // add padding back to end of rows
-    UCharVec image_with_padding;
-    UCharVec_init(&image_with_padding);
-    size_t width_bytes = bmp->size_with_padding / bmp->h;
-    size_t padding = width_bytes - 3 * bmp->w;
-    for (size_t i = 0; i < bmp->size_with_padding - (padding * bmp->h); ++i) {
-        if (i != 0 && i % (width_bytes - padding) == 0) {
-            for (size_t n = 0; n < padding; ++n) {
-                UCharVec_push(&image_with_padding, 0x00);
-            }
+    BMP_error status = 0;
+    size_t used = 0;
+    *data_bytes = 0;
+    for (size_t end = h; end > 0 && status == 0;) {
+        size_t start = end > band_rows ? end - band_rows : 0;
+        const uchar *rows = image ? image : band;
+        if (!image && fn(ctx, start, end - start, band) != 0) {
+            status = WRITE_FAILED;
+            break;
         }
 
-        UCharVec_push(&image_with_padding, bmp->image_raw[i]);
+        for (size_t y = end; y-- > start;) {
+            size_t src_row = image ? y : y - start;
+            if (batch_size - used < enc->max_row_bytes) {
+                if (fwrite(batch, 1, used, fp) != used) {
+                    status = WRITE_FAILED;
+                    break;
+                }
+                *data_bytes += used;
+                used = 0;
+            }
+            used += enc->encode(enc, rows + src_row * width_bytes, batch + used, y == 0);
+        }
+        end = start;
     }
+    if (status == 0 && fwrite(batch, 1, used, fp) != used)
+        status = WRITE_FAILED;
+    *data_bytes += used;
+
+    free(batch);
+    free(band);
+    free(enc->indices);
+    enc->indices = NULL;
+    return status;
+}
 
-    // add EOF padding bytes
-    for (size_t n = 0; n < padding; ++n) {
-        UCharVec_push(&image_with_padding, 0x00);
+static BMP_error write_file(const char *dest, unsigned h, const uchar *image, BMP_band_fn fn,
+                            void *ctx, size_t band_rows, RowEncoder *enc, uint32_t ppm) {
+    FILE *fp = fopen(dest, "wb");
+    if (!fp) {
+        BMP_print_error(NOT_FOUND, dest);
+        return NOT_FOUND;
     }
+    // rows are batched here, stdio buffering would only add a copy
+    setvbuf(fp, NULL, _IONBF, 0);
+
+    size_t data_bytes = 0, offset = write_header(fp, enc, h, ppm);
+    BMP_error status = WRITE_FAILED;
+    if (offset && (status = write_rows(fp, h, image, fn, ctx, band_rows, enc, &data_bytes)) == 0 &&
+        patch_sizes(fp, offset, data_bytes) != 0)
+        status = WRITE_FAILED;
+
+    if (fclose(fp) != 0 && status == 0)
+        status = WRITE_FAILED;
+    if (status != 0)
+        BMP_print_error(status, dest);
+    return status;
+}
 
-    assert(bmp->size_with_padding == image_with_padding.size);
-    fwrite(image_with_padding.arr, 1, bmp->size_with_padding, fp);
+int BMP_write(BMP_file *bmp, const char *dest) {
+    assert(bmp && bmp->image_raw && dest);
+    uint32_t ppm = bmp->info_header ? bmp->info_header->x_resolution_ppm : DEFAULT_PPM;
+    RowEncoder enc;
+    init_encoder(&enc, bmp->w, bmp->bytes_per_pixel, NULL, 0, 0);
+    return write_file(dest, bmp->h, bmp->image_raw, NULL, NULL, 0, &enc, ppm);
+}
 
-    UCharVec_free(&image_with_padding);
-    fclose(fp);
-    return 0;
+int BMP_write_buffer(const uchar *image, unsigned w, unsigned h, unsigned bytes_per_pixel,
+                     const char *dest) {
+    assert(image && dest && (bytes_per_pixel == 3 || bytes_per_pixel == 4));
+    RowEncoder enc;
+    init_encoder(&enc, w, bytes_per_pixel, NULL, 0, 0);
+    return write_file(dest, h, image, NULL, NULL, 0, &enc, DEFAULT_PPM);
+}
+
+int BMP_write_bands(unsigned w, unsigned h, BMP_band_fn fn, void *ctx, size_t band_rows,
+                    const char *dest) {
+    assert(fn && dest);
+    RowEncoder enc;
+    init_encoder(&enc, w, 3, NULL, 0, 0);
+    return write_file(dest, h, NULL, fn, ctx, band_rows, &enc, DEFAULT_PPM);
+}
+
+int BMP_write_paletted(const uchar *image, unsigned w, unsigned h, const uint32_t *palette,
+                       size_t ncolors, int rle, const char *dest) {
+    assert(image && palette && dest && ncolors > 0 && ncolors <= 256);
+    RowEncoder *enc = malloc(sizeof(RowEncoder));
+    if (!enc) {
+        BMP_print_error(MALLOC_FAILED, dest);
+        return MALLOC_FAILED;
+    }
+    init_encoder(enc, w, 3, palette, ncolors, rle);
+    BMP_error status = write_file(dest, h, image, NULL, NULL, 0, enc, DEFAULT_PPM);
+    free(enc);
+    return status;
 }
 
 void BMP_set_pixel(BMP_file *bmp, uint byte_x, uint y, uint32_t rgb) {
@@ -180,7 +610,7 @@ void BMP_set_pixel(BMP_file *bmp, uint byte_x, uint y, uint32_t rgb) {
         return;
     }
 
-    int i = byte_x + (3 * y * bmp->w);
+    size_t i = byte_x + ((size_t)bmp->bytes_per_pixel * y * bmp->w);
     bmp->image_raw[i] = rgb & 0x00FF00;
     bmp->image_raw[i + 1] = (rgb & 0x00FF00) >> 8;
     bmp->image_raw[i + 2] = (rgb & 0xFF0000) >> 16;
@@ -204,3 +634,112 @@ void BMP_free(BMP_file *bmp) {
     bmp->file_header = NULL;
     bmp->info_header = NULL;
 }
+
+
+static BMP_error map_file(BMP_view *view, const char *src) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(src, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NOT_FOUND;
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NOT_A_BMP;
+    view->map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    view->map_size = size.QuadPart;
+    if (!view->map)
+        return MALLOC_FAILED;
+#else
+    int fd = open(src, O_RDONLY);
+    if (fd < 0)
+        return NOT_FOUND;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NOT_A_BMP;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return MALLOC_FAILED;
+    // rows are usually consumed in order, let the kernel read ahead
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    view->map = map;
+    view->map_size = st.st_size;
+#endif
+    return 0;
+}
+
+static void unmap_file(BMP_view *view) {
+#ifdef _WIN32
+    UnmapViewOfFile(view->map);
+#else
+    munmap((void *)view->map, view->map_size);
+#endif
+    view->map = NULL;
+    view->map_size = 0;
+}
+
+// checks the headers of a mapped file and locates the pixel rows
+static int parse_view(BMP_view *view) {
+    const uchar *p = view->map;
+    if (view->map_size < FILEHEADER_SIZE + INFOHEADER_SIZE || read_u16(p) != BMP_MAGIC)
+        return -1;
+
+    uint32_t offset = read_u32(p + 10);
+    const uchar *info = p + FILEHEADER_SIZE;
+    int32_t width = read_u32(info + 4), height = read_u32(info + 8);
+    uint16_t bits = read_u16(info + 14);
+    uint32_t compression = read_u32(info + 16);
+    if (read_u32(info) < INFOHEADER_SIZE || read_u16(info + 12) != 1 || width <= 0 || height == 0 ||
+        height == INT32_MIN)
+        return -1;
+    if (!(bits == 24 && compression == BMP_RGB) &&
+        !(bits == 32 && (compression == BMP_RGB || compression == BMP_BITFIELDS)))
+        return -1;
+    // bitfield masks directly follow the 40 byte header
+    if (compression == BMP_BITFIELDS &&
+        (view->map_size < FILEHEADER_SIZE + INFOHEADER_SIZE + 12 ||
+         read_u32(info + 40) != 0xFF0000 || read_u32(info + 44) != 0xFF00 || read_u32(info + 48) != 0xFF))
+        return -1;
+
+    view->w = width;
+    view->top_down = height < 0;
+    view->h = height < 0 ? -height : height;
+    view->bytes_per_pixel = bits / 8;
+    view->row_bytes = (view->bytes_per_pixel * (size_t)view->w + 3) & ~(size_t)3;
+    if (offset > view->map_size || (view->map_size - offset) / view->row_bytes < view->h)
+        return -1;
+    view->pixels = p + offset;
+    return 0;
+}
+
+int BMP_view_open(BMP_view *view, const char *src) {
+    assert(view && src);
+    memset(view, 0, sizeof(*view));
+    BMP_error status = map_file(view, src);
+    if (status == 0 && parse_view(view) != 0) {
+        unmap_file(view);
+        status = NOT_A_BMP;
+    }
+    if (status != 0)
+        BMP_print_error(status, src);
+    return status;
+}
+
+const uchar *BMP_view_row(const BMP_view *view, size_t y) {
+    assert(view && view->map && y < view->h);
+    size_t file_row = view->top_down ? y : view->h - 1 - y;
+    return view->pixels + file_row * view->row_bytes;
+}
+
+void BMP_view_close(BMP_view *view) {
+    assert(view);
+    if (view->map)
+        unmap_file(view);
+}
@@ -9,6 +9,11 @@
 #define INFOHEADER_SIZE 40
 #define BMP_MAGIC 0x4D42
 
+// BMP_info_header::compression_type
+#define BMP_RGB 0
+#define BMP_RLE8 1
+#define BMP_BITFIELDS 3
+
 typedef unsigned char uchar;
 typedef unsigned int uint;
 
@@ -20,7 +25,7 @@ typedef struct {
     uint32_t  offset;       /* specifies the offset in bytes from header to data */
 } BMP_file_header;
 
-// for use with 24bit bitmaps
+// the 40 byte BITMAPINFOHEADER, larger headers are read as this plus bitfield masks
 typedef struct {
     uint32_t  header_size;        /* specifies the size of the info header in bytes */
     uint32_t  width_px;       /* specifies width in pixels */
@@ -39,11 +44,14 @@ typedef enum {
     NOT_A_BMP = 1,
     NOT_FOUND,
     MALLOC_FAILED,
+    WRITE_FAILED,
 } BMP_error;
 
 /**
- * @brief holds the two headers and the raw image data for IO, data MUST include padding bytes
- * see https://en.wikipedia.org/wiki/BMP_file_format#Example_1
+ * @brief holds the two headers and the decoded image, see
+ * https://en.wikipedia.org/wiki/BMP_file_format#Example_1
+ * 24bit, 8bit paletted and RLE8 files decode to BGR, 32bit files to BGRA (alpha is 255 unless
+ * the file has an alpha mask). rows are top-down whatever the order in the file
  */
 typedef struct {
     BMP_file_header *file_header;
@@ -51,17 +59,62 @@ typedef struct {
     uchar *image_raw;               // image without end of row padding
     unsigned w;
     unsigned h;
-    unsigned size_with_padding;
-    unsigned size_bytes;            // size without padding
+    unsigned bytes_per_pixel;       // of image_raw, 3 or 4
+    size_t size_with_padding;       // pixel data size in the file
+    size_t size_bytes;              // size of image_raw
 } BMP_file;
 
-/** all BMP_* functions set the global bmp_err variable on error and then return -1*/
+/**
+ * @brief read-only memory mapped bmp, pixel rows are served straight from the page cache
+ * so files larger than memory can be processed row by row without a copy
+ */
+typedef struct {
+    const uchar *map;
+    size_t map_size;
+    const uchar *pixels;            // first row in file order
+    unsigned w;
+    unsigned h;
+    unsigned bytes_per_pixel;       // 3 (BGR) or 4 (BGRA)
+    size_t row_bytes;               // file row size including padding
+    int top_down;                   // negative height in the info header
+} BMP_view;
+
+/**
+ * all BMP_* functions that can fail report the error on stderr and return its BMP_error, 0 on
+ * success. they keep no shared state, so any number of files can be read and written in parallel
+ */
 int BMP_load(BMP_file *bmp, const char *src);
+/** writes file->image_raw (top-down, unpadded) as a 24bit or, with 4 bytes per pixel, 32bit bmp */
 int BMP_write(BMP_file *file, const char *dest);
+int BMP_write_buffer(const uchar *image, unsigned w, unsigned h, unsigned bytes_per_pixel,
+                     const char *dest);
+
+/**
+ * writes a BGR image as 8bit paletted bmp, optionally RLE8 compressed. pixels are stored as
+ * the index of their palette color (RGB, MSB as in load_palette) or of the nearest one, so
+ * palette_quantization output round-trips exactly at a third of the size
+ */
+int BMP_write_paletted(const uchar *image, unsigned w, unsigned h, const uint32_t *palette,
+                       size_t ncolors, int rle, const char *dest);
+
+/**
+ * produces nrows top-down rows starting at y0 into band (3 * w bytes per row, no padding).
+ * bands are requested from the bottom of the image up, returns 0 or -1 to abort the write
+ */
+typedef int (*BMP_band_fn)(void *ctx, size_t y0, size_t nrows, uchar *band);
+
+/** streams an image of any size to disk with one band of rows in memory at a time */
+int BMP_write_bands(unsigned w, unsigned h, BMP_band_fn fn, void *ctx, size_t band_rows,
+                    const char *dest);
 void BMP_print_dimensions(BMP_file *bmp);
 void BMP_set_pixel(BMP_file *bmp, uint x, uint y, uint32_t rgb);
 void BMP_reverse(uchar *dest, uchar *src, size_t height, size_t width_bytes, size_t nbytes);
 void buf_flip_horiz(uchar *dest, uchar *src, uint height, uint width_bytes);
 void BMP_free(BMP_file *bmp);
 
+int BMP_view_open(BMP_view *view, const char *src);
+/** pixels of row y counted from the top, without padding. only uncompressed 24/32bit files */
+const uchar *BMP_view_row(const BMP_view *view, size_t y);
+void BMP_view_close(BMP_view *view);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,66 @@
+/* lz-test.c - round trips LZ_compress/LZ_decompress over typical and edge case inputs */
+#include "lz-test.h"
+#include "lz.h"
+#include "random.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_INPUT (1 << 16)
+
+// compresses src and checks it decodes to the same bytes, returns the compressed size
+static size_t round_trip(const uchar *src, size_t n, uchar *packed, uchar *out) {
+    size_t size = LZ_compress(src, n, packed, LZ_BOUND(n));
+    assert(size > 0 && size <= LZ_BOUND(n));
+    memset(out, 0xAB, n);
+    assert(LZ_decompress(packed, size, out, n) == 0);
+    assert(memcmp(src, out, n) == 0);
+    return size;
+}
+
+int lz_selftest(void) {
+    uchar *src = malloc(MAX_INPUT);
+    uchar *packed = malloc(LZ_BOUND(MAX_INPUT));
+    uchar *out = malloc(MAX_INPUT);
+    assert(src && packed && out);
+    ImpRng rng;
+    rng_seed(&rng, 44);
+
+    // every length around the match limits, empty input included
+    for (size_t n = 0; n < 300; ++n) {
+        memset(src, 7, n);
+        round_trip(src, n, packed, out);
+        for (size_t i = 0; i < n; ++i)
+            src[i] = (uchar)rng_next(&rng);
+        round_trip(src, n, packed, out);
+    }
+
+    // a flat tile shrinks a lot, noise stays within the bound
+    memset(src, 0xFF, MAX_INPUT);
+    assert(round_trip(src, MAX_INPUT, packed, out) < MAX_INPUT / 100);
+    for (size_t i = 0; i < MAX_INPUT; ++i)
+        src[i] = (uchar)rng_next(&rng);
+    round_trip(src, MAX_INPUT, packed, out);
+
+    // painted-looking pixels: mostly background with a few colors
+    for (size_t i = 0; i < MAX_INPUT; i += 4) {
+        uint32_t px = rng_next(&rng) % 8 ? 0xFFFFFFFF : (uint32_t)rng_next(&rng) % 4 * 0x00102030;
+        memcpy(src + i, &px, 4);
+    }
+    round_trip(src, MAX_INPUT, packed, out);
+
+    // no room is reported, not overrun
+    size_t size = LZ_compress(src, MAX_INPUT, packed, LZ_BOUND(MAX_INPUT));
+    assert(LZ_compress(src, MAX_INPUT, packed, size - 1) == 0);
+
+    // truncated, too long or too short input is rejected
+    assert(LZ_decompress(packed, size - 1, out, MAX_INPUT) == -1);
+    assert(LZ_decompress(packed, size, out, MAX_INPUT - 1) == -1);
+    uchar bad_offset[] = {0x10, 'a', 0x00, 0x00};   // one literal, then a match at offset 0
+    assert(LZ_decompress(bad_offset, sizeof(bad_offset), out, 8) == -1);
+
+    free(src);
+    free(packed);
+    free(out);
+    return 1;
+}
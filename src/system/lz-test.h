@@ -0,0 +1,8 @@
+/* lz-test.h - tests for LZ block compression */
+#ifndef LZ_TEST_H
+#define LZ_TEST_H
+
+/** asserts on failure, returns 1 when every case passed */
+int lz_selftest(void);
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+#define MIN_MATCH 4
+#define HASH_BITS 12
+#define LAST_LITERALS 5     // the format ends with literals
+#define MATCH_LIMIT 12      // no match starts closer than this to the end
+#define MAX_OFFSET 65535
+
+static uint32_t read32(const uchar *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// lengths from 15 up continue in bytes of 255 and a final smaller one
+static uchar *put_length(uchar *op, size_t len) {
+    for (len -= 15; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (uchar)len;
+    return op;
+}
+
+// token, literals and for a match the offset, 0 when out of room
+static uchar *put_sequence(uchar *op, uchar *end, const uchar *lit, size_t nlit, size_t offset,
+                           size_t mlen) {
+    size_t need = 1 + nlit / 255 + 1 + nlit + (offset ? 2 + mlen / 255 + 1 : 0);
+    if (need > (size_t)(end - op))
+        return NULL;
+    uchar *token = op++;
+    *token = (nlit >= 15 ? 15 : nlit) << 4;
+    if (nlit >= 15)
+        op = put_length(op, nlit);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (!offset)
+        return op;
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    *token |= mlen >= 15 ? 15 : mlen;
+    if (mlen >= 15)
+        op = put_length(op, mlen);
+    return op;
+}
+
+size_t LZ_compress(const uchar *src, size_t n, uchar *dest, size_t cap) {
+    uint32_t table[1 << HASH_BITS] = {0};  // last position of each hashed 4 bytes
+    const uchar *ip = src, *anchor = src, *end = src + n;
+    uchar *op = dest, *oend = dest + cap;
+
+    if (n >= MATCH_LIMIT) {
+        const uchar *last_start = end - MATCH_LIMIT;
+        const uchar *last_byte = end - LAST_LITERALS;
+        while (ip <= last_start) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash4(seq);
+            const uchar *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+                ++ip;
+                continue;
+            }
+            const uchar *mp = ip + MIN_MATCH, *rp = ref + MIN_MATCH;
+            while (mp < last_byte && *mp == *rp)
+                ++mp, ++rp;
+            op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip - MIN_MATCH);
+            if (!op)
+                return 0;
+            ip = anchor = mp;
+        }
+    }
+    op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    return op ? (size_t)(op - dest) : 0;
+}
+
+static int get_length(const uchar **ip, const uchar *end, size_t *len) {
+    uchar b;
+    do {
+        if (*ip >= end)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int LZ_decompress(const uchar *src, size_t n, uchar *dest, size_t size) {
+    const uchar *ip = src, *iend = src + n;
+    uchar *op = dest, *oend = dest + size;
+
+    while (ip < iend) {
+        uint token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && get_length(&ip, iend, &nlit) != 0)
+            return -1;
+        if (nlit > (size_t)(iend - ip) || nlit > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+        if (ip == iend)
+            break;  // the last sequence has no match
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && get_length(&ip, iend, &mlen) != 0)
+            return -1;
+        mlen += MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dest) || mlen > (size_t)(oend - op))
+            return -1;
+        const uchar *ref = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            // overlapping copy repeats the last offset bytes
+            while (mlen--)
+                *op++ = *ref++;
+        }
+    }
+    return op == oend ? 0 : -1;
+}
@@ -0,0 +1,19 @@
+/* lz.h - fast LZ77 block compression in the LZ4 block format */
+#ifndef LZ_H
+#define LZ_H
+#include <stddef.h>
+#include "vector.h"
+
+/** worst case compressed size of n bytes */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+/**
+ * greedy single-probe matching, meant for speed over ratio: flat and repeated pixels shrink a
+ * lot, noise not at all. returns the compressed size, or 0 when it would not fit in cap
+ */
+size_t LZ_compress(const uchar *src, size_t n, uchar *dest, size_t cap);
+
+/** decodes into exactly size bytes, returns 0 or -1 on malformed or truncated input */
+int LZ_decompress(const uchar *src, size_t n, uchar *dest, size_t size);
+
+#endif
@@ -1,8 +1,27 @@
 #include "palette.h"
+#include "quantize.h"
+#include "parallel.h"
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define mkdir(path, mode) _mkdir(path)
+#define getpid _getpid
+#define realpath(path, resolved) _fullpath(resolved, path, PATH_MAX)
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
 
 /**
  * @brief loads the <palette>, if not found loads a default
@@ -15,26 +34,390 @@ int load_palette(U32Vec *buffer, const char *palette) {
             return -1;
         }
 
-        int MAX_CHARS = 1024;
-        char line[MAX_CHARS];
-        while (fgets(line, MAX_CHARS, palette_fp)) {
-            char *tok = NULL;
-            tok = strtok(line, ",");
-            while (tok && isalnum(*tok)) {
-                uint32_t n = strtoul(tok, NULL, 16);
-                U32Vec_push(buffer, n);
-                tok = strtok(NULL, ",");
-            }
+        // one read of the whole file, colors are hex values separated by commas or whitespace
+        UCharVec text;
+        UCharVec_init(&text);
+        long size = fseek(palette_fp, 0, SEEK_END) == 0 ? ftell(palette_fp) : -1;
+        rewind(palette_fp);
+        int status = size >= 0 && UCharVec_resize(&text, size + 1) == 0 ? 0 : -1;
+        if (status == 0) {
+            text.arr[fread(text.arr, 1, size, palette_fp)] = '\0';
+            // the shortest entry is "rgb," so this reserves enough in one allocation
+            status = U32Vec_reserve(buffer, buffer->size + size / 4 + 1);
         }
         fclose(palette_fp);
+
+        for (char *p = (char *)text.arr; status == 0 && p && *p;) {
+            if (!isxdigit((uchar)*p)) {
+                ++p;
+                continue;
+            }
+            char *end;
+            uint32_t n = strtoul(p, &end, 16);
+            status = U32Vec_push(buffer, n);
+            p = end;
+        }
+        UCharVec_free(&text);
+        if (status != 0) {
+            fprintf(stderr, "Palette file could not be read: '%s'\n", palette);
+            return -1;
+        }
     } else {
         uint32_t default_palette[] = {
             0x800000, 0x9A6324, 0x808000, 0x469990, 0x000075, 0x000000,
             0xe6194B, 0xf58231, 0xffe119, 0xbfef45, 0x3cb44b, 0x42d4f4,
             0x4363d8, 0x911eb4, 0xf032e6, 0xa9a9a9, 0xfabed4, 0xffd8b1,
             0xfffac8, 0xaaffc3, 0xdcbeff, 0xffffff};
-        U32Vec_from(buffer, default_palette,
-                    sizeof(default_palette) / sizeof(default_palette[0]));
+        return U32Vec_from(buffer, default_palette,
+                           sizeof(default_palette) / sizeof(default_palette[0]));
     }
     return 0;
 }
+
+
+#define KMEANS_ITERATIONS 8
+
+/**
+ * @brief median-cut seeds refined by a few k-means iterations, no palette file needed
+ */
+int generate_palette(U32Vec *buffer, const uchar *image, size_t size_bytes, size_t bytes_per_pixel,
+                     size_t ncolors) {
+    // colors are generated straight into buffer
+    ColorHistogram *hist = color_histogram_create(image, size_bytes, bytes_per_pixel);
+    if (!hist || U32Vec_resize(buffer, ncolors) != 0) {
+        fprintf(stderr, "generate_palette: allocation failed\n");
+        color_histogram_free(hist);
+        return -1;
+    }
+
+    size_t n = palette_median_cut(hist, buffer->arr, ncolors);
+    palette_kmeans_refine(hist, buffer->arr, n, KMEANS_ITERATIONS);
+    U32Vec_resize(buffer, n);
+
+    color_histogram_free(hist);
+    return n ? 0 : -1;
+}
+
+
+#define NCELLS ((size_t)PALETTE_CELLS * PALETTE_CELLS * PALETTE_CELLS)
+
+/** layout of compiled palettes, in memory and in cache files, followed by the three arrays */
+typedef struct {
+    char magic[8];
+    uint32_t cell_bits;
+    uint32_t ncolors;
+    uint32_t ncell_colors;
+    uint32_t reserved;
+    int64_t source_mtime;       // key of cache files, 0 for palettes built in memory
+    int64_t source_size;
+} CompiledHeader;
+
+static const char compiled_magic[8] = {'I', 'M', 'P', 'P', 'A', 'L', 0, 1};
+
+static size_t compiled_size(size_t ncolors, size_t ncell_colors) {
+    return sizeof(CompiledHeader) + ncolors * sizeof(uint32_t) + (NCELLS + 1) * sizeof(uint32_t) +
+           ncell_colors * sizeof(uint16_t);
+}
+
+// points the palette arrays into data, which starts with a valid header
+static void attach(ImpPalette *palette, void *data, size_t data_size, int mapped) {
+    const CompiledHeader *header = data;
+    palette->colors = (const uint32_t *)(header + 1);
+    palette->ncolors = header->ncolors;
+    palette->cell_start = palette->colors + header->ncolors;
+    palette->cell_colors = (const uint16_t *)(palette->cell_start + NCELLS + 1);
+    palette->data = data;
+    palette->data_size = data_size;
+    palette->mapped = mapped;
+}
+
+// fine cells per side of the coarse blocks whose candidates are found first
+#define BLOCK_CELLS 4
+#define BLOCK_SIZE (BLOCK_CELLS * PALETTE_CELL_SIZE)
+
+// squared distances from a channel value to the closest and the farthest value in [lo, hi]
+static void range_distances(int value, int lo, int hi, int *near, int *far) {
+    int dn = value < lo ? lo - value : value > hi ? value - hi : 0;
+    int df = value - lo > hi - value ? value - lo : hi - value;
+    *near = dn * dn;
+    *far = df * df;
+}
+
+typedef struct {
+    const uint32_t *colors;
+    size_t ncolors;
+    int (*near)[3][PALETTE_CELLS];  // per color, channel and cell along that channel
+    int (*far)[3][PALETTE_CELLS];
+    uint16_t *candidates;           // ncolors per chunk
+    int *bound;                     // per cell, farthest distance to its best color
+    uint32_t *cell_start;
+    uint16_t *cell_colors;          // NULL while counting
+} IndexBuild;
+
+/**
+ * a color can only be nearest to some value in a region if its closest distance to the region
+ * does not exceed the smallest farthest distance of any color. candidates of a cell are a
+ * subset of those of the block containing it, so blocks are filtered against the whole
+ * palette and cells against their block. the first pass counts candidates, the second fills
+ * them in. chunks are slices of cells with the same red range
+ */
+static void index_slice(void *ctx, size_t chunk, size_t begin, size_t end) {
+    (void) begin;
+    (void) end;
+    IndexBuild *b = ctx;
+    size_t r = chunk;
+    uint16_t *candidates = b->candidates + chunk * b->ncolors;
+
+    for (int g0 = 0; g0 < PALETTE_CELLS; g0 += BLOCK_CELLS) {
+        for (int b0 = 0; b0 < PALETTE_CELLS; b0 += BLOCK_CELLS) {
+            int glo = g0 * PALETTE_CELL_SIZE, blo = b0 * PALETTE_CELL_SIZE;
+            int bound = INT32_MAX, near, far, gnear, gfar, bnear, bfar;
+            for (size_t i = 0; i < b->ncolors; ++i) {
+                range_distances(b->colors[i] >> 8 & 0xFF, glo, glo + BLOCK_SIZE - 1, &near, &gfar);
+                range_distances(b->colors[i] & 0xFF, blo, blo + BLOCK_SIZE - 1, &near, &bfar);
+                far = b->far[i][0][r] + gfar + bfar;
+                if (far < bound)
+                    bound = far;
+            }
+            size_t ncandidates = 0;
+            for (size_t i = 0; i < b->ncolors; ++i) {
+                range_distances(b->colors[i] >> 8 & 0xFF, glo, glo + BLOCK_SIZE - 1, &gnear, &far);
+                range_distances(b->colors[i] & 0xFF, blo, blo + BLOCK_SIZE - 1, &bnear, &far);
+                if (b->near[i][0][r] + gnear + bnear <= bound)
+                    candidates[ncandidates++] = (uint16_t)i;
+            }
+
+            for (int g = g0; g < g0 + BLOCK_CELLS; ++g) {
+                for (int bl = b0; bl < b0 + BLOCK_CELLS; ++bl) {
+                    size_t cell = (r * PALETTE_CELLS + g) * PALETTE_CELLS + bl;
+                    if (!b->cell_colors) {
+                        int cell_bound = INT32_MAX;
+                        for (size_t k = 0; k < ncandidates; ++k) {
+                            size_t i = candidates[k];
+                            int d = b->far[i][0][r] + b->far[i][1][g] + b->far[i][2][bl];
+                            if (d < cell_bound)
+                                cell_bound = d;
+                        }
+                        uint32_t count = 0;
+                        for (size_t k = 0; k < ncandidates; ++k) {
+                            size_t i = candidates[k];
+                            count += b->near[i][0][r] + b->near[i][1][g] + b->near[i][2][bl] <= cell_bound;
+                        }
+                        b->bound[cell] = cell_bound;
+                        b->cell_start[cell] = count;
+                    } else {
+                        uint16_t *out = b->cell_colors + b->cell_start[cell];
+                        for (size_t k = 0; k < ncandidates; ++k) {
+                            size_t i = candidates[k];
+                            if (b->near[i][0][r] + b->near[i][1][g] + b->near[i][2][bl] <= b->bound[cell])
+                                *out++ = (uint16_t)i;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+int palette_build(ImpPalette *palette, const uint32_t *colors, size_t ncolors) {
+    memset(palette, 0, sizeof(*palette));
+    if (ncolors == 0 || ncolors > PALETTE_MAX_COLORS) {
+        fprintf(stderr, "palette_build: %zu colors, expected 1 to %d\n", ncolors, PALETTE_MAX_COLORS);
+        return -1;
+    }
+
+    IndexBuild b = {.colors = colors, .ncolors = ncolors};
+    b.near = malloc(ncolors * sizeof(*b.near));
+    b.far = malloc(ncolors * sizeof(*b.far));
+    b.candidates = malloc(PALETTE_CELLS * ncolors * sizeof(uint16_t));
+    b.bound = malloc(NCELLS * sizeof(int));
+    b.cell_start = malloc((NCELLS + 1) * sizeof(uint32_t));
+    uchar *data = NULL;
+    if (b.near && b.far && b.candidates && b.bound && b.cell_start) {
+        for (size_t i = 0; i < ncolors; ++i)
+            for (int c = 0; c < 3; ++c)
+                for (int k = 0; k < PALETTE_CELLS; ++k)
+                    range_distances(colors[i] >> (16 - 8 * c) & 0xFF, k * PALETTE_CELL_SIZE,
+                                    (k + 1) * PALETTE_CELL_SIZE - 1, &b.near[i][c][k], &b.far[i][c][k]);
+        parallel_for(PALETTE_CELLS, 1, index_slice, &b);
+
+        // counts to offsets
+        uint32_t total = 0;
+        for (size_t cell = 0; cell < NCELLS; ++cell) {
+            uint32_t count = b.cell_start[cell];
+            b.cell_start[cell] = total;
+            total += count;
+        }
+        b.cell_start[NCELLS] = total;
+
+        size_t size = compiled_size(ncolors, total);
+        if ((data = malloc(size))) {
+            CompiledHeader header = {.cell_bits = PALETTE_CELL_BITS, .ncolors = ncolors,
+                                     .ncell_colors = total};
+            memcpy(header.magic, compiled_magic, sizeof(compiled_magic));
+            memcpy(data, &header, sizeof(header));
+            attach(palette, data, size, 0);
+            memcpy((uint32_t *)palette->colors, colors, ncolors * sizeof(uint32_t));
+            memcpy((uint32_t *)palette->cell_start, b.cell_start, (NCELLS + 1) * sizeof(uint32_t));
+            b.cell_colors = (uint16_t *)palette->cell_colors;
+            parallel_for(PALETTE_CELLS, 1, index_slice, &b);
+        }
+    }
+    free(b.near);
+    free(b.far);
+    free(b.candidates);
+    free(b.bound);
+    free(b.cell_start);
+    if (!data) {
+        fprintf(stderr, "palette_build: allocation failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+void palette_close(ImpPalette *palette) {
+    if (palette->mapped) {
+#ifndef _WIN32
+        munmap(palette->data, palette->data_size);
+#endif
+    } else {
+        free(palette->data);
+    }
+    memset(palette, 0, sizeof(*palette));
+}
+
+static int cache_dir(char *dir, size_t size) {
+    const char *env;
+    int n;
+    if ((env = getenv("IMP_CACHE_DIR")) && *env) {
+        n = snprintf(dir, size, "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+        n = snprintf(dir, size, "%s/imp", env);
+    } else if ((env = getenv("HOME")) && *env) {
+        n = snprintf(dir, size, "%s/.cache", env);
+        if (n > 0 && (size_t)n < size)
+            mkdir(dir, 0755);
+        n = snprintf(dir, size, "%s/.cache/imp", env);
+    } else {
+        return -1;
+    }
+    if (n <= 0 || (size_t)n >= size || (mkdir(dir, 0755) != 0 && errno != EEXIST))
+        return -1;
+    return 0;
+}
+
+// <cache dir>/<file name>-<hash of the absolute source path>.impal
+static int cache_path(char *out, size_t size, const char *source) {
+    char dir[PATH_MAX], absolute[PATH_MAX];
+    if (cache_dir(dir, sizeof(dir)) != 0 || !realpath(source, absolute))
+        return -1;
+    uint64_t hash = 0xcbf29ce484222325ull;  // FNV-1a
+    for (const char *c = absolute; *c; ++c)
+        hash = (hash ^ (uchar)*c) * 0x100000001b3ull;
+    const char *name = strrchr(absolute, '/');
+    name = name ? name + 1 : absolute;
+    int n = snprintf(out, size, "%s/%s-%016llx.impal", dir, name, (unsigned long long)hash);
+    return n > 0 && (size_t)n < size ? 0 : -1;
+}
+
+/**
+ * a cache file is trusted only as far as palette_nearest needs: every cell holds at least one
+ * color (palette_build always keeps the closest one) and every index names a palette color.
+ * a truncated or corrupted file fails here and the palette is rebuilt from its source
+ */
+static int valid_cache(const CompiledHeader *header, size_t size, const struct stat *source) {
+    if (size < sizeof(*header) || memcmp(header->magic, compiled_magic, sizeof(compiled_magic)) ||
+        header->cell_bits != PALETTE_CELL_BITS || header->source_mtime != (int64_t)source->st_mtime ||
+        header->source_size != (int64_t)source->st_size || header->ncolors == 0 ||
+        header->ncolors > PALETTE_MAX_COLORS ||
+        size != compiled_size(header->ncolors, header->ncell_colors))
+        return 0;
+    const uint32_t *cell_start = (const uint32_t *)(header + 1) + header->ncolors;
+    const uint16_t *cell_colors = (const uint16_t *)(cell_start + NCELLS + 1);
+    if (cell_start[0] != 0 || cell_start[NCELLS] != header->ncell_colors)
+        return 0;
+    for (size_t cell = 0; cell < NCELLS; ++cell)
+        if (cell_start[cell] >= cell_start[cell + 1])
+            return 0;
+    for (size_t i = 0; i < header->ncell_colors; ++i)
+        if (cell_colors[i] >= header->ncolors)
+            return 0;
+    return 1;
+}
+
+// maps a cache file that matches source, returns -1 when it is missing or stale
+static int open_cache(ImpPalette *palette, const char *path, const struct stat *source) {
+#ifdef _WIN32
+    // no mapping here, the file is small enough to be read in one go
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+    long size = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+    rewind(fp);
+    void *data = size > 0 ? malloc(size) : NULL;
+    int ok = data && fread(data, 1, size, fp) == (size_t)size && valid_cache(data, size, source);
+    fclose(fp);
+    if (!ok) {
+        free(data);
+        return -1;
+    }
+    attach(palette, data, size, 0);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    if (!valid_cache(map, st.st_size, source)) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    attach(palette, map, st.st_size, 1);
+#endif
+    return 0;
+}
+
+// written next to the cache file and renamed, so readers never see a partial file
+static void write_cache(const ImpPalette *palette, const char *path, const struct stat *source) {
+    CompiledHeader *header = palette->data;
+    header->source_mtime = source->st_mtime;
+    header->source_size = source->st_size;
+
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp)
+        return;
+    int ok = fwrite(palette->data, 1, palette->data_size, fp) == palette->data_size;
+    ok &= fclose(fp) == 0;
+#ifdef _WIN32
+    if (ok)
+        remove(path);
+#endif
+    if (!ok || rename(tmp, path) != 0)
+        remove(tmp);
+}
+
+int palette_open(ImpPalette *palette, const char *path) {
+    memset(palette, 0, sizeof(*palette));
+    struct stat source;
+    char cache[PATH_MAX];
+    int cached = path && stat(path, &source) == 0 && cache_path(cache, sizeof(cache), path) == 0;
+    if (cached && open_cache(palette, cache, &source) == 0)
+        return 0;
+
+    U32Vec colors;
+    U32Vec_init(&colors);
+    int status = load_palette(&colors, path);
+    if (status == 0)
+        status = palette_build(palette, colors.arr, colors.size);
+    U32Vec_free(&colors);
+    if (status == 0 && cached)
+        write_cache(palette, cache, &source);
+    return status;
+}
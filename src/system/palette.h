@@ -1,7 +1,72 @@
 #ifndef PALETTE_H
 #define PALETTE_H
+#include <stddef.h>
+#include <stdint.h>
 #include "vector.h"
 
 int load_palette(U32Vec *buffer, const char *palette);
 
-#endif
\ No newline at end of file
+/**
+ * replaces contents of buffer with up to ncolors generated from a packed BGR image of 3 or 4
+ * bytes per pixel
+ */
+int generate_palette(U32Vec *buffer, const uchar *image, size_t size_bytes, size_t bytes_per_pixel,
+                     size_t ncolors);
+
+/** the rgb cube is split in PALETTE_CELLS^3 cells of PALETTE_CELL_SIZE values per channel */
+#define PALETTE_CELL_BITS 3
+#define PALETTE_CELL_SIZE (1 << PALETTE_CELL_BITS)
+#define PALETTE_CELLS (256 >> PALETTE_CELL_BITS)
+#define PALETTE_MAX_COLORS 65536
+
+/**
+ * a palette with its nearest-color index: every cell lists, in palette order, the colors that
+ * can be the nearest one to some rgb value inside the cell. lookups scan a few candidates
+ * instead of the whole palette and return exactly what a linear search would.
+ * palettes opened from a file are compiled once into a cache file and mapped afterwards
+ */
+typedef struct ImpPalette {
+    const uint32_t *colors;        // 0xRRGGBB
+    size_t ncolors;
+    const uint32_t *cell_start;    // PALETTE_CELLS^3 + 1 offsets into cell_colors
+    const uint16_t *cell_colors;   // indices into colors
+    void *data;                    // mapping or allocation backing the arrays above
+    size_t data_size;
+    int mapped;
+} ImpPalette;
+
+/**
+ * opens a palette file as load_palette would, NULL for the default palette. the compiled form
+ * is cached in $IMP_CACHE_DIR, $XDG_CACHE_HOME/imp or ~/.cache/imp and rebuilt when the
+ * source file's mtime or size changes. returns 0 or -1
+ */
+int palette_open(ImpPalette *palette, const char *path);
+
+/** builds the index of ncolors 0xRRGGBB colors in memory, returns 0 or -1 */
+int palette_build(ImpPalette *palette, const uint32_t *colors, size_t ncolors);
+void palette_close(ImpPalette *palette);
+
+/** index of the first palette color with the smallest euclidean rgb distance */
+static inline size_t palette_nearest(const ImpPalette *palette, int red, int green, int blue) {
+    size_t cell = (((size_t)red >> PALETTE_CELL_BITS) * PALETTE_CELLS +
+                   ((size_t)green >> PALETTE_CELL_BITS)) * PALETTE_CELLS +
+                  ((size_t)blue >> PALETTE_CELL_BITS);
+    const uint16_t *it = palette->cell_colors + palette->cell_start[cell];
+    const uint16_t *end = palette->cell_colors + palette->cell_start[cell + 1];
+    size_t best = *it;
+    int min = 1 << 30;
+    for (; it != end; ++it) {
+        uint32_t c = palette->colors[*it];
+        int dr = (int)(c >> 16 & 0xFF) - red;
+        int dg = (int)(c >> 8 & 0xFF) - green;
+        int db = (int)(c & 0xFF) - blue;
+        int d = dr * dr + dg * dg + db * db;
+        if (d < min) {
+            min = d;
+            best = *it;
+        }
+    }
+    return best;
+}
+
+#endif
@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "parallel.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define MAX_THREADS 64
+
+static int nthreads = 0;
+
+typedef struct ParallelJob ParallelJob;
+struct ParallelJob {
+    parallel_fn fn;
+    void *ctx;
+    size_t n, grain, nchunks;
+    atomic_size_t next;
+    size_t helpers_left;    // pool threads that may still join, guarded by pool.lock
+    size_t running;         // pool threads working on it, guarded by pool.lock
+    ParallelJob *next_job;
+};
+
+/**
+ * threads are started on first use and then live as long as the process, so their thread
+ * arenas and stacks are reused across calls. concurrent parallel_for calls (batch workers)
+ * share the threads, each job takes at most parallel_nthreads() - 1 of them
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work, job_done;
+    ParallelJob *jobs;      // jobs still accepting helpers, newest first
+    int nstarted;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .job_done = PTHREAD_COND_INITIALIZER,
+};
+
+int parallel_nthreads(void) {
+    if (nthreads > 0)
+        return nthreads;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long ncpu = info.dwNumberOfProcessors;
+#else
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    nthreads = ncpu < 1 ? 1 : ncpu > MAX_THREADS ? MAX_THREADS : ncpu;
+    return nthreads;
+}
+
+void parallel_set_nthreads(int n) {
+    nthreads = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+}
+
+static void run_chunks(ParallelJob *job) {
+    size_t chunk;
+    while ((chunk = atomic_fetch_add(&job->next, 1)) < job->nchunks) {
+        size_t begin = chunk * job->grain;
+        size_t end = begin + job->grain < job->n ? begin + job->grain : job->n;
+        job->fn(job->ctx, chunk, begin, end);
+    }
+}
+
+// with pool.lock held
+static void unlink_job(ParallelJob *job) {
+    for (ParallelJob **p = &pool.jobs; *p; p = &(*p)->next_job) {
+        if (*p == job) {
+            *p = job->next_job;
+            return;
+        }
+    }
+}
+
+static void *pool_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (!pool.jobs)
+            pthread_cond_wait(&pool.work, &pool.lock);
+        ParallelJob *job = pool.jobs;
+        if (--job->helpers_left == 0)
+            unlink_job(job);
+        ++job->running;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_chunks(job);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--job->running == 0)
+            pthread_cond_broadcast(&pool.job_done);
+    }
+    return NULL;
+}
+
+// with pool.lock held. spawn failures just leave more chunks for the threads that did start
+static void pool_grow(int n) {
+    for (; pool.nstarted < n; ++pool.nstarted) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_thread, NULL) != 0) {
+            fprintf(stderr, "parallel_for: pthread_create failed, continuing with %d threads\n",
+                    pool.nstarted + 1);
+            return;
+        }
+        pthread_detach(thread);
+    }
+}
+
+void parallel_for(size_t n, size_t grain, parallel_fn fn, void *ctx) {
+    assert(fn && grain);
+    ParallelJob job = {.fn = fn, .ctx = ctx, .n = n, .grain = grain};
+    job.nchunks = (n + grain - 1) / grain;
+    atomic_init(&job.next, 0);
+
+    size_t nworkers = parallel_nthreads();
+    if (nworkers > job.nchunks)
+        nworkers = job.nchunks;
+    if (nworkers <= 1) {
+        run_chunks(&job);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool_grow(nworkers - 1);
+    job.helpers_left = nworkers - 1;
+    job.next_job = pool.jobs;
+    pool.jobs = &job;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_chunks(&job);
+
+    // no new helpers once the chunks ran out, then wait for those still inside fn
+    pthread_mutex_lock(&pool.lock);
+    if (job.helpers_left > 0)
+        unlink_job(&job);
+    while (job.running > 0)
+        pthread_cond_wait(&pool.job_done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
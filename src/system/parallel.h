@@ -0,0 +1,20 @@
+/* parallel.h - minimal fork/join helper over a persistent pthread pool */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <stddef.h>
+
+/** processes the half-open range [begin, end), chunk is the index of that range */
+typedef void (*parallel_fn)(void *ctx, size_t chunk, size_t begin, size_t end);
+
+/**
+ * splits [0, n) into chunks of `grain` items and runs fn over them on up to parallel_nthreads()
+ * threads, the calling thread included. chunk boundaries only depend on n and grain, so work
+ * that derives its state from the chunk index is reproducible for any thread count
+ */
+void parallel_for(size_t n, size_t grain, parallel_fn fn, void *ctx);
+
+/** defaults to the number of online cpus */
+int parallel_nthreads(void);
+void parallel_set_nthreads(int nthreads);
+
+#endif
@@ -0,0 +1,181 @@
+/* png-test.c - PNG_write output decoded with zlib and compared with the image it came from */
+#include "png-test.h"
+#include "png.h"
+#include "random.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// build.sh creates build/, the file is removed again at the end
+#define TEST_FILE "build/selftest.png"
+#define W 53
+#define H 41
+
+static uint32_t get_u32(const uchar *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// undoes the filter of each row in place, rows are 1 + row_bytes apart
+static void unfilter(uchar *data, size_t row_bytes, size_t h, size_t pixel_bytes) {
+    uchar *prev = NULL;
+    for (size_t y = 0; y < h; ++y) {
+        uchar *row = data + y * (row_bytes + 1), type = row[0];
+        uchar *cur = row + 1;
+        assert(type <= PNG_FILTER_PAETH);
+        for (size_t i = 0; i < row_bytes; ++i) {
+            int a = i >= pixel_bytes ? cur[i - pixel_bytes] : 0;
+            int b = prev ? prev[i] : 0;
+            int c = prev && i >= pixel_bytes ? prev[i - pixel_bytes] : 0;
+            int predicted = type == PNG_FILTER_SUB ? a : type == PNG_FILTER_UP ? b
+                          : type == PNG_FILTER_AVERAGE ? (a + b) / 2
+                          : type == PNG_FILTER_PAETH ? paeth(a, b, c) : 0;
+            cur[i] += predicted;
+        }
+        prev = cur;
+    }
+}
+
+/**
+ * reads TEST_FILE, checking the signature, every crc and the zlib stream, and returns its
+ * pixels as RGBA (W x H of them). color_type and bit_depth are set from IHDR
+ */
+static uchar *decode(int *color_type, int *bit_depth) {
+    FILE *fp = fopen(TEST_FILE, "rb");
+    assert(fp);
+    fseek(fp, 0, SEEK_END);
+    size_t n = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uchar *file = malloc(n), *idat = malloc(n);
+    assert(file && idat && fread(file, 1, n, fp) == n);
+    fclose(fp);
+    assert(n > 8 && memcmp(file, "\x89PNG\r\n\x1a\n", 8) == 0);
+
+    uchar palette[256][4];
+    memset(palette, 0xFF, sizeof(palette));
+    size_t nidat = 0, pos = 8;
+    bool ended = false;
+    while (!ended) {
+        assert(pos + 12 <= n);
+        size_t len = get_u32(file + pos);
+        const uchar *type = file + pos + 4, *body = type + 4;
+        assert(pos + 12 + len <= n);
+        assert(crc32(0, type, 4 + len) == get_u32(body + len));
+        if (!memcmp(type, "IHDR", 4)) {
+            assert(get_u32(body) == W && get_u32(body + 4) == H);
+            *bit_depth = body[8];
+            *color_type = body[9];
+        } else if (!memcmp(type, "PLTE", 4)) {
+            for (size_t i = 0; i < len / 3; ++i) {
+                memcpy(palette[i], body + 3 * i, 3);
+            }
+        } else if (!memcmp(type, "tRNS", 4)) {
+            for (size_t i = 0; i < len; ++i) {
+                palette[i][3] = body[i];
+            }
+        } else if (!memcmp(type, "IDAT", 4)) {
+            memcpy(idat + nidat, body, len);
+            nidat += len;
+        } else {
+            ended = !memcmp(type, "IEND", 4);
+        }
+        pos += 12 + len;
+    }
+    assert(pos == n);
+
+    size_t pixel_bits = *color_type == 3 ? *bit_depth : *color_type == 6 ? 32 : 24;
+    size_t row_bytes = (W * pixel_bits + 7) / 8;
+    uLongf raw_size = (row_bytes + 1) * H;
+    uchar *raw = malloc(raw_size + 1);
+    assert(raw && uncompress(raw, &raw_size, idat, nidat) == Z_OK && raw_size == (row_bytes + 1) * H);
+    unfilter(raw, row_bytes, H, pixel_bits < 8 ? 1 : pixel_bits / 8);
+
+    uchar *rgba = malloc(W * H * 4);
+    assert(rgba);
+    for (size_t y = 0; y < H; ++y) {
+        const uchar *row = raw + y * (row_bytes + 1) + 1;
+        for (size_t x = 0; x < W; ++x) {
+            uchar *out = rgba + (y * W + x) * 4;
+            if (*color_type == 3) {
+                size_t bit = x * *bit_depth;
+                int index = row[bit / 8] >> (8 - *bit_depth - bit % 8) & ((1 << *bit_depth) - 1);
+                memcpy(out, palette[index], 4);
+            } else {
+                memcpy(out, row + x * (pixel_bits / 8), pixel_bits / 8);
+                out[3] = pixel_bits == 32 ? out[3] : 0xFF;
+            }
+        }
+    }
+    free(file);
+    free(idat);
+    free(raw);
+    return rgba;
+}
+
+// writes image (BGRA, or BGR with 3 bytes per pixel) and checks what decodes from the file
+static void round_trip(const uchar *pixels, int bytes_per_pixel, const PNG_options *options,
+                       int color_type, int bit_depth) {
+    ImpImage image = {(uchar *)pixels, W, H, {bytes_per_pixel, 2, 1, 0, false}};
+    assert(PNG_write(&image, options, TEST_FILE) == 0);
+    int got_type, got_depth;
+    uchar *rgba = decode(&got_type, &got_depth);
+    assert(got_type == color_type && got_depth == bit_depth);
+    for (size_t i = 0; i < W * H; ++i) {
+        const uchar *p = pixels + i * bytes_per_pixel;
+        uchar alpha = bytes_per_pixel == 4 ? p[3] : 0xFF;
+        assert(rgba[4 * i] == p[2] && rgba[4 * i + 1] == p[1] && rgba[4 * i + 2] == p[0]);
+        assert(rgba[4 * i + 3] == alpha);
+    }
+    free(rgba);
+}
+
+int png_selftest(void) {
+    uchar *pixels = malloc(W * H * 4);
+    assert(pixels);
+    ImpRng rng;
+    rng_seed(&rng, 40);
+
+    // truecolor: every filter, stored to best compression, one or many deflate chunks
+    for (size_t i = 0; i < W * H * 4; ++i) {
+        pixels[i] = i % 4 == 3 ? 0xFF : (uchar)(rng_next(&rng) % 64 + i / (W * 4));
+    }
+    for (int filter = PNG_FILTER_NONE; filter <= PNG_FILTER_ADAPTIVE; ++filter) {
+        for (int level = 0; level <= 9; level += 3) {
+            PNG_options options = {level, filter, 0, level % 2 ? 1 : 500};
+            round_trip(pixels, 3, &options, 2, 8);
+            round_trip(pixels, 4, &options, 2, 8);   // opaque, so written as RGB
+        }
+    }
+    pixels[4 * 7 + 3] = 0x80;
+    round_trip(pixels, 4, NULL, 6, 8);
+
+    // indexed at every bit depth, a translucent color gives a tRNS chunk
+    const int ncolors[] = {2, 4, 16, 200};
+    const int depths[] = {1, 2, 4, 8};
+    for (int k = 0; k < 4; ++k) {
+        uint32_t palette[200];
+        for (int i = 0; i < ncolors[k]; ++i) {
+            palette[i] = (uint32_t)rng_next(&rng) | 0xFF000000;
+        }
+        palette[ncolors[k] - 1] &= 0x40FFFFFF;
+        for (size_t i = 0; i < W * H; ++i) {
+            // every color used at least once
+            uint32_t c = palette[i < (size_t)ncolors[k] ? i : rng_next(&rng) % ncolors[k]];
+            memcpy(pixels + 4 * i, &c, 4);
+        }
+        PNG_options options = PNG_DEFAULT_OPTIONS;
+        options.chunk_bytes = 100;
+        round_trip(pixels, 4, &options, 3, depths[k]);
+    }
+
+    remove(TEST_FILE);
+    free(pixels);
+    return 1;
+}
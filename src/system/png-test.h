@@ -0,0 +1,8 @@
+/* png-test.h - tests for the PNG encoder */
+#ifndef PNG_TEST_H
+#define PNG_TEST_H
+
+/** asserts on failure, returns 1 when every case passed */
+int png_selftest(void);
+
+#endif
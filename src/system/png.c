@@ -0,0 +1,428 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "png.h"
+#include "arena.h"
+#include "parallel.h"
+
+#define PNG_RGB 2
+#define PNG_INDEXED 3
+#define PNG_RGBA 6
+#define COLOR_SLOTS 512     // open addressing, at least twice the largest palette
+#define DICT_BYTES 32768    // deflate window
+
+const PNG_options PNG_DEFAULT_OPTIONS = {
+    .level = 3, .filter = PNG_FILTER_ADAPTIVE, .max_palette = 256, .chunk_bytes = 256 * 1024,
+};
+
+static const uchar signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+/** colors of an image as 0xRRGGBBAA and their palette index */
+typedef struct {
+    uint32_t keys[COLOR_SLOTS];
+    uint16_t index[COLOR_SLOTS];
+    uchar used[COLOR_SLOTS];
+    uint32_t palette[256];
+    size_t ncolors;
+} ColorSet;
+
+/** output of one chunk of rows: a piece of the shared zlib stream */
+typedef struct {
+    uchar *data;
+    size_t size;
+    uLong adler;
+    size_t raw_size;
+} Chunk;
+
+typedef struct {
+    const ImpImage *image;
+    const PNG_options *options;
+    size_t r, g, b, a;          // byte offsets within an input pixel
+    int color_type;
+    int bit_depth;
+    size_t pixel_bytes;         // distance used by the sub, average and paeth filters
+    size_t row_bytes;           // a row without its filter type byte
+    ColorSet colors;
+    size_t rows_per_chunk, nchunks;
+    Chunk *chunks;
+    int failed;
+} Encoder;
+
+static void put_u32(uchar *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static size_t color_slot(const ColorSet *set, uint32_t key) {
+    size_t slot = (key * 2654435761u) >> (32 - 9);
+    while (set->used[slot] && set->keys[slot] != key)
+        slot = (slot + 1) & (COLOR_SLOTS - 1);
+    return slot;
+}
+
+static uint32_t pixel_key(const Encoder *enc, const uchar *p) {
+    uint32_t alpha = enc->image->format.bytes_per_pixel == 4 ? p[enc->a] : 0xFF;
+    return (uint32_t)p[enc->r] << 24 | (uint32_t)p[enc->g] << 16 | (uint32_t)p[enc->b] << 8 | alpha;
+}
+
+/**
+ * picks the color type: indexed while the distinct colors fit in max_palette, else RGB when
+ * every pixel is opaque and RGBA otherwise
+ */
+static void scan_colors(Encoder *enc) {
+    const ImpImage *image = enc->image;
+    size_t bpp = image->format.bytes_per_pixel;
+    size_t npixels = image->width * image->height;
+    size_t max_colors = enc->options->max_palette > 256 ? 256 : enc->options->max_palette;
+    ColorSet *set = &enc->colors;
+    int indexed = max_colors > 0, opaque = 1;
+    uint32_t last = 0;
+
+    for (size_t i = 0; i < npixels && (indexed || opaque); ++i) {
+        uint32_t key = pixel_key(enc, image->pixels + i * bpp);
+        opaque &= (key & 0xFF) == 0xFF;
+        if (!indexed || (i > 0 && key == last))
+            continue;
+        last = key;
+        size_t slot = color_slot(set, key);
+        if (set->used[slot])
+            continue;
+        if (set->ncolors == max_colors) {
+            indexed = 0;
+            continue;
+        }
+        set->used[slot] = 1;
+        set->keys[slot] = key;
+        set->index[slot] = set->ncolors;
+        set->palette[set->ncolors++] = key;
+    }
+
+    if (indexed) {
+        enc->color_type = PNG_INDEXED;
+        size_t n = set->ncolors;
+        enc->bit_depth = n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+        enc->pixel_bytes = 1;
+        enc->row_bytes = (image->width * enc->bit_depth + 7) / 8;
+    } else {
+        enc->color_type = bpp == 4 && !opaque ? PNG_RGBA : PNG_RGB;
+        enc->bit_depth = 8;
+        enc->pixel_bytes = enc->color_type == PNG_RGBA ? 4 : 3;
+        enc->row_bytes = image->width * enc->pixel_bytes;
+    }
+}
+
+// row y of the image in png sample order, without filtering
+static void pack_row(const Encoder *enc, size_t y, uchar *dst) {
+    const ImpImage *image = enc->image;
+    size_t bpp = image->format.bytes_per_pixel;
+    const uchar *src = image->pixels + y * image->width * bpp;
+
+    if (enc->color_type == PNG_INDEXED) {
+        int depth = enc->bit_depth;
+        memset(dst, 0, enc->row_bytes);
+        uint32_t last = ~pixel_key(enc, src);
+        size_t index = 0;
+        for (size_t x = 0; x < image->width; ++x, src += bpp) {
+            uint32_t key = pixel_key(enc, src);
+            if (key != last) {
+                index = enc->colors.index[color_slot(&enc->colors, key)];
+                last = key;
+            }
+            size_t bit = x * depth;
+            dst[bit / 8] |= index << (8 - depth - bit % 8);
+        }
+    } else if (enc->color_type == PNG_RGBA) {
+        for (size_t x = 0; x < image->width; ++x, src += bpp, dst += 4) {
+            dst[0] = src[enc->r];
+            dst[1] = src[enc->g];
+            dst[2] = src[enc->b];
+            dst[3] = src[enc->a];
+        }
+    } else {
+        for (size_t x = 0; x < image->width; ++x, src += bpp, dst += 3) {
+            dst[0] = src[enc->r];
+            dst[1] = src[enc->g];
+            dst[2] = src[enc->b];
+        }
+    }
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// out[i] = residual of cur[i] for one filter type
+static void apply_row_filter(int type, const uchar *cur, const uchar *prev, size_t n, size_t bpp, uchar *out) {
+    size_t i = 0;
+    switch (type) {
+    case PNG_FILTER_SUB:
+        for (; i < bpp; ++i)
+            out[i] = cur[i];
+        for (; i < n; ++i)
+            out[i] = cur[i] - cur[i - bpp];
+        break;
+    case PNG_FILTER_UP:
+        for (; i < n; ++i)
+            out[i] = cur[i] - prev[i];
+        break;
+    case PNG_FILTER_AVERAGE:
+        for (; i < bpp; ++i)
+            out[i] = cur[i] - prev[i] / 2;
+        for (; i < n; ++i)
+            out[i] = cur[i] - (cur[i - bpp] + prev[i]) / 2;
+        break;
+    case PNG_FILTER_PAETH:
+        for (; i < bpp; ++i)
+            out[i] = cur[i] - prev[i];
+        for (; i < n; ++i)
+            out[i] = cur[i] - paeth(cur[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    default:
+        memcpy(out, cur, n);
+        break;
+    }
+}
+
+// residuals read as signed bytes, the smallest absolute sum tends to deflate best
+static size_t residual_sum(const uchar *res, size_t n) {
+    size_t sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += abs((signed char)res[i]);
+    return sum;
+}
+
+/**
+ * writes the filter type byte and the filtered row to out. the adaptive choice tries every
+ * type in scratch (one row) and keeps the best in out
+ */
+static void filter_row(const Encoder *enc, const uchar *cur, const uchar *prev, uchar *scratch, uchar *out) {
+    size_t n = enc->row_bytes, bpp = enc->pixel_bytes;
+    int type = enc->color_type == PNG_INDEXED ? PNG_FILTER_NONE : (int)enc->options->filter;
+    if (type != PNG_FILTER_ADAPTIVE) {
+        out[0] = type;
+        apply_row_filter(type, cur, prev, n, bpp, out + 1);
+        return;
+    }
+
+    out[0] = PNG_FILTER_NONE;
+    memcpy(out + 1, cur, n);
+    size_t best = residual_sum(cur, n);
+    for (int f = PNG_FILTER_SUB; f <= PNG_FILTER_PAETH; ++f) {
+        apply_row_filter(f, cur, prev, n, bpp, scratch);
+        size_t sum = residual_sum(scratch, n);
+        if (sum < best) {
+            best = sum;
+            out[0] = f;
+            memcpy(out + 1, scratch, n);
+        }
+    }
+}
+
+// filtered rows [y0, y1) into out, rows is scratch for three rows
+static void filter_rows(const Encoder *enc, size_t y0, size_t y1, uchar *rows, uchar *out) {
+    uchar *prev = rows, *cur = rows + enc->row_bytes, *scratch = rows + 2 * enc->row_bytes;
+    if (y0 > 0)
+        pack_row(enc, y0 - 1, prev);
+    else
+        memset(prev, 0, enc->row_bytes);
+    for (size_t y = y0; y < y1; ++y, out += enc->row_bytes + 1) {
+        pack_row(enc, y, cur);
+        filter_row(enc, cur, prev, scratch, out);
+        uchar *t = prev;
+        prev = cur;
+        cur = t;
+    }
+}
+
+/**
+ * deflates one chunk of rows as a raw stream. all but the last end on a sync flush so the
+ * pieces concatenate into one stream, and each is primed with the rows before it as
+ * dictionary so matches still reach back across chunk boundaries
+ */
+static void deflate_chunk(void *ctx, size_t index, size_t begin, size_t end) {
+    (void) begin;
+    (void) end;
+    Encoder *enc = ctx;
+    Chunk *chunk = &enc->chunks[index];
+    size_t stride = enc->row_bytes + 1, h = enc->image->height;
+    size_t y0 = index * enc->rows_per_chunk;
+    size_t y1 = y0 + enc->rows_per_chunk < h ? y0 + enc->rows_per_chunk : h;
+    size_t dict_rows = y0 < (DICT_BYTES + stride - 1) / stride ? y0 : (DICT_BYTES + stride - 1) / stride;
+    int last = y1 == h;
+
+    ImpArena *arena = arena_thread();
+    ArenaMark mark = arena_mark(arena);
+    uchar *rows = arena_alloc(arena, 3 * enc->row_bytes);
+    uchar *raw = arena_alloc(arena, (dict_rows + y1 - y0) * stride);
+    z_stream zs = {0};
+    int status = rows && raw ? deflateInit2(&zs, enc->options->level, Z_DEFLATED, -15, 8,
+                                            enc->color_type == PNG_INDEXED ? Z_DEFAULT_STRATEGY
+                                                                           : Z_FILTERED)
+                             : Z_MEM_ERROR;
+    if (status != Z_OK) {
+        enc->failed = 1;
+        arena_release(arena, mark);
+        return;
+    }
+
+    filter_rows(enc, y0 - dict_rows, y1, rows, raw);
+    uchar *data = raw + dict_rows * stride;
+    chunk->raw_size = (y1 - y0) * stride;
+    chunk->adler = adler32(1, data, chunk->raw_size);
+    size_t dict_size = dict_rows * stride;
+    if (dict_size > DICT_BYTES)
+        dict_size = DICT_BYTES;
+    if (dict_size)
+        deflateSetDictionary(&zs, data - dict_size, dict_size);
+
+    // a sync flush adds an empty stored block on top of the bound
+    size_t cap = deflateBound(&zs, chunk->raw_size) + 16;
+    if ((chunk->data = malloc(cap))) {
+        zs.next_in = data;
+        zs.avail_in = chunk->raw_size;
+        zs.next_out = chunk->data;
+        zs.avail_out = cap;
+        status = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        chunk->size = cap - zs.avail_out;
+        if (status != (last ? Z_STREAM_END : Z_OK) || zs.avail_in != 0)
+            enc->failed = 1;
+    } else {
+        enc->failed = 1;
+    }
+    deflateEnd(&zs);
+    arena_release(arena, mark);
+}
+
+// chunk of the png format: length, type, the concatenated parts and a crc of type and parts
+static int write_chunk(FILE *fp, const char *type, const uchar **parts, const size_t *sizes, size_t nparts) {
+    uchar head[8];
+    size_t length = 0;
+    for (size_t i = 0; i < nparts; ++i)
+        length += sizes[i];
+    put_u32(head, length);
+    memcpy(head + 4, type, 4);
+    uLong crc = crc32(0, head + 4, 4);
+    int ok = fwrite(head, 1, 8, fp) == 8;
+    for (size_t i = 0; i < nparts; ++i) {
+        crc = crc32(crc, parts[i], sizes[i]);
+        ok &= fwrite(parts[i], 1, sizes[i], fp) == sizes[i];
+    }
+    uchar tail[4];
+    put_u32(tail, crc);
+    ok &= fwrite(tail, 1, 4, fp) == 4;
+    return ok ? 0 : -1;
+}
+
+static int write_file(const Encoder *enc, const char *dest) {
+    FILE *fp = fopen(dest, "wb");
+    if (!fp) {
+        fprintf(stderr, "PNG_write: could not open '%s'\n", dest);
+        return -1;
+    }
+    int status = fwrite(signature, 1, sizeof(signature), fp) == sizeof(signature) ? 0 : -1;
+
+    uchar ihdr[13] = {0};
+    put_u32(ihdr, enc->image->width);
+    put_u32(ihdr + 4, enc->image->height);
+    ihdr[8] = enc->bit_depth;
+    ihdr[9] = enc->color_type;
+    status |= write_chunk(fp, "IHDR", (const uchar *[]){ihdr}, (size_t[]){13}, 1);
+
+    if (enc->color_type == PNG_INDEXED) {
+        uchar plte[3 * 256], trns[256];
+        size_t ntrns = 0;
+        for (size_t i = 0; i < enc->colors.ncolors; ++i) {
+            uint32_t c = enc->colors.palette[i];
+            plte[3 * i] = c >> 24;
+            plte[3 * i + 1] = c >> 16;
+            plte[3 * i + 2] = c >> 8;
+            trns[i] = c;
+            if (trns[i] != 0xFF)
+                ntrns = i + 1;
+        }
+        status |= write_chunk(fp, "PLTE", (const uchar *[]){plte}, (size_t[]){3 * enc->colors.ncolors}, 1);
+        if (ntrns)
+            status |= write_chunk(fp, "tRNS", (const uchar *[]){trns}, (size_t[]){ntrns}, 1);
+    }
+
+    // one IDAT per chunk, the zlib header goes in front of the first and the adler32 after the last
+    int level = enc->options->level;
+    uchar zhead[2] = {0x78, (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6};
+    zhead[1] += 31 - (zhead[0] * 256 + zhead[1]) % 31;
+    uLong adler = 1;
+    for (size_t i = 0; i < enc->nchunks; ++i)
+        adler = adler32_combine(adler, enc->chunks[i].adler, enc->chunks[i].raw_size);
+    uchar ztail[4];
+    put_u32(ztail, adler);
+    for (size_t i = 0; i < enc->nchunks && status == 0; ++i) {
+        const uchar *parts[3];
+        size_t sizes[3], n = 0;
+        if (i == 0) {
+            parts[n] = zhead;
+            sizes[n++] = 2;
+        }
+        parts[n] = enc->chunks[i].data;
+        sizes[n++] = enc->chunks[i].size;
+        if (i + 1 == enc->nchunks) {
+            parts[n] = ztail;
+            sizes[n++] = 4;
+        }
+        status |= write_chunk(fp, "IDAT", parts, sizes, n);
+    }
+    status |= write_chunk(fp, "IEND", NULL, NULL, 0);
+
+    if (fclose(fp) != 0 || status != 0) {
+        fprintf(stderr, "PNG_write: could not write '%s'\n", dest);
+        return -1;
+    }
+    return 0;
+}
+
+int PNG_write(const ImpImage *image, const PNG_options *options, const char *dest) {
+    assert(image && image->pixels && dest);
+    const ImpPixelFormat *fmt = &image->format;
+    if (fmt->planar || (fmt->bytes_per_pixel != 3 && fmt->bytes_per_pixel != 4) ||
+        image->width == 0 || image->height == 0) {
+        fprintf(stderr, "PNG_write: unsupported image\n");
+        return -1;
+    }
+
+    Encoder *enc = calloc(1, sizeof(Encoder));
+    if (!enc)
+        return -1;
+    enc->image = image;
+    enc->options = options ? options : &PNG_DEFAULT_OPTIONS;
+    enc->r = fmt->red;
+    enc->g = fmt->green;
+    enc->b = fmt->blue;
+    enc->a = 6 - fmt->red - fmt->green - fmt->blue;   // the byte left over in 4 byte pixels
+    scan_colors(enc);
+
+    size_t chunk_bytes = enc->options->chunk_bytes ? enc->options->chunk_bytes : SIZE_MAX;
+    enc->rows_per_chunk = chunk_bytes / (enc->row_bytes + 1);
+    if (enc->rows_per_chunk == 0)
+        enc->rows_per_chunk = 1;
+    if (enc->rows_per_chunk > image->height)
+        enc->rows_per_chunk = image->height;
+    enc->nchunks = (image->height + enc->rows_per_chunk - 1) / enc->rows_per_chunk;
+
+    int status = -1;
+    if ((enc->chunks = calloc(enc->nchunks, sizeof(Chunk)))) {
+        parallel_for(enc->nchunks, 1, deflate_chunk, enc);
+        if (enc->failed)
+            fprintf(stderr, "PNG_write: compression failed\n");
+        else
+            status = write_file(enc, dest);
+        for (size_t i = 0; i < enc->nchunks; ++i)
+            free(enc->chunks[i].data);
+        free(enc->chunks);
+    }
+    free(enc);
+    return status;
+}
@@ -0,0 +1,36 @@
+/** png.h - PNG encoding with parallel deflate */
+#ifndef PNG_H
+#define PNG_H
+
+#include <stddef.h>
+#include "image.h"
+
+// PNG_options::filter, the first five are the per-row filter types of the format
+typedef enum {
+    PNG_FILTER_NONE,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE,
+    PNG_FILTER_PAETH,
+    PNG_FILTER_ADAPTIVE,    // per row, the filter with the smallest sum of absolute residuals
+} PNG_filter;
+
+typedef struct {
+    int level;              // zlib compression level, 0 (store) to 9
+    PNG_filter filter;      // truecolor images only, indexed rows are never filtered
+    int max_palette;        // indexed png when the image has at most this many colors, 0 for never
+    size_t chunk_bytes;     // uncompressed bytes per independently deflated chunk of rows
+} PNG_options;
+
+/** level 3, adaptive filtering, indexed up to 256 colors and 256KB chunks */
+extern const PNG_options PNG_DEFAULT_OPTIONS;
+
+/**
+ * writes a packed 3 or 4 byte per pixel image. 4 byte images are written as RGBA unless every
+ * alpha byte is 255. chunks of rows are filtered and deflated on all threads and joined into a
+ * single zlib stream, at a slight cost in ratio against one serial stream.
+ * options may be NULL for the defaults, returns 0 or -1
+ */
+int PNG_write(const ImpImage *image, const PNG_options *options, const char *dest);
+
+#endif
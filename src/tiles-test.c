@@ -0,0 +1,107 @@
+/* tiles-test.c - random writes and reads of a tiled canvas checked against a flat copy */
+#include "tiles-test.h"
+#include "tiles.h"
+#include "random.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// not a multiple of the tile size, so edge tiles are partial
+#define W 3000
+#define H 2000
+#define WRITES 100
+#define BACKGROUND 0xFFFFFFFF
+#define COLS ((W + IMP_TILE_SIZE - 1) / IMP_TILE_SIZE)
+#define ROWS ((H + IMP_TILE_SIZE - 1) / IMP_TILE_SIZE)
+
+static SDL_Rect random_rect(ImpRng *rng, int max_side) {
+    SDL_Rect r = {rng_next(rng) % W, rng_next(rng) % H, 1 + rng_next(rng) % max_side, 1 + rng_next(rng) % max_side};
+    r.w = SDL_min(r.w, W - r.x);
+    r.h = SDL_min(r.h, H - r.y);
+    return r;
+}
+
+int tiles_selftest(void) {
+    ImpTiles *tiles = create_imp_tiles(W, H, 0, BACKGROUND);
+    uint32_t *flat = malloc((size_t)W * H * 4);
+    uint32_t *buf = malloc((size_t)W * H * 4);
+    assert(tiles && flat && buf);
+    ImpRng rng;
+    rng_seed(&rng, 50);
+    for (size_t i = 0; i < (size_t)W * H; ++i) {
+        flat[i] = BACKGROUND;
+    }
+
+    assert(!create_imp_tiles(0, H, 0, BACKGROUND));
+    assert(!create_imp_tiles(IMP_TILES_MAX_SIZE + 1, H, 0, BACKGROUND));
+    assert(imp_tiles_width(tiles) == W && imp_tiles_height(tiles) == H);
+
+    // nothing painted: no memory, no bounds, and background writes keep it that way
+    SDL_Rect bounds;
+    assert(imp_tiles_bytes(tiles) == 0);
+    assert(!imp_tiles_painted(tiles, &bounds));
+    assert(imp_tiles_write(tiles, (SDL_Rect){0, 0, W, H}, flat, W) == 0);
+    assert(imp_tiles_bytes(tiles) == 0);
+
+    // one pixel allocates one tile, the same pixel as background again frees nothing
+    assert(imp_tiles_write(tiles, (SDL_Rect){0, 0, 1, 1}, &(uint32_t){0}, 1) == 0);
+    size_t tile_bytes = imp_tiles_bytes(tiles);
+    assert(tile_bytes >= IMP_TILE_SIZE * IMP_TILE_SIZE * 4);
+    assert(imp_tiles_write(tiles, (SDL_Rect){0, 0, 1, 1}, flat, 1) == 0);
+    assert(imp_tiles_bytes(tiles) == tile_bytes);
+    bool painted[COLS * ROWS] = {true};
+
+    for (int k = 0; k < WRITES; ++k) {
+        SDL_Rect r = random_rect(&rng, 300);
+        // some writes are background only, wherever they land
+        uint32_t color = k % 5 ? (uint32_t)rng_next(&rng) & 0xFF7FFFFF : BACKGROUND;
+        for (int y = 0; y < r.h; ++y) {
+            for (int x = 0; x < r.w; ++x) {
+                uint32_t px = color == BACKGROUND ? color : color ^ (x & 2);
+                buf[y * r.w + x] = px;
+                flat[(size_t)(r.y + y) * W + r.x + x] = px;
+            }
+        }
+        assert(imp_tiles_write(tiles, r, buf, r.w) == 0);
+        for (int ty = r.y / IMP_TILE_SIZE; ty <= (r.y + r.h - 1) / IMP_TILE_SIZE; ++ty) {
+            for (int tx = r.x / IMP_TILE_SIZE; tx <= (r.x + r.w - 1) / IMP_TILE_SIZE; ++tx) {
+                painted[ty * COLS + tx] |= color != BACKGROUND;
+            }
+        }
+
+        // reads of any rect, with a stride wider than it, match the flat copy
+        SDL_Rect q = random_rect(&rng, 600);
+        size_t stride = q.w + 7;
+        imp_tiles_read(tiles, q, buf, stride);
+        for (int y = 0; y < q.h; ++y) {
+            assert(memcmp(buf + y * stride, flat + (size_t)(q.y + y) * W + q.x, q.w * 4) == 0);
+        }
+    }
+
+    imp_tiles_read(tiles, (SDL_Rect){0, 0, W, H}, buf, W);
+    assert(memcmp(buf, flat, (size_t)W * H * 4) == 0);
+    int x0 = W, y0 = H, x1 = -1, y1 = -1;
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            if (flat[(size_t)y * W + x] != BACKGROUND) {
+                x0 = SDL_min(x0, x);
+                x1 = SDL_max(x1, x);
+                y0 = SDL_min(y0, y);
+                y1 = SDL_max(y1, y);
+            }
+        }
+    }
+    assert(imp_tiles_painted(tiles, &bounds));
+    assert(bounds.x == x0 && bounds.y == y0 && bounds.w == x1 - x0 + 1 && bounds.h == y1 - y0 + 1);
+    // a tile is allocated once something other than background was written to it
+    size_t allocated = 0;
+    for (int i = 0; i < COLS * ROWS; ++i) {
+        allocated += painted[i];
+    }
+    assert(imp_tiles_bytes(tiles) == allocated * tile_bytes);
+
+    imp_tiles_free(tiles);
+    free(flat);
+    free(buf);
+    return 1;
+}
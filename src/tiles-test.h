@@ -0,0 +1,8 @@
+/* tiles-test.h - tests for the sparse tiled canvas */
+#ifndef TILES_TEST_H
+#define TILES_TEST_H
+
+/** asserts on failure, returns 1 when every case passed */
+int tiles_selftest(void);
+
+#endif
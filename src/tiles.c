@@ -0,0 +1,321 @@
+#include "tiles.h"
+#include "vector.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TILE IMP_TILE_SIZE
+// mip levels of a tile, from TILE x TILE down to 1 x 1
+#define LEVELS 9
+// pixels of a tile and all of its mip levels, TILE^2 + (TILE/2)^2 + ... + 1
+#define TILE_PIXELS ((TILE * TILE * 4 - 1) / 3)
+
+typedef struct {
+    uint32_t *pixels;       // level 0 then every mip level, NULL while the tile is all background
+    int mips;               // levels up to this one match level 0
+    SDL_Texture *texture;   // of mip level `level`, NULL while out of view
+    int level;
+    SDL_Rect stale;         // written since the texture was last uploaded, level 0 coordinates
+    uint32_t frame;         // last frame the tile was drawn in
+} Tile;
+
+struct ImpTiles {
+    int w, h;
+    int cols, rows;
+    uint32_t format, background;
+    Tile *tiles;
+    size_t allocated;       // tiles with pixels
+    U32Vec shown;           // tiles holding a texture
+    SDL_Texture *fill;      // 1 x 1 of the background, stretched under the allocated tiles
+    uint32_t frame;
+};
+
+static int max(int a, int b) { return a > b ? a : b; }
+
+static int min(int a, int b) { return a < b ? a : b; }
+
+static size_t level_offset(int level) {
+    size_t offset = 0;
+    for (int l = 0; l < level; ++l) {
+        offset += (size_t)(TILE >> l) * (TILE >> l);
+    }
+    return offset;
+}
+
+ImpTiles *create_imp_tiles(int w, int h, uint32_t format, uint32_t background) {
+    if (w <= 0 || h <= 0 || w > IMP_TILES_MAX_SIZE || h > IMP_TILES_MAX_SIZE) {
+        return NULL;
+    }
+    ImpTiles *tiles = calloc(1, sizeof(ImpTiles));
+    if (!tiles) {
+        return NULL;
+    }
+    tiles->w = w;
+    tiles->h = h;
+    tiles->cols = (w + TILE - 1) / TILE;
+    tiles->rows = (h + TILE - 1) / TILE;
+    tiles->format = format;
+    tiles->background = background;
+    tiles->tiles = calloc((size_t)tiles->cols * tiles->rows, sizeof(Tile));
+    if (!tiles->tiles) {
+        free(tiles);
+        return NULL;
+    }
+    U32Vec_init(&tiles->shown);
+    return tiles;
+}
+
+void imp_tiles_free(ImpTiles *tiles) {
+    if (!tiles) {
+        return;
+    }
+    for (size_t i = 0; i < tiles->shown.size; ++i) {
+        SDL_DestroyTexture(tiles->tiles[tiles->shown.arr[i]].texture);
+    }
+    for (size_t i = 0; i < (size_t)tiles->cols * tiles->rows; ++i) {
+        free(tiles->tiles[i].pixels);
+    }
+    U32Vec_free(&tiles->shown);
+    SDL_DestroyTexture(tiles->fill);
+    free(tiles->tiles);
+    free(tiles);
+}
+
+int imp_tiles_width(const ImpTiles *tiles) { return tiles->w; }
+
+int imp_tiles_height(const ImpTiles *tiles) { return tiles->h; }
+
+size_t imp_tiles_bytes(const ImpTiles *tiles) {
+    return tiles->allocated * TILE_PIXELS * sizeof(uint32_t);
+}
+
+static bool all_background(const uint32_t *src, size_t stride, int w, int h, uint32_t background) {
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            if (src[y * stride + x] != background) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static int tile_alloc(ImpTiles *tiles, Tile *tile) {
+    tile->pixels = malloc(TILE_PIXELS * sizeof(uint32_t));
+    if (!tile->pixels) {
+        return -1;
+    }
+    for (size_t i = 0; i < TILE_PIXELS; ++i) {
+        tile->pixels[i] = tiles->background;
+    }
+    tile->mips = LEVELS - 1;
+    tiles->allocated++;
+    return 0;
+}
+
+// the part of tile (tx, ty) inside area, in canvas coordinates
+static SDL_Rect tile_part(int tx, int ty, SDL_Rect area) {
+    SDL_Rect r = {tx * TILE, ty * TILE, TILE, TILE};
+    SDL_IntersectRect(&r, &area, &r);
+    return r;
+}
+
+int imp_tiles_write(ImpTiles *tiles, SDL_Rect area, const uint32_t *src, size_t stride) {
+    int result = 0;
+    for (int ty = area.y / TILE; ty <= (area.y + area.h - 1) / TILE; ++ty) {
+        for (int tx = area.x / TILE; tx <= (area.x + area.w - 1) / TILE; ++tx) {
+            Tile *tile = &tiles->tiles[ty * tiles->cols + tx];
+            SDL_Rect r = tile_part(tx, ty, area);
+            const uint32_t *from = src + (size_t)(r.y - area.y) * stride + (r.x - area.x);
+            // writing the background over a tile that was never painted changes nothing
+            if (!tile->pixels && all_background(from, stride, r.w, r.h, tiles->background)) {
+                continue;
+            }
+            if (!tile->pixels && tile_alloc(tiles, tile) != 0) {
+                result = -1;
+                continue;
+            }
+            SDL_Rect local = {r.x - tx * TILE, r.y - ty * TILE, r.w, r.h};
+            for (int y = 0; y < r.h; ++y) {
+                memcpy(tile->pixels + (size_t)(local.y + y) * TILE + local.x, from + y * stride,
+                       r.w * sizeof(uint32_t));
+            }
+            SDL_UnionRect(&tile->stale, &local, &tile->stale);
+            tile->mips = 0;
+        }
+    }
+    return result;
+}
+
+void imp_tiles_read(const ImpTiles *tiles, SDL_Rect area, uint32_t *dest, size_t stride) {
+    for (int ty = area.y / TILE; ty <= (area.y + area.h - 1) / TILE; ++ty) {
+        for (int tx = area.x / TILE; tx <= (area.x + area.w - 1) / TILE; ++tx) {
+            const Tile *tile = &tiles->tiles[ty * tiles->cols + tx];
+            SDL_Rect r = tile_part(tx, ty, area);
+            uint32_t *to = dest + (size_t)(r.y - area.y) * stride + (r.x - area.x);
+            for (int y = 0; y < r.h; ++y) {
+                if (tile->pixels) {
+                    const uint32_t *row = tile->pixels + (size_t)(r.y - ty * TILE + y) * TILE;
+                    memcpy(to + y * stride, row + (r.x - tx * TILE), r.w * sizeof(uint32_t));
+                    continue;
+                }
+                for (int x = 0; x < r.w; ++x) {
+                    to[y * stride + x] = tiles->background;
+                }
+            }
+        }
+    }
+}
+
+bool imp_tiles_painted(const ImpTiles *tiles, SDL_Rect *bounds) {
+    int x0 = tiles->w, y0 = tiles->h, x1 = -1, y1 = -1;
+    for (int ty = 0; ty < tiles->rows; ++ty) {
+        for (int tx = 0; tx < tiles->cols; ++tx) {
+            const uint32_t *pixels = tiles->tiles[ty * tiles->cols + tx].pixels;
+            if (!pixels) {
+                continue;
+            }
+            int w = min(TILE, tiles->w - tx * TILE), h = min(TILE, tiles->h - ty * TILE);
+            for (int y = 0; y < h; ++y) {
+                for (int x = 0; x < w; ++x) {
+                    if (pixels[y * TILE + x] != tiles->background) {
+                        x0 = min(x0, tx * TILE + x);
+                        x1 = max(x1, tx * TILE + x);
+                        y0 = min(y0, ty * TILE + y);
+                        y1 = max(y1, ty * TILE + y);
+                    }
+                }
+            }
+        }
+    }
+    if (x1 < 0) {
+        return false;
+    }
+    *bounds = (SDL_Rect){x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+    return true;
+}
+
+// average of 4 pixels per byte, rounded, with two bytes of each in separate 16-bit lanes
+static uint32_t average4(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint32_t rb = (a & 0x00FF00FF) + (b & 0x00FF00FF) + (c & 0x00FF00FF) + (d & 0x00FF00FF);
+    uint32_t ag = ((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF) + ((c >> 8) & 0x00FF00FF) +
+                  ((d >> 8) & 0x00FF00FF);
+    rb = ((rb + 0x00020002) >> 2) & 0x00FF00FF;
+    ag = ((ag + 0x00020002) >> 2) & 0x00FF00FF;
+    return rb | ag << 8;
+}
+
+// box filters the levels above tile->mips up to level, each from the one below it
+static void build_mips(Tile *tile, int level) {
+    for (int l = tile->mips + 1; l <= level; ++l) {
+        int size = TILE >> l;
+        const uint32_t *src = tile->pixels + level_offset(l - 1);
+        uint32_t *dest = tile->pixels + level_offset(l);
+        for (int y = 0; y < size; ++y) {
+            const uint32_t *r0 = src + (size_t)2 * y * 2 * size, *r1 = r0 + 2 * size;
+            for (int x = 0; x < size; ++x) {
+                dest[y * size + x] = average4(r0[2 * x], r0[2 * x + 1], r1[2 * x], r1[2 * x + 1]);
+            }
+        }
+    }
+    tile->mips = max(tile->mips, level);
+}
+
+// brings the texture of tile at level up to date, creating it if needed
+static int tile_upload(SDL_Renderer *renderer, ImpTiles *tiles, uint32_t index, int level) {
+    Tile *tile = &tiles->tiles[index];
+    bool listed = tile->texture != NULL, full = false;
+    if (tile->texture && tile->level != level) {
+        SDL_DestroyTexture(tile->texture);
+        tile->texture = NULL;
+    }
+    if (!tile->texture) {
+        int size = TILE >> level;
+        tile->texture = SDL_CreateTexture(renderer, tiles->format, SDL_TEXTUREACCESS_STATIC, size, size);
+        if (!tile->texture || (!listed && U32Vec_push(&tiles->shown, index) != 0)) {
+            SDL_DestroyTexture(tile->texture);
+            tile->texture = NULL;
+            // a texture already in the list is dropped from it with the hidden ones
+            return -1;
+        }
+        SDL_SetTextureBlendMode(tile->texture, SDL_BLENDMODE_BLEND);
+        tile->level = level;
+        full = true;
+    }
+    if (!full && SDL_RectEmpty(&tile->stale)) {
+        return 0;
+    }
+    if (level == 0 && !full) {
+        SDL_Rect *r = &tile->stale;
+        SDL_UpdateTexture(tile->texture, r, tile->pixels + (size_t)r->y * TILE + r->x, TILE * 4);
+    } else {
+        build_mips(tile, level);
+        SDL_UpdateTexture(tile->texture, NULL, tile->pixels + level_offset(level), (TILE >> level) * 4);
+    }
+    tile->stale = (SDL_Rect){0};
+    return 0;
+}
+
+// textures of tiles that were not drawn this frame are released, so they follow the view
+static void drop_hidden(ImpTiles *tiles) {
+    size_t kept = 0;
+    for (size_t i = 0; i < tiles->shown.size; ++i) {
+        Tile *tile = &tiles->tiles[tiles->shown.arr[i]];
+        if (tile->texture && tile->frame == tiles->frame) {
+            tiles->shown.arr[kept++] = tiles->shown.arr[i];
+            continue;
+        }
+        SDL_DestroyTexture(tile->texture);
+        tile->texture = NULL;
+    }
+    tiles->shown.size = kept;
+}
+
+// where canvas coordinate c lands on screen along an axis, shared edges of tiles land together
+static int screen(int base, float origin, float zoom, int c) {
+    return base + (int)floorf((c - origin) * zoom + 0.5f);
+}
+
+void imp_tiles_render(SDL_Renderer *renderer, ImpTiles *tiles, SDL_Rect dest, float x, float y,
+                      float zoom) {
+    tiles->frame++;
+    // canvas pixels in view
+    int cx0 = max((int)floorf(x), 0), cx1 = min((int)ceilf(x + dest.w / zoom), tiles->w);
+    int cy0 = max((int)floorf(y), 0), cy1 = min((int)ceilf(y + dest.h / zoom), tiles->h);
+    if (cx0 >= cx1 || cy0 >= cy1) {
+        drop_hidden(tiles);
+        return;
+    }
+
+    if (!tiles->fill) {
+        tiles->fill = SDL_CreateTexture(renderer, tiles->format, SDL_TEXTUREACCESS_STATIC, 1, 1);
+        SDL_UpdateTexture(tiles->fill, NULL, &tiles->background, 4);
+    }
+    SDL_RenderSetClipRect(renderer, &dest);
+    int sx0 = screen(dest.x, x, zoom, cx0), sy0 = screen(dest.y, y, zoom, cy0);
+    SDL_Rect visible = {sx0, sy0, screen(dest.x, x, zoom, cx1) - sx0, screen(dest.y, y, zoom, cy1) - sy0};
+    SDL_RenderCopy(renderer, tiles->fill, NULL, &visible);
+
+    // the level whose texels are closest to one screen pixel without being smaller
+    int level = zoom >= 1.0f ? 0 : min((int)floorf(log2f(1.0f / zoom)), LEVELS - 1);
+    for (int ty = cy0 / TILE; ty <= (cy1 - 1) / TILE; ++ty) {
+        for (int tx = cx0 / TILE; tx <= (cx1 - 1) / TILE; ++tx) {
+            uint32_t index = (uint32_t)(ty * tiles->cols + tx);
+            Tile *tile = &tiles->tiles[index];
+            if (!tile->pixels || tile_upload(renderer, tiles, index, level) != 0) {
+                continue;
+            }
+            tile->frame = tiles->frame;
+            // tiles on the right and bottom edges hang over the canvas, only its part is drawn
+            int w = min(TILE, tiles->w - tx * TILE), h = min(TILE, tiles->h - ty * TILE);
+            SDL_Rect src = {0, 0, max(w >> level, 1), max(h >> level, 1)};
+            int sx = screen(dest.x, x, zoom, tx * TILE), sy = screen(dest.y, y, zoom, ty * TILE);
+            SDL_Rect to = {sx, sy, screen(dest.x, x, zoom, tx * TILE + w) - sx,
+                           screen(dest.y, y, zoom, ty * TILE + h) - sy};
+            SDL_RenderCopy(renderer, tile->texture, &src, &to);
+        }
+    }
+    SDL_RenderSetClipRect(renderer, NULL);
+    drop_hidden(tiles);
+}
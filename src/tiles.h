@@ -0,0 +1,48 @@
+/* tiles.h - sparse tiled storage of a large canvas, drawn through mipmapped tile textures */
+#ifndef IMP_TILES_H
+#define IMP_TILES_H
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define IMP_TILE_SIZE 256
+#define IMP_TILES_MAX_SIZE 32768
+
+typedef struct ImpTiles ImpTiles;
+
+/**
+ * a w x h canvas of 32-bit pixels in SDL pixel format, up to IMP_TILES_MAX_SIZE on each side.
+ * every pixel starts as background and tiles are only allocated once something else is written
+ * to them, so memory follows the painted area rather than w * h
+ */
+ImpTiles *create_imp_tiles(int w, int h, uint32_t format, uint32_t background);
+void imp_tiles_free(ImpTiles *tiles);
+
+int imp_tiles_width(const ImpTiles *tiles);
+int imp_tiles_height(const ImpTiles *tiles);
+
+/**
+ * copies the pixels of area (canvas coordinates, must lie inside it) from src, whose rows are
+ * stride pixels apart. returns 0, or -1 when a tile could not be allocated
+ */
+int imp_tiles_write(ImpTiles *tiles, SDL_Rect area, const uint32_t *src, size_t stride);
+
+/** copies area (canvas coordinates, must lie inside it) into dest, rows stride pixels apart */
+void imp_tiles_read(const ImpTiles *tiles, SDL_Rect area, uint32_t *dest, size_t stride);
+
+/** sets bounds to the smallest rect holding every pixel that is not background, false if none */
+bool imp_tiles_painted(const ImpTiles *tiles, SDL_Rect *bounds);
+
+/**
+ * draws the canvas into dest with (x, y) at its top-left corner, zoom screen pixels per canvas
+ * pixel. only allocated tiles in view are drawn, each from the mip level nearest the zoom, and
+ * their textures are created on first sight and dropped once out of view
+ */
+void imp_tiles_render(SDL_Renderer *renderer, ImpTiles *tiles, SDL_Rect dest, float x, float y,
+                      float zoom);
+
+/** bytes of allocated tiles, mip levels included */
+size_t imp_tiles_bytes(const ImpTiles *tiles);
+
+#endif
@@ -114,12 +114,18 @@ void imp_actionmenu_event(ImpActionMenu *menu, SDL_Event *e, ImpCursor *cursor)
     }
 }
 
-void imp_actionmenu_render(SDL_Renderer *renderer, ImpActionMenu *menu) {
+void imp_actionmenu_render_static(SDL_Renderer *renderer, ImpActionMenu *menu) {
     SDL_RenderCopy(renderer, menu->bg, NULL, &menu->bg_rect);
 
     for (int i = 0; i < menu->n; ++i) {
         ImpActionButton *button = menu->buttons[i];
         SDL_RenderCopy(renderer, button->texture, NULL, &button->rect);
+    }
+}
+
+void imp_actionmenu_render(SDL_Renderer *renderer, ImpActionMenu *menu) {
+    for (int i = 0; i < menu->n; ++i) {
+        ImpActionButton *button = menu->buttons[i];
         if (button->clicked) {
             SDL_SetRenderDrawColor(renderer, 0, 0, 0, 200);
             SDL_RenderFillRect(renderer, &button->rect);
@@ -11,6 +11,9 @@ typedef struct ImpActionMenu ImpActionMenu;
 
 ImpActionMenu *create_imp_actionmenu(SDL_Renderer *renderer, ImpCanvas *canvas, char *bg_path);
 void imp_actionmenu_event(ImpActionMenu *menu, SDL_Event *e, ImpCursor *cursor);
+/** background and buttons, drawn into the cached ui layer */
+void imp_actionmenu_render_static(SDL_Renderer *renderer, ImpActionMenu *menu);
+/** shading of clicked buttons, drawn every frame */
 void imp_actionmenu_render(SDL_Renderer *renderer, ImpActionMenu *menu);
 void imp_actionmenu_ontoolchange(ImpActionMenu *menu, ImpTool tool);
 
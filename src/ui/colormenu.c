@@ -137,11 +137,13 @@ void imp_colormenu_event(ImpColorMenu *menu, SDL_Event *e, ImpCursor *cursor) {
 }
 
 void imp_colormenu_render(SDL_Renderer *renderer, ImpColorMenu *menu) {
-    SDL_RenderCopy(renderer, menu->bg, NULL, &menu->bg_rect);
-    
     u32 selected_color = menu->buttons[menu->selected]->color;
     SDL_SetRenderDrawColor(renderer, rgb_red(selected_color), rgb_green(selected_color), rgb_blue(selected_color), 255);
     SDL_RenderFillRect(renderer, &menu->display->rect);
+}
+
+void imp_colormenu_render_static(SDL_Renderer *renderer, ImpColorMenu *menu) {
+    SDL_RenderCopy(renderer, menu->bg, NULL, &menu->bg_rect);
 
     for (int i = 0; i < menu->n; ++i) {
         ImpColorButton *but = menu->buttons[i];
@@ -10,6 +10,9 @@ typedef struct ImpColorMenu ImpColorMenu;
 
 ImpColorMenu *create_imp_colormenu(SDL_Renderer *renderer, ImpCanvas *canvas);
 void imp_colormenu_event(ImpColorMenu *menu, SDL_Event *e, ImpCursor *cursor);
+/** background and color buttons, drawn into the cached ui layer */
+void imp_colormenu_render_static(SDL_Renderer *renderer, ImpColorMenu *menu);
+/** the selected color display, drawn every frame */
 void imp_colormenu_render(SDL_Renderer *renderer, ImpColorMenu *menu);
 
 #endif
\ No newline at end of file
@@ -140,7 +140,7 @@ ImpTool imp_toolmenu_event(ImpToolMenu *menu, SDL_Event *e, ImpCursor *cursor) {
     return 0;
 }
 
-void imp_toolmenu_render(SDL_Renderer *renderer, ImpToolMenu *menu) {
+void imp_toolmenu_render_static(SDL_Renderer *renderer, ImpToolMenu *menu) {
     SDL_RenderCopy(renderer, menu->bg, NULL, &menu->bg_rect);
 
     for (int i = 0; i < menu->n; ++i) {
@@ -149,10 +149,15 @@ void imp_toolmenu_render(SDL_Renderer *renderer, ImpToolMenu *menu) {
         if (button->tool == IMP_TOOL_NOTHING) {
             SDL_SetRenderDrawColor(renderer, 0, 0, 0, 150);
             SDL_RenderFillRect(renderer, &button->rect);
-        } else if (i == menu->selected) {
-            // TODO: render a slightly larger pre-loaded verison, about 10 px
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 50);
-            SDL_RenderFillRect(renderer, &button->rect);
         }
     }
 }
+
+void imp_toolmenu_render(SDL_Renderer *renderer, ImpToolMenu *menu) {
+    ImpToolButton *button = menu->buttons[menu->selected];
+    if (button->tool != IMP_TOOL_NOTHING) {
+        // TODO: render a slightly larger pre-loaded verison, about 10 px
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 50);
+        SDL_RenderFillRect(renderer, &button->rect);
+    }
+}
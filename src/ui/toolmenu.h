@@ -20,6 +20,9 @@ typedef enum ImpTool {
 
 ImpToolMenu *create_imp_toolmenu(SDL_Renderer *renderer, ImpCanvas *canvas, char *bg_path);
 ImpTool imp_toolmenu_event(ImpToolMenu *menu, SDL_Event *e, ImpCursor *cursor);
+/** background and buttons, drawn into the cached ui layer */
+void imp_toolmenu_render_static(SDL_Renderer *renderer, ImpToolMenu *menu);
+/** highlight of the selected tool, drawn every frame */
 void imp_toolmenu_render(SDL_Renderer *renderer, ImpToolMenu *menu);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,10 @@
 #ifndef VECTOR_H
 #define VECTOR_H
+#include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 typedef unsigned char uchar;
 typedef unsigned int uint;
@@ -8,32 +12,156 @@ typedef unsigned int uint;
 #define INITIAL_CAPACITY 10
 #define SCALING_FACTOR 2
 
-typedef struct {
-    uchar *arr;
-    uint size;
-    uint cap;
-} UCharVec;
-
-int UCharVec_init(UCharVec *vec);
-uint UCharVec_size(UCharVec *vec);
-void UCharVec_push(UCharVec *vec, uchar data);
-uchar UCharVec_get(UCharVec *vec, uint i);
-void UCharVec_copyto(UCharVec *vec, uchar* dest, uint dest_size);
-void UCharVec_free(UCharVec *vec);
-
-typedef struct {
-    uint32_t *arr;
-    uint size;
-    uint cap;
-} U32Vec;
-
-int U32Vec_init(U32Vec *vec);
-uint U32Vec_size(U32Vec *vec);
-void U32Vec_push(U32Vec *vec, uint32_t data);
-uint32_t U32Vec_get(U32Vec *vec, uint i);
-
-/** replaces contents of vec with src */
-void U32Vec_from(U32Vec *vec, uint32_t *src, uint nmemb);
-void U32Vec_free(U32Vec *vec);
-
-#endif
\ No newline at end of file
+/**
+ * typed growable arrays. VECTOR_DECLARE(Name, T) in a header plus VECTOR_DEFINE(Name, T) in one
+ * source file generate the functions below, VECTOR_DEFINE_STATIC(Name, T) does both with
+ * internal linkage for a vector private to one file. functions that allocate return 0 on
+ * success and -1 when out of memory, leaving the vector unchanged
+ *
+ *   int  Name_init(Name *vec)                  empty, allocates nothing
+ *   size_t Name_size(Name *vec)
+ *   int  Name_reserve(Name *vec, size_t cap)   capacity for cap elements in one allocation
+ *   int  Name_push(Name *vec, T data)
+ *   int  Name_append(Name *vec, const T *src, size_t n)
+ *   int  Name_resize(Name *vec, size_t n)      new elements are left uninitialized
+ *   T    Name_get(Name *vec, size_t i)
+ *   int  Name_copyto(Name *vec, T *dest, size_t dest_size)
+ *   int  Name_from(Name *vec, const T *src, size_t n)   replaces contents of vec with src
+ *   T   *Name_steal(Name *vec, size_t *size)   hands the buffer to the caller, vec becomes empty
+ *   void Name_clear(Name *vec)
+ *   void Name_free(Name *vec)
+ */
+#define VECTOR_TYPE(Name, T)                                                                       \
+    typedef struct Name {                                                                          \
+        T *arr;                                                                                    \
+        size_t size;                                                                               \
+        size_t cap;                                                                                \
+    } Name;
+
+#define VECTOR_PROTOTYPES(Name, T, linkage)                                                        \
+    linkage int Name##_init(Name *vec);                                                            \
+    linkage size_t Name##_size(Name *vec);                                                         \
+    linkage int Name##_reserve(Name *vec, size_t cap);                                             \
+    linkage int Name##_push(Name *vec, T data);                                                    \
+    linkage int Name##_append(Name *vec, const T *src, size_t n);                                  \
+    linkage int Name##_resize(Name *vec, size_t n);                                                \
+    linkage T Name##_get(Name *vec, size_t i);                                                     \
+    linkage int Name##_copyto(Name *vec, T *dest, size_t dest_size);                               \
+    linkage int Name##_from(Name *vec, const T *src, size_t n);                                    \
+    linkage T *Name##_steal(Name *vec, size_t *size);                                              \
+    linkage void Name##_clear(Name *vec);                                                          \
+    linkage void Name##_free(Name *vec);
+
+#define VECTOR_IMPL(Name, T, linkage)                                                              \
+    linkage int Name##_init(Name *vec) {                                                           \
+        assert(vec);                                                                               \
+        vec->arr = NULL;                                                                           \
+        vec->size = vec->cap = 0;                                                                  \
+        return 0;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    linkage size_t Name##_size(Name *vec) {                                                        \
+        assert(vec);                                                                               \
+        return vec->size;                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    linkage int Name##_reserve(Name *vec, size_t cap) {                                            \
+        assert(vec);                                                                               \
+        if (cap <= vec->cap)                                                                       \
+            return 0;                                                                              \
+        if (cap > SIZE_MAX / sizeof(T))                                                            \
+            return -1;                                                                             \
+        T *arr = realloc(vec->arr, cap * sizeof(T));                                               \
+        if (!arr)                                                                                  \
+            return -1;                                                                             \
+        vec->arr = arr;                                                                            \
+        vec->cap = cap;                                                                            \
+        return 0;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    /* geometric growth so n single pushes cost O(log n) reallocations */                          \
+    static int Name##_grow(Name *vec, size_t min_cap) {                                            \
+        if (min_cap <= vec->cap)                                                                   \
+            return 0;                                                                              \
+        size_t cap = vec->cap ? SCALING_FACTOR * vec->cap : INITIAL_CAPACITY;                      \
+        return Name##_reserve(vec, cap > min_cap ? cap : min_cap);                                 \
+    }                                                                                              \
+                                                                                                   \
+    linkage int Name##_push(Name *vec, T data) {                                                   \
+        assert(vec);                                                                               \
+        if (vec->size == vec->cap && Name##_grow(vec, vec->size + 1) != 0)                         \
+            return -1;                                                                             \
+        vec->arr[vec->size++] = data;                                                              \
+        return 0;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    linkage int Name##_append(Name *vec, const T *src, size_t n) {                                 \
+        assert(vec && (src || !n));                                                                \
+        if (n > SIZE_MAX - vec->size || Name##_grow(vec, vec->size + n) != 0)                      \
+            return -1;                                                                             \
+        if (n)                                                                                     \
+            memcpy(vec->arr + vec->size, src, n * sizeof(T));                                      \
+        vec->size += n;                                                                            \
+        return 0;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    linkage int Name##_resize(Name *vec, size_t n) {                                               \
+        assert(vec);                                                                               \
+        if (Name##_reserve(vec, n) != 0)                                                           \
+            return -1;                                                                             \
+        vec->size = n;                                                                             \
+        return 0;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    linkage T Name##_get(Name *vec, size_t i) {                                                    \
+        assert(vec && i < vec->size);                                                              \
+        return vec->arr[i];                                                                        \
+    }                                                                                              \
+                                                                                                   \
+    linkage int Name##_copyto(Name *vec, T *dest, size_t dest_size) {                              \
+        assert(vec && dest);                                                                       \
+        if (dest_size != vec->size)                                                                \
+            return -1;                                                                             \
+        if (dest_size)                                                                             \
+            memcpy(dest, vec->arr, dest_size * sizeof(T));                                         \
+        return 0;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    linkage int Name##_from(Name *vec, const T *src, size_t n) {                                   \
+        assert(vec && (src || !n));                                                                \
+        if (Name##_reserve(vec, n) != 0)                                                           \
+            return -1;                                                                             \
+        vec->size = 0;                                                                             \
+        return Name##_append(vec, src, n);                                                         \
+    }                                                                                              \
+                                                                                                   \
+    linkage T *Name##_steal(Name *vec, size_t *size) {                                             \
+        assert(vec);                                                                               \
+        T *arr = vec->arr;                                                                         \
+        if (size)                                                                                  \
+            *size = vec->size;                                                                     \
+        vec->arr = NULL;                                                                           \
+        vec->size = vec->cap = 0;                                                                  \
+        return arr;                                                                                \
+    }                                                                                              \
+                                                                                                   \
+    linkage void Name##_clear(Name *vec) {                                                         \
+        assert(vec);                                                                               \
+        vec->size = 0;                                                                             \
+    }                                                                                              \
+                                                                                                   \
+    linkage void Name##_free(Name *vec) {                                                          \
+        assert(vec);                                                                               \
+        free(vec->arr);                                                                            \
+        vec->arr = NULL;                                                                           \
+        vec->size = vec->cap = 0;                                                                  \
+    }
+
+#define VECTOR_DECLARE(Name, T) VECTOR_TYPE(Name, T) VECTOR_PROTOTYPES(Name, T, extern)
+#define VECTOR_DEFINE(Name, T) VECTOR_IMPL(Name, T, )
+#define VECTOR_DEFINE_STATIC(Name, T) VECTOR_TYPE(Name, T) VECTOR_IMPL(Name, T, static)
+
+VECTOR_DECLARE(UCharVec, uchar)
+VECTOR_DECLARE(U32Vec, uint32_t)
+
+#endif